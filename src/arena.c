@@ -0,0 +1,162 @@
+/*
+ * This file is part of the sse package, copyright (c) 2011, 2012, @radiospiel.
+ * It is copyrighted under the terms of the modified BSD license, see LICENSE.BSD.
+ *
+ * For more information see https://https://github.com/radiospiel/sse.
+ */
+
+#include "sse.h"
+#include "arena.h"
+
+#define ARENA_ALIGN(n) (((n) + sizeof(void*) - 1) & ~(sizeof(void*) - 1))
+#define ARENA_GROW_LIMIT  16    // max. size of the main block, in multiples of its initial size
+
+struct ArenaBlock {
+  struct ArenaBlock*  next;
+  size_t              size;
+  size_t              used;
+  char                data[];
+};
+
+void arena_init(struct Arena* arena, size_t size)
+{
+  memset(arena, 0, sizeof(*arena));
+
+  arena->size = arena->initial = ARENA_ALIGN(size);
+  arena->base = malloc(arena->size);
+  if(!arena->base)
+    die("malloc");
+}
+
+static void arena_free_overflow(struct Arena* arena)
+{
+  while(arena->overflow) {
+    struct ArenaBlock* next = arena->overflow->next;
+    free(arena->overflow);
+    arena->overflow = next;
+  }
+
+  arena->overflow_used = 0;
+}
+
+void arena_free(struct Arena* arena)
+{
+  arena_free_overflow(arena);
+  free(arena->base);
+
+  memset(arena, 0, sizeof(*arena));
+}
+
+/*
+ * try to fit \a len bytes at offset \a offset into a block of \a size
+ * bytes, whose used counter is at \a pused.
+ */
+static int arena_fits(size_t* pused, size_t size, size_t offset, size_t len)
+{
+  if(len > size - offset)
+    return 0;
+
+  *pused = offset + len;
+  return 1;
+}
+
+void* arena_alloc(struct Arena* arena, size_t len)
+{
+  char* ptr;
+
+  len = ARENA_ALIGN(len ? len : 1);
+
+  if(arena_fits(&arena->used, arena->size, arena->used, len)) {
+    ptr = arena->base + arena->used - len;
+  }
+  else {
+    struct ArenaBlock* block = arena->overflow;
+    if(!block || len > block->size - block->used) {
+      size_t size = len > arena->size ? len : arena->size;
+
+      block = malloc(sizeof(struct ArenaBlock) + size);
+      if(!block)
+        die("malloc");
+
+      block->next = arena->overflow;
+      block->size = size;
+      block->used = 0;
+      arena->overflow = block;
+    }
+
+    ptr = block->data + block->used;
+    block->used += len;
+    arena->overflow_used += len;
+  }
+
+  arena->last = ptr;
+  return ptr;
+}
+
+char* arena_strndup(struct Arena* arena, const char* s, size_t len)
+{
+  char* r = arena_alloc(arena, len + 1);
+  memcpy(r, s, len);
+  r[len] = 0;
+  return r;
+}
+
+void* arena_grow(struct Arena* arena, void* ptr, size_t old_len, size_t new_len)
+{
+  if(!ptr)
+    return arena_alloc(arena, new_len);
+
+  /*
+   * The most recent allocation can grow in place, if there is room in
+   * its block.
+   */
+  if(ptr == arena->last) {
+    char* p = ptr;
+    struct ArenaBlock* block = arena->overflow;
+
+    if(p >= arena->base && p < arena->base + arena->size) {
+      if(arena_fits(&arena->used, arena->size, p - arena->base, ARENA_ALIGN(new_len)))
+        return ptr;
+    }
+    else if(block && p >= block->data && p < block->data + block->size) {
+      size_t used = block->used;
+      if(arena_fits(&block->used, block->size, p - block->data, ARENA_ALIGN(new_len))) {
+        arena->overflow_used += block->used - used;
+        return ptr;
+      }
+    }
+  }
+
+  void* r = arena_alloc(arena, new_len);
+  memcpy(r, ptr, old_len < new_len ? old_len : new_len);
+  return r;
+}
+
+void arena_reset(struct Arena* arena)
+{
+  /*
+   * If the last record didn't fit into the main block, replace it with
+   * one that is big enough. A record that is way larger than usual does
+   * not grow the main block: it would hold on to that memory for good.
+   */
+  if(arena->overflow) {
+    size_t needed = arena->used + arena->overflow_used;
+    size_t size = arena->size ? arena->size : needed;
+    while(size < needed)
+      size *= 2;
+
+    arena_free_overflow(arena);
+
+    if(size <= arena->initial * ARENA_GROW_LIMIT) {
+      free(arena->base);
+      arena->base = malloc(size);
+      if(!arena->base)
+        die("malloc");
+
+      arena->size = size;
+    }
+  }
+
+  arena->used = 0;
+  arena->last = 0;
+}
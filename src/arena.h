@@ -0,0 +1,68 @@
+/*
+ * This file is part of the sse package, copyright (c) 2011, 2012, @radiospiel.
+ * It is copyrighted under the terms of the modified BSD license, see LICENSE.BSD.
+ *
+ * For more information see https://https://github.com/radiospiel/sse.
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/*
+ * A bump allocator. Allocations are served from a single block and are
+ * released all at once by arena_reset(). If a block runs full, further
+ * allocations go into overflow blocks; the next arena_reset() then
+ * replaces the main block with one that is big enough for all of it,
+ * so the arena grows only when an unusually large record comes in.
+ * The main block grows to at most ARENA_GROW_LIMIT times its initial
+ * size; a record larger than that is served from overflow blocks, which
+ * are released again by the next arena_reset().
+ */
+
+struct ArenaBlock;
+
+struct Arena {
+  char*               base;       // main block
+  size_t              size;       // size of the main block
+  size_t              initial;    // size of the main block as set up
+  size_t              used;       // bytes used in the main block
+  void*               last;       // most recent allocation
+  struct ArenaBlock*  overflow;   // overflow blocks, most recent first
+  size_t              overflow_used;
+};
+
+/*
+ * initialize an arena with a main block of \a size bytes.
+ */
+extern void arena_init(struct Arena* arena, size_t size);
+
+/*
+ * release all memory held by the arena.
+ */
+extern void arena_free(struct Arena* arena);
+
+/*
+ * allocate \a len bytes from the arena. Never returns NULL.
+ */
+extern void* arena_alloc(struct Arena* arena, size_t len);
+
+/*
+ * copy \a len bytes from \a s into the arena, and NUL terminate it.
+ */
+extern char* arena_strndup(struct Arena* arena, const char* s, size_t len);
+
+/*
+ * resize the allocation at \a ptr from \a old_len to \a new_len bytes.
+ * If \a ptr is the most recent allocation it is grown in place; else
+ * its contents are copied into a new allocation.
+ */
+extern void* arena_grow(struct Arena* arena, void* ptr, size_t old_len, size_t new_len);
+
+/*
+ * release all allocations at once.
+ */
+extern void arena_reset(struct Arena* arena);
+
+#endif
@@ -0,0 +1,183 @@
+/*
+ * This file is part of the sse package, copyright (c) 2011, 2012, @radiospiel.
+ * It is copyrighted under the terms of the modified BSD license, see LICENSE.BSD.
+ *
+ * For more information see https://https://github.com/radiospiel/sse.
+ */
+
+/*
+ * The binary output format; see sse-binary.h. Records are built right 
+ * from the parser's event views, and go to the output writer.
+ */
+
+#include "sse.h"
+#include "json.h"
+#include "sse-binary.h"
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "the binary output format is implemented for little endian hosts only"
+#endif
+
+#define ALIGN8(n) (((n) + 7) & ~(size_t) 7)
+
+static struct Buffer record;    // the record being built
+static struct Buffer joined;    // data of events with more than one data line
+static struct Buffer matches;   // the struct Match'es of the current event
+
+struct Match {
+  int         path;
+  const char* value;
+  size_t      len;
+};
+
+void binary_init()
+{
+  const struct JSONMatcher* matcher = parse_json_matcher();
+  struct SSEBinaryHeader header;
+  size_t size = sizeof(header);
+  int i;
+
+  for(i = 0; i < matcher->npaths; ++i)
+    size += strlen(matcher->paths[i]) + 1;
+  size = ALIGN8(size);
+
+  memcpy(header.magic, SSE_BINARY_MAGIC, 4);
+  header.version = SSE_BINARY_VERSION;
+  header.size = size;
+  header.npaths = matcher->npaths;
+
+  char* p = buffer_reserve(&record, size);
+  memset(p, 0, size);
+  memcpy(p, &header, sizeof(header));
+  p += sizeof(header);
+
+  for(i = 0; i < matcher->npaths; ++i) {
+    strcpy(p, matcher->paths[i]);
+    p += strlen(p) + 1;
+  }
+
+  output_header(record.data, size);
+}
+
+static void on_match(int path, const char* value, size_t len, void* context)
+{
+  struct Match match = { path, value, len };
+  buffer_append(&matches, (const char*) &match, sizeof(match));
+}
+
+/*
+ * copy \a len bytes from \a s into the record at \a *pos, and fill in
+ * \a slice.
+ */
+static void put_string(struct SSEBinarySlice* slice, size_t* pos, const char* s, size_t len)
+{
+  memcpy(record.data + *pos, s, len);
+  record.data[*pos + len] = 0;
+
+  slice->offset = *pos;
+  slice->len = len;
+  *pos += len + 1;
+}
+
+/*
+ * returns the event's data. Data lines are joined by newlines.
+ */
+static struct SSESlice event_data(const struct SSEEvent* event)
+{
+  struct SSESlice data = { "", 0 };
+  unsigned i, ndata = 0;
+
+  for(i = 0; i < event->nfields; ++i) {
+    const struct SSEField* field = event->fields + i;
+    if(field->type != SSE_FIELD_DATA)
+      continue;
+
+    if(ndata++ == 0) {
+      data = field->value;
+      joined.len = 0;
+      continue;
+    }
+
+    if(ndata == 2)
+      buffer_append(&joined, data.ptr, data.len);
+
+    buffer_append(&joined, "\n", 1);
+    buffer_append(&joined, field->value.ptr, field->value.len);
+  }
+
+  if(ndata > 1) {
+    data.ptr = joined.data;
+    data.len = joined.len;
+  }
+
+  return data;
+}
+
+void binary_on_event(const struct SSEEvent* event, void* context)
+{
+  const struct SSESlice* id = sse_event_get(event, SSE_FIELD_ID);
+  const struct SSESlice* type = sse_event_get(event, SSE_FIELD_EVENT);
+  const struct SSESlice* reply = sse_event_get(event, SSE_FIELD_REPLY);
+  struct SSESlice data = event_data(event);
+
+  /* find the projected values */
+  matches.len = 0;
+  if(json_match(parse_json_matcher(), data.ptr, data.len, on_match, 0) < 0)
+    fprintf(stderr, "error: invalid JSON\n");
+  else if(!matches.len)
+    fprintf(stderr, "error: no JSON path found in event data\n");
+
+  const struct Match* match = (const struct Match*) matches.data;
+  unsigned nvalues = matches.len / sizeof(struct Match), i;
+
+  /* 
+   * the size of the record; unescaped values are never longer than 
+   * their JSON text.
+   */
+  size_t size = sizeof(struct SSEBinaryRecord) + nvalues * sizeof(struct SSEBinaryValue);
+  size += (id ? id->len + 1 : 0) + (type ? type->len + 1 : 0) + data.len + 1;
+  for(i = 0; i < nvalues; ++i)
+    size += match[i].len + 1;
+  size = ALIGN8(size);
+
+  /* sizes and offsets in a record are 32 bit. */
+  if(size > UINT32_MAX) {
+    fprintf(stderr, "record exceeds %lu byte, dropping event\n", (unsigned long) UINT32_MAX);
+    return;
+  }
+
+  record.len = 0;
+  memset(buffer_reserve(&record, size), 0, size);
+
+  struct SSEBinaryRecord* r = (struct SSEBinaryRecord*) record.data;
+  size_t pos = sizeof(struct SSEBinaryRecord) + nvalues * sizeof(struct SSEBinaryValue);
+
+  r->nvalues = nvalues;
+  if(id)
+    put_string(&r->id, &pos, id->ptr, id->len);
+  if(type)
+    put_string(&r->event, &pos, type->ptr, type->len);
+  put_string(&r->data, &pos, data.ptr, data.len);
+
+  int counts[JSON_MAX_NODES] = { 0 };
+  for(i = 0; i < nvalues; ++i) {
+    struct SSEBinaryValue* value = r->values + i;
+
+    value->path = match[i].path;
+    value->index = counts[match[i].path]++;
+    value->value.offset = pos;
+    value->value.len = json_unescape(match[i].value, match[i].len, record.data + pos);
+
+    record.data[pos + value->value.len] = 0;
+    pos += value->value.len + 1;
+  }
+
+  r->size = ALIGN8(pos);
+  output_write(type ? record.data + r->event.offset : 0, record.data, r->size);
+
+  if(reply) {
+    char* url = strndup(reply->ptr, reply->len);
+    send_reply(url, id ? record.data + r->id.offset : 0, "", 0);
+    free(url);
+  }
+}
@@ -0,0 +1,152 @@
+/*
+ * This file is part of the sse package, copyright (c) 2011, 2012, @radiospiel.
+ * It is copyrighted under the terms of the modified BSD license, see LICENSE.BSD.
+ *
+ * For more information see https://https://github.com/radiospiel/sse.
+ */
+
+/*
+ * A pool of threads that extract JSON from events.
+ *
+ * Events are numbered as they are submitted, and put into a ring of
+ * slots. Workers take the slots in order, and decode them concurrently.
+ * Whichever worker finishes the oldest outstanding event becomes the
+ * writer, and writes out all finished events in sequence; so the output
+ * is in stream order, no matter which worker is done first.
+ *
+ * When the ring is full, submitting an event blocks until the oldest
+ * event is written. Threads submitting events take turns.
+ */
+
+#include <pthread.h>
+#include "sse.h"
+
+#define DECODE_QUEUE_SIZE 256
+
+struct DecodeJob {
+  char*         data;
+  char*         event_id;
+  char*         event_type;
+  const char*   stream;         // the stream's tag; it is never freed
+  struct Buffer out;
+  int           done;
+};
+
+static struct DecodeJob jobs[DECODE_QUEUE_SIZE];
+
+static unsigned long submit_seq = 0;    // next event to submit
+static unsigned long take_seq = 0;      // next event to decode
+static unsigned long write_seq = 0;     // next event to write
+static int writing = 0;                 // set while a worker writes
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t submit_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  has_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  has_room = PTHREAD_COND_INITIALIZER;
+
+/*
+ * write all events that are done, starting at write_seq. Must be called
+ * with the lock held.
+ */
+static void write_done_jobs()
+{
+  if(writing)
+    return;
+
+  writing = 1;
+
+  while(write_seq < take_seq && jobs[write_seq % DECODE_QUEUE_SIZE].done) {
+    struct DecodeJob* job = jobs + write_seq % DECODE_QUEUE_SIZE;
+
+    pthread_mutex_unlock(&lock);
+    output_write(job->event_type, job->out.data, job->out.len);
+    pthread_mutex_lock(&lock);
+
+    free(job->event_type);
+    job->event_type = 0;
+
+    job->done = 0;
+    write_seq++;
+    pthread_cond_broadcast(&has_room);
+  }
+
+  writing = 0;
+}
+
+static void* decode_worker(void* arg)
+{
+  pthread_mutex_lock(&lock);
+
+  while(1) {
+    while(take_seq == submit_seq)
+      pthread_cond_wait(&has_work, &lock);
+
+    struct DecodeJob* job = jobs + take_seq++ % DECODE_QUEUE_SIZE;
+    pthread_mutex_unlock(&lock);
+
+    parse_json(job->data, job->event_id, job->stream, &job->out);
+
+    free(job->data);
+    free(job->event_id);
+    job->data = job->event_id = 0;
+
+    pthread_mutex_lock(&lock);
+    job->done = 1;
+    write_done_jobs();
+  }
+
+  return 0;
+}
+
+void decode_pool_start(int n)
+{
+  while(n-- > 0) {
+    pthread_t thread;
+    if(pthread_create(&thread, 0, decode_worker, 0))
+      die("pthread_create");
+    pthread_detach(thread);
+  }
+
+  atexit(decode_pool_drain);
+}
+
+void decode_pool_submit(char** headers, const char** values, const char* data)
+{
+  pthread_mutex_lock(&submit_lock);
+  pthread_mutex_lock(&lock);
+
+  while(submit_seq - write_seq >= DECODE_QUEUE_SIZE)
+    pthread_cond_wait(&has_room, &lock);
+
+  struct DecodeJob* job = jobs + submit_seq % DECODE_QUEUE_SIZE;
+  pthread_mutex_unlock(&lock);
+
+  /*
+   * The slot is ours until submit_seq is advanced. The headers are
+   * formatted right here, the JSON is extracted by a worker.
+   */
+  job->out.len = 0;
+  format_event(headers, values, data, &job->out);
+
+  job->data = strdup(data);
+  job->event_id = values[SSE_FIELD_ID] ? strdup(values[SSE_FIELD_ID]) : 0;
+  job->event_type = values[SSE_FIELD_EVENT] ? strdup(values[SSE_FIELD_EVENT]) : 0;
+  job->stream = values[SSE_FIELD_STREAM];
+
+  pthread_mutex_lock(&lock);
+  submit_seq++;
+  pthread_cond_signal(&has_work);
+  pthread_mutex_unlock(&lock);
+  pthread_mutex_unlock(&submit_lock);
+}
+
+void decode_pool_drain()
+{
+  pthread_mutex_lock(&lock);
+
+  while(write_seq < submit_seq)
+    pthread_cond_wait(&has_room, &lock);
+
+  pthread_mutex_unlock(&lock);
+  output_flush();
+}
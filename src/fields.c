@@ -0,0 +1,145 @@
+/*
+ * This file is part of the sse package, copyright (c) 2011, 2012, @radiospiel.
+ * It is copyrighted under the terms of the modified BSD license, see LICENSE.BSD.
+ *
+ * For more information see https://https://github.com/radiospiel/sse.
+ */
+
+/*
+ * The field dictionary maps field names to numeric field ids via a
+ * perfect hash: each known name hashes into a table slot of its own, so
+ * a lookup costs one hash and one compare.
+ *
+ * The table for the built-in fields is precomputed. Registering extra
+ * fields at startup generates a new table.
+ */
+
+#include <stdint.h>
+#include "sse.h"
+
+#define FIELD_TABLE_BITS  5
+#define FIELD_TABLE_SIZE  (1 << FIELD_TABLE_BITS)
+
+struct FieldName {
+  const char* name;
+  size_t      len;
+  const char* upcased;   // the name in uppercase, as used in headers
+};
+
+static struct FieldName field_names[SSE_MAX_FIELDS] = {
+  [SSE_FIELD_EVENT] = { "event", 5, "EVENT" },
+  [SSE_FIELD_ID]    = { "id",    2, "ID"    },
+  [SSE_FIELD_RETRY] = { "retry", 5, "RETRY" },
+  [SSE_FIELD_DATA]  = { "data",  4, "DATA"  },
+  [SSE_FIELD_REPLY] = { "reply", 5, "REPLY" },
+};
+
+static int field_count = SSE_FIELD_EXTRA;
+
+/*
+ * The perfect hash for the built-in fields, as generated by fields_rehash.
+ */
+static unsigned field_seed = 1;
+
+static unsigned char field_table[FIELD_TABLE_SIZE] = {
+  [4]  = SSE_FIELD_EVENT,
+  [22] = SSE_FIELD_ID,
+  [13] = SSE_FIELD_RETRY,
+  [31] = SSE_FIELD_DATA,
+  [20] = SSE_FIELD_REPLY,
+};
+
+/*
+ * a seeded FNV-1a hash, with a final mix so that names differing only 
+ * in their last character spread well. The table index is taken from 
+ * the upper bits.
+ */
+static unsigned field_hash(unsigned seed, const char* name, size_t len)
+{
+  uint32_t h = seed;
+  while(len--)
+    h = (h ^ (unsigned char) *name++) * 16777619u;
+
+  h ^= h >> 16;
+  h *= 0x45d9f3bu;
+  h ^= h >> 16;
+
+  return h >> (32 - FIELD_TABLE_BITS);
+}
+
+/*
+ * find a seed that maps all registered names into distinct table slots.
+ */
+static void fields_rehash()
+{
+  unsigned seed;
+
+  for(seed = 1; seed < (1 << 20); ++seed) {
+    memset(field_table, 0, sizeof(field_table));
+
+    int id;
+    for(id = SSE_FIELD_EVENT; id < field_count; ++id) {
+      if(!field_names[id].name)
+        continue;
+
+      unsigned char* slot = field_table + field_hash(seed, field_names[id].name, field_names[id].len);
+      if(*slot) break;
+
+      *slot = id;
+    }
+
+    if(id == field_count) {
+      field_seed = seed;
+      return;
+    }
+  }
+
+  fprintf(stderr, "Cannot build field dictionary.\n");
+  exit(1);
+}
+
+int sse_field_register(const char* name)
+{
+  size_t len = strlen(name);
+  int id = sse_field_lookup(name, len);
+  if(id != SSE_FIELD_OTHER)
+    return id;
+
+  if(field_count == SSE_MAX_FIELDS) {
+    fprintf(stderr, "Too many fields, the limit is %d.\n", SSE_MAX_FIELDS - SSE_FIELD_EXTRA);
+    exit(1);
+  }
+
+  char* upcased = strdup(name);
+  char* s;
+  for(s = upcased; *s; ++s)
+    *s = toupper(*s);
+
+  id = field_count++;
+  field_names[id].name = name;
+  field_names[id].len = len;
+  field_names[id].upcased = upcased;
+
+  fields_rehash();
+  return id;
+}
+
+int sse_field_lookup(const char* name, size_t len)
+{
+  int id = field_table[field_hash(field_seed, name, len)];
+
+  if(id && field_names[id].len == len && !memcmp(field_names[id].name, name, len))
+    return id;
+
+  return SSE_FIELD_OTHER;
+}
+
+const char* sse_field_name(int id)
+{
+  return field_names[id].name;
+}
+
+const char* sse_field_upcased(int id)
+{
+  return field_names[id].upcased;
+}
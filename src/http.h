@@ -12,24 +12,9 @@
 #include <curl/curl.h>
 
 /*
- * send HTTP request.
+ * set our defaults - user agent, redirects, TLS settings - on \a curl.
  */
-
-#define HTTP_GET  0
-#define HTTP_POST 1
-
-extern void http(int  verb,
-  const char*   url, 
-  const char**  http_headers, 
-
-  const char*   body, 
-  unsigned      bodyLenght,
-
-  size_t        (*on_data)(char *ptr, size_t size, size_t nmemb, void *userdata),
-  const char*   (*on_verify)(CURL* curl)
-);
-
-extern char curl_error_buf[];
+extern void http_setup(CURL* curl);
 
 extern size_t http_ignore_data(char *ptr, size_t size, size_t nmemb, void *userdata);
 
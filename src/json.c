@@ -0,0 +1,579 @@
+/*
+ * This file is part of the sse package, copyright (c) 2011, 2012, @radiospiel.
+ * It is copyrighted under the terms of the modified BSD license, see LICENSE.BSD.
+ *
+ * For more information see https://https://github.com/radiospiel/sse.
+ */
+
+#include "sse.h"
+#include "json.h"
+
+/* === compiling paths ============================================= */
+
+void json_matcher_init(struct JSONMatcher* matcher)
+{
+  memset(matcher, 0, sizeof(*matcher));
+
+  matcher->nnodes = 1;
+  matcher->nodes[0].path = -1;
+  matcher->nodes[0].first_child = -1;
+  matcher->nodes[0].next_sibling = -1;
+}
+
+/*
+ * find or add the child of \a parent for the member \a key (if \a key
+ * is set) or the array element \a index.
+ */
+static int json_matcher_child(struct JSONMatcher* matcher, int parent,
+                              const char* key, size_t key_len, int index)
+{
+  int n;
+  for(n = matcher->nodes[parent].first_child; n != -1; n = matcher->nodes[n].next_sibling) {
+    struct JSONNode* node = matcher->nodes + n;
+
+    if(key && node->key && node->key_len == key_len && !memcmp(node->key, key, key_len))
+      return n;
+    if(!key && !node->key && node->index == index)
+      return n;
+  }
+
+  if(matcher->nnodes == JSON_MAX_NODES)
+    return -1;
+
+  n = matcher->nnodes++;
+
+  struct JSONNode* node = matcher->nodes + n;
+  node->key = key;
+  node->key_len = key_len;
+  node->index = index;
+  node->repeated = matcher->nodes[parent].repeated || (!key && index == -1);
+  node->path = -1;
+  node->first_child = -1;
+  node->next_sibling = matcher->nodes[parent].first_child;
+  matcher->nodes[parent].first_child = n;
+
+  return n;
+}
+
+int json_matcher_add(struct JSONMatcher* matcher, const char* path)
+{
+  const char* p = path;
+  int node = 0;
+
+  while(*p) {
+    if(*p == '[') {
+      char* end;
+      long index = strtol(p + 1, &end, 10);
+      if(end == p + 1 && *end == ']')
+        index = -1;
+      else if(end == p + 1 || *end != ']' || index < 0)
+        return -1;
+
+      node = json_matcher_child(matcher, node, NULL, 0, (int) index);
+      p = end + 1;
+
+      if(*p && *p != '.' && *p != '[')
+        return -1;
+    }
+    else {
+      const char* key = p;
+      while(*p && *p != '.' && *p != '[')
+        ++p;
+
+      if(p == key)
+        return -1;
+
+      node = json_matcher_child(matcher, node, key, p - key, 0);
+    }
+
+    if(node < 0)
+      return -1;
+
+    if(*p == '.' && (!p[1] || p[1] == '.' || p[1] == '['))
+      return -1;
+    if(*p == '.')
+      ++p;
+  }
+
+  if(!node || matcher->nodes[node].path != -1)
+    return -1;
+
+  matcher->nodes[node].path = matcher->npaths;
+  matcher->paths[matcher->npaths] = path;
+  return matcher->npaths++;
+}
+
+/* === scanning ==================================================== */
+
+struct JSONScan {
+  const struct JSONMatcher* matcher;
+  const char*     end;
+  int             pending;            // number of nodes not yet done, 
+                                      // not counting repeated nodes
+  int             stop;               // set when all nodes are done
+  unsigned char   done[JSON_MAX_NODES];
+
+  void            (*on_match)(int path, const char* value, size_t len, void* context);
+  void*           context;
+};
+
+static const char* skip_ws(const char* p, const char* end)
+{
+  while(p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t'))
+    ++p;
+  return p;
+}
+
+/*
+ * skip a string; \a p points after the opening quote. Returns a pointer
+ * after the closing quote, or NULL.
+ */
+static const char* skip_string(const char* p, const char* end)
+{
+  while(1) {
+    const char* quote = memchr(p, '"', end - p);
+    if(!quote)
+      return NULL;
+
+    /* the quote is escaped if it follows an odd number of backslashes */
+    const char* s = quote;
+    while(s > p && s[-1] == '\\')
+      --s;
+
+    if(!((quote - s) & 1))
+      return quote + 1;
+
+    p = quote + 1;
+  }
+}
+
+/*
+ * skip the rest of a container, \a depth levels deep.
+ */
+static const char* skip_nested(const char* p, const char* end, int depth)
+{
+  while(p < end) {
+    switch(*p++) {
+      case '"':
+        if(!(p = skip_string(p, end))) return NULL;
+        break;
+      case '{': case '[':
+        ++depth;
+        break;
+      case '}': case ']':
+        if(!--depth) return p;
+        break;
+    }
+  }
+
+  return NULL;
+}
+
+static const char* skip_value(const char* p, const char* end)
+{
+  if(p >= end)
+    return NULL;
+
+  switch(*p) {
+    case '"':           return skip_string(p + 1, end);
+    case '{': case '[': return skip_nested(p + 1, end, 1);
+  }
+
+  const char* s = p;
+  while(p < end && !strchr(",:}] \t\r\n", *p))
+    ++p;
+
+  return p > s ? p : NULL;
+}
+
+static const char* match_value(struct JSONScan* scan, const char* p, int n);
+
+/*
+ * mark node \a n as done. Once all nodes are done, scanning stops.
+ */
+static void node_done(struct JSONScan* scan, int n)
+{
+  scan->done[n] = 1;
+  if(scan->matcher->nodes[n].repeated)
+    return;
+
+  if(!--scan->pending)
+    scan->stop = 1;
+}
+
+/*
+ * Nodes below a "[]" step are looked for in each array element anew.
+ */
+static void clear_done(struct JSONScan* scan, int n)
+{
+  int c;
+
+  scan->done[n] = 0;
+  for(c = scan->matcher->nodes[n].first_child; c != -1; c = scan->matcher->nodes[c].next_sibling)
+    clear_done(scan, c);
+}
+
+/*
+ * When all children of node \a n are done there is nothing left to look
+ * for in its value. Unless the value itself is to be reported, the node
+ * is done, too.
+ */
+static const char* finish_container(struct JSONScan* scan, const char* p, int n)
+{
+  if(scan->matcher->nodes[n].path == -1) {
+    node_done(scan, n);
+    if(scan->stop)
+      return NULL;
+  }
+
+  return skip_nested(p, scan->end, 1);
+}
+
+/*
+ * are all children of node \a n done? A "[]" child is never done, as
+ * long as there might be more elements.
+ */
+static int children_done(struct JSONScan* scan, int n)
+{
+  const struct JSONNode* nodes = scan->matcher->nodes;
+  int c;
+
+  for(c = nodes[n].first_child; c != -1; c = nodes[c].next_sibling) {
+    if(!scan->done[c] || (!nodes[c].key && nodes[c].index == -1))
+      return 0;
+  }
+  return 1;
+}
+
+static const char* match_object(struct JSONScan* scan, const char* p, int n)
+{
+  const struct JSONMatcher* matcher = scan->matcher;
+  const char* end = scan->end;
+
+  p = skip_ws(p + 1, end);
+  if(p < end && *p == '}')
+    return p + 1;
+
+  while(p < end) {
+    /* key */
+    if(*p != '"')
+      return NULL;
+
+    const char* key = p + 1;
+    if(!(p = skip_string(key, end)))
+      return NULL;
+
+    size_t key_len = p - 1 - key;
+
+    p = skip_ws(p, end);
+    if(p >= end || *p != ':')
+      return NULL;
+    p = skip_ws(p + 1, end);
+
+    /* value */
+    int c;
+    for(c = matcher->nodes[n].first_child; c != -1; c = matcher->nodes[c].next_sibling) {
+      const struct JSONNode* child = matcher->nodes + c;
+      if(child->key && child->key_len == key_len && !memcmp(child->key, key, key_len))
+        break;
+    }
+
+    p = (c != -1 && !scan->done[c]) ? match_value(scan, p, c) : skip_value(p, end);
+    if(!p)
+      return NULL;
+
+    /* nothing left to look for in here? */
+    if(children_done(scan, n))
+      return finish_container(scan, p, n);
+
+    p = skip_ws(p, end);
+    if(p < end && *p == '}')
+      return p + 1;
+    if(p >= end || *p != ',')
+      return NULL;
+
+    p = skip_ws(p + 1, end);
+  }
+
+  return NULL;
+}
+
+static const char* match_array(struct JSONScan* scan, const char* p, int n)
+{
+  const struct JSONMatcher* matcher = scan->matcher;
+  const char* end = scan->end;
+  int index = 0;
+
+  p = skip_ws(p + 1, end);
+  if(p < end && *p == ']')
+    return p + 1;
+
+  while(p < end) {
+    int exact = -1, all = -1, c;
+    for(c = matcher->nodes[n].first_child; c != -1; c = matcher->nodes[c].next_sibling) {
+      const struct JSONNode* child = matcher->nodes + c;
+      if(child->key) 
+        continue;
+
+      if(child->index == index)
+        exact = c;
+      else if(child->index == -1)
+        all = c;
+    }
+
+    /*
+     * If an element is matched by both an index and a "[]" step it is
+     * scanned twice.
+     */
+    const char* element = p;
+
+    if(exact != -1 && !scan->done[exact])
+      p = match_value(scan, element, exact);
+    else if(all == -1)
+      p = skip_value(element, end);
+
+    if(p && all != -1) {
+      clear_done(scan, all);
+      p = match_value(scan, element, all);
+    }
+
+    if(!p)
+      return NULL;
+
+    ++index;
+
+    /* nothing left to look for in here? */
+    if(children_done(scan, n))
+      return finish_container(scan, p, n);
+
+    p = skip_ws(p, end);
+    if(p < end && *p == ']')
+      return p + 1;
+    if(p >= end || *p != ',')
+      return NULL;
+
+    p = skip_ws(p + 1, end);
+  }
+
+  return NULL;
+}
+
+/*
+ * match the value at \a p against the matcher node \a n.
+ */
+static const char* match_value(struct JSONScan* scan, const char* p, int n)
+{
+  const struct JSONNode* node = scan->matcher->nodes + n;
+  const char* start = p;
+
+  if(node->first_child == -1 || p >= scan->end)
+    p = skip_value(p, scan->end);
+  else if(*p == '{')
+    p = match_object(scan, p, n);
+  else if(*p == '[')
+    p = match_array(scan, p, n);
+  else
+    p = skip_value(p, scan->end);
+
+  if(!p || scan->stop)
+    return NULL;
+
+  if(node->path != -1)
+    scan->on_match(node->path, start, p - start, scan->context);
+
+  if(!scan->done[n])
+    node_done(scan, n);
+
+  return scan->stop ? NULL : p;
+}
+
+int json_match(const struct JSONMatcher* matcher, const char* json, size_t len,
+               void (*on_match)(int path, const char* value, size_t len, void* context),
+               void* context)
+{
+  struct JSONScan scan;
+
+  scan.matcher = matcher;
+  scan.end = json + len;
+  scan.pending = 0;
+  scan.stop = 0;
+  scan.on_match = on_match;
+  scan.context = context;
+  memset(scan.done, 0, matcher->nnodes);
+
+  int n;
+  for(n = 0; n < matcher->nnodes; ++n) {
+    if(!matcher->nodes[n].repeated)
+      scan.pending++;
+  }
+
+  const char* p = match_value(&scan, skip_ws(json, scan.end), 0);
+  if(scan.stop)
+    return 0;
+
+  return p && skip_ws(p, scan.end) == scan.end ? 0 : -1;
+}
+
+/* === strings ===================================================== */
+
+static int hex_value(const char* p)
+{
+  int value = 0, i;
+  for(i = 0; i < 4; ++i) {
+    char ch = p[i];
+    value <<= 4;
+    if(ch >= '0' && ch <= '9')      value |= ch - '0';
+    else if(ch >= 'a' && ch <= 'f') value |= ch - 'a' + 10;
+    else if(ch >= 'A' && ch <= 'F') value |= ch - 'A' + 10;
+    else return -1;
+  }
+  return value;
+}
+
+static char* put_utf8(char* d, unsigned cp)
+{
+  if(cp < 0x80) {
+    *d++ = cp;
+  }
+  else if(cp < 0x800) {
+    *d++ = 0xc0 | (cp >> 6);
+    *d++ = 0x80 | (cp & 0x3f);
+  }
+  else if(cp < 0x10000) {
+    *d++ = 0xe0 | (cp >> 12);
+    *d++ = 0x80 | ((cp >> 6) & 0x3f);
+    *d++ = 0x80 | (cp & 0x3f);
+  }
+  else {
+    *d++ = 0xf0 | (cp >> 18);
+    *d++ = 0x80 | ((cp >> 12) & 0x3f);
+    *d++ = 0x80 | ((cp >> 6) & 0x3f);
+    *d++ = 0x80 | (cp & 0x3f);
+  }
+  return d;
+}
+
+size_t json_unescape(const char* value, size_t len, char* dest)
+{
+  if(len < 2 || *value != '"') {
+    memcpy(dest, value, len);
+    return len;
+  }
+
+  const char* p = value + 1;
+  const char* end = value + len - 1;
+  char* d = dest;
+
+  while(p < end) {
+    const char* backslash = memchr(p, '\\', end - p);
+    if(!backslash)
+      backslash = end;
+
+    memcpy(d, p, backslash - p);
+    d += backslash - p;
+    p = backslash;
+
+    if(p + 1 >= end)
+      break;
+
+    switch(p[1]) {
+      case 'b': *d++ = '\b'; p += 2; break;
+      case 'f': *d++ = '\f'; p += 2; break;
+      case 'n': *d++ = '\n'; p += 2; break;
+      case 'r': *d++ = '\r'; p += 2; break;
+      case 't': *d++ = '\t'; p += 2; break;
+      case 'u': {
+        int cp = end - p >= 6 ? hex_value(p + 2) : -1;
+        if(cp < 0) {
+          *d++ = *p++;
+          break;
+        }
+        p += 6;
+
+        /* a surrogate pair */
+        if(cp >= 0xd800 && cp < 0xdc00 && end - p >= 6 && p[0] == '\\' && p[1] == 'u') {
+          int lo = hex_value(p + 2);
+          if(lo >= 0xdc00 && lo < 0xe000) {
+            cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+            p += 6;
+          }
+        }
+
+        d = put_utf8(d, cp);
+        break;
+      }
+      default:  *d++ = p[1]; p += 2; break;
+    }
+  }
+
+  return d - dest;
+}
+
+size_t json_escape(const char* s, size_t len, char* dest)
+{
+  static const char hex[] = "0123456789abcdef";
+  const unsigned char* p = (const unsigned char*) s;
+  const unsigned char* end = p + len;
+  char* d = dest;
+
+  while(p < end) {
+    /* copy runs of plain characters in one go */
+    const unsigned char* run = p;
+    while(p < end && *p >= 0x20 && *p != '"' && *p != '\\')
+      ++p;
+
+    memcpy(d, run, p - run);
+    d += p - run;
+
+    if(p == end)
+      break;
+
+    *d++ = '\\';
+    switch(*p) {
+      case '"':  *d++ = '"'; break;
+      case '\\': *d++ = '\\'; break;
+      case '\b': *d++ = 'b'; break;
+      case '\f': *d++ = 'f'; break;
+      case '\n': *d++ = 'n'; break;
+      case '\r': *d++ = 'r'; break;
+      case '\t': *d++ = 't'; break;
+      default:
+        *d++ = 'u';
+        *d++ = '0';
+        *d++ = '0';
+        *d++ = hex[*p >> 4];
+        *d++ = hex[*p & 15];
+        break;
+    }
+    ++p;
+  }
+
+  return d - dest;
+}
+
+size_t json_compact(const char* value, size_t len, char* dest)
+{
+  const char* p = value;
+  const char* end = value + len;
+  char* d = dest;
+
+  while(p < end) {
+    if(*p == '"') {
+      const char* s = skip_string(p + 1, end);
+      if(!s)
+        s = end;
+
+      memcpy(d, p, s - p);
+      d += s - p;
+      p = s;
+    }
+    else if(*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t') {
+      ++p;
+    }
+    else {
+      *d++ = *p++;
+    }
+  }
+
+  return d - dest;
+}
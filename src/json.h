@@ -0,0 +1,86 @@
+/*
+ * This file is part of the sse package, copyright (c) 2011, 2012, @radiospiel.
+ * It is copyrighted under the terms of the modified BSD license, see LICENSE.BSD.
+ *
+ * For more information see https://https://github.com/radiospiel/sse.
+ */
+
+#ifndef JSON_H
+#define JSON_H
+
+#include <stddef.h>
+
+/*
+ * Streaming JSON projection.
+ *
+ * A set of paths, like "metrics.messages[0].message", is compiled into a
+ * matcher once; a "[]" step matches all elements of an array, as in
+ * "metrics.messages[].message". json_match then walks a JSON text and
+ * reports the raw text of each value found at one of these paths. It
+ * does not build a tree and does not allocate; subtrees that no path
+ * leads into are just skipped, and scanning stops as soon as all paths
+ * have been found.
+ */
+
+#define JSON_MAX_NODES 64
+
+struct JSONNode {
+  const char* key;          // member name, or NULL for an array element
+  size_t      key_len;
+  int         index;        // array index, or -1 for all elements
+  int         repeated;     // set if the node is at or below a "[]" step
+  int         path;         // index of the path ending here, or -1
+  int         first_child;  // -1 if none
+  int         next_sibling; // -1 if none
+};
+
+struct JSONMatcher {
+  struct JSONNode nodes[JSON_MAX_NODES];  // nodes[0] is the root
+  int             nnodes;
+  const char*     paths[JSON_MAX_NODES];
+  int             npaths;
+};
+
+/*
+ * add \a path to the matcher. Returns the path's index, or -1 if the
+ * path is invalid.
+ */
+extern int json_matcher_add(struct JSONMatcher* matcher, const char* path);
+
+/*
+ * initialize an empty matcher.
+ */
+extern void json_matcher_init(struct JSONMatcher* matcher);
+
+/*
+ * scan the JSON text \a json, and call \a on_match with the raw text of
+ * each value found at one of the matcher's paths. Returns 0 on success,
+ * or -1 if the JSON is invalid. Values reported before an error are
+ * still valid.
+ */
+extern int json_match(const struct JSONMatcher* matcher, const char* json, size_t len,
+                      void (*on_match)(int path, const char* value, size_t len, void* context),
+                      void* context);
+
+/*
+ * escape \a len bytes from \a s as the contents of a JSON string, into
+ * \a dest, which must have room for 6 * \a len bytes. Returns the length
+ * of the result; the quotes are not included.
+ */
+extern size_t json_escape(const char* s, size_t len, char* dest);
+
+/*
+ * copy the JSON value \a value into \a dest, which must have room for
+ * \a len bytes, leaving out all whitespace outside of strings. Returns 
+ * the length of the result.
+ */
+extern size_t json_compact(const char* value, size_t len, char* dest);
+
+/*
+ * unescape the JSON string \a value, including its quotes, into \a dest,
+ * which must have room for \a len bytes. Returns the length of the
+ * result. A \a value that is not a string is copied as is.
+ */
+extern size_t json_unescape(const char* value, size_t len, char* dest);
+
+#endif
@@ -0,0 +1,282 @@
+/*
+ * This file is part of the sse package, copyright (c) 2011, 2012, @radiospiel.
+ * It is copyrighted under the terms of the modified BSD license, see LICENSE.BSD.
+ *
+ * For more information see https://https://github.com/radiospiel/sse.
+ */
+
+/*
+ * Buffered output.
+ *
+ * The output of all events is collected in a large buffer and written to
+ * stdout with a single writev(2) once the buffer holds flush_bytes bytes
+ * or flush_events events - or once the oldest buffered event is older
+ * than flush_ms milliseconds, whichever comes first. A background thread
+ * takes care of the latter.
+ *
+ * Events larger than flush_bytes are not copied into the buffer; they go
+ * out together with the buffer contents in the same writev call.
+ *
+ * Output is staged per thread: each stream thread (see --threads in
+ * streams.c) has a staging buffer of its own, and all other threads
+ * share one. Threads contend only for stdout itself, never while they
+ * format and stage their events. Threads that share the staging buffer,
+ * like the decode pool's, keep their order.
+ *
+ * With --shm the output goes into a shared-memory ring instead, one 
+ * record per event; see shm-ring.h. With --serve it goes to the clients
+ * of a Unix socket; see serve.c.
+ */
+
+#include <pthread.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/uio.h>
+#include "sse.h"
+#include "shm-ring.h"
+
+struct Staging {
+  struct Buffer   staged;         // buffered output
+  unsigned        events;         // number of events in staged
+  struct timespec since;          // when the oldest event came in
+  pthread_mutex_t lock;
+  struct Staging* next;
+};
+
+static struct Staging shared = { { 0, 0, 0 }, 0, { 0, 0 }, PTHREAD_MUTEX_INITIALIZER, 0 };
+static struct Staging* stagings = &shared;  // all staging buffers; only ever prepended to
+static __thread struct Staging* own = 0;    // this thread's staging buffer, or NULL
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;        // stagings, due; shm and serve output
+static pthread_mutex_t write_lock = PTHREAD_MUTEX_INITIALIZER;  // stdout
+static pthread_cond_t  wake;
+static int due = 0;             // set when a staging buffer got its first event
+
+/*
+ * write the staged output of \a staging, followed by \a len bytes from
+ * \a data. Must be called with the staging buffer's lock held.
+ */
+static void write_staged(struct Staging* staging, const char* data, size_t len)
+{
+  struct iovec iov[2];
+  int iovcnt = 0;
+
+  if(staging->staged.len) {
+    iov[iovcnt].iov_base = staging->staged.data;
+    iov[iovcnt].iov_len = staging->staged.len;
+    ++iovcnt;
+  }
+
+  if(len) {
+    iov[iovcnt].iov_base = (void*) data;
+    iov[iovcnt].iov_len = len;
+    ++iovcnt;
+  }
+
+  pthread_mutex_lock(&write_lock);
+  if(writev_all(FD_STDOUT, iov, iovcnt) < 0)
+    die("write");
+  pthread_mutex_unlock(&write_lock);
+
+  staging->staged.len = 0;
+  staging->events = 0;
+}
+
+/*
+ * returns the time the staged output of \a staging must go out.
+ */
+static struct timespec flush_deadline(const struct Staging* staging)
+{
+  struct timespec deadline = staging->since;
+
+  deadline.tv_sec += options.flush_ms / 1000;
+  deadline.tv_nsec += (options.flush_ms % 1000) * 1000000L;
+  if(deadline.tv_nsec >= 1000000000L) {
+    deadline.tv_sec += 1;
+    deadline.tv_nsec -= 1000000000L;
+  }
+
+  return deadline;
+}
+
+static int before(const struct timespec* a, const struct timespec* b)
+{
+  return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+/*
+ * the flush thread writes out staged output once it gets too old.
+ */
+static void* output_flusher(void* arg)
+{
+  struct timespec deadline, now;
+  int waiting = 0;              // set if some output is due at deadline
+
+  while(1) {
+    pthread_mutex_lock(&lock);
+
+    while(!due) {
+      if(!waiting)
+        pthread_cond_wait(&wake, &lock);
+      else if(pthread_cond_timedwait(&wake, &lock, &deadline) == ETIMEDOUT)
+        break;
+    }
+
+    due = 0;
+    struct Staging* staging = stagings;
+
+    pthread_mutex_unlock(&lock);
+
+    /* write what is too old, and find out when the rest is. */
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    waiting = 0;
+
+    for(; staging; staging = staging->next) {
+      pthread_mutex_lock(&staging->lock);
+
+      if(staging->staged.len) {
+        struct timespec at = flush_deadline(staging);
+
+        if(!before(&now, &at))
+          write_staged(staging, 0, 0);
+        else if(!waiting || before(&at, &deadline)) {
+          deadline = at;
+          waiting = 1;
+        }
+      }
+
+      pthread_mutex_unlock(&staging->lock);
+    }
+  }
+
+  return 0;
+}
+
+/*
+ * flush the output, and tell shm readers that there is no more.
+ */
+static void output_close()
+{
+  output_flush();
+
+  if(options.shm_name)
+    shm_ring_close();
+  if(options.serve_path)
+    serve_close();
+}
+
+void output_init()
+{
+  if(options.shm_name || options.serve_path) {
+    if(options.shm_name)
+      shm_ring_create(options.shm_name, options.shm_size, options.shm_policy);
+    if(options.serve_path)
+      serve_init(options.serve_path);
+
+    atexit(output_close);
+    return;
+  }
+
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&wake, &attr);
+
+  if(options.flush_ms > 0) {
+    pthread_t thread;
+    if(pthread_create(&thread, 0, output_flusher, 0))
+      die("pthread_create");
+    pthread_detach(thread);
+  }
+
+  atexit(output_close);
+}
+
+void output_header(const char* data, size_t len)
+{
+  if(options.shm_name)
+    shm_ring_preamble(data, len);
+  if(options.serve_path)
+    serve_preamble(data, len);
+
+  if(!options.shm_name && !options.serve_path)
+    output_write(0, data, len);
+}
+
+void output_thread_init()
+{
+  struct Staging* staging = calloc(1, sizeof(struct Staging));
+  if(!staging)
+    die("calloc");
+
+  pthread_mutex_init(&staging->lock, 0);
+
+  pthread_mutex_lock(&lock);
+  staging->next = stagings;
+  stagings = staging;
+  pthread_mutex_unlock(&lock);
+
+  own = staging;
+}
+
+void output_write(const char* type, const char* data, size_t len)
+{
+  if(!len)
+    return;
+
+  if(options.shm_name || options.serve_path) {
+    pthread_mutex_lock(&lock);
+
+    if(options.shm_name)
+      shm_ring_publish(data, len);
+    if(options.serve_path)
+      serve_write(type, data, len);
+
+    pthread_mutex_unlock(&lock);
+    return;
+  }
+
+  struct Staging* staging = own ? own : &shared;
+
+  pthread_mutex_lock(&staging->lock);
+
+  if(len >= options.flush_bytes || options.flush_ms <= 0) {
+    write_staged(staging, data, len);
+  }
+  else {
+    int first = !staging->staged.len;
+    if(first)
+      clock_gettime(CLOCK_MONOTONIC, &staging->since);
+
+    buffer_append(&staging->staged, data, len);
+    staging->events++;
+
+    if(staging->staged.len >= options.flush_bytes || staging->events >= options.flush_events) {
+      write_staged(staging, 0, 0);
+    }
+    else if(first) {
+      pthread_mutex_lock(&lock);
+      due = 1;
+      pthread_cond_signal(&wake);
+      pthread_mutex_unlock(&lock);
+    }
+  }
+
+  pthread_mutex_unlock(&staging->lock);
+}
+
+void output_flush()
+{
+  pthread_mutex_lock(&lock);
+  struct Staging* staging = stagings;
+  pthread_mutex_unlock(&lock);
+
+  for(; staging; staging = staging->next) {
+    pthread_mutex_lock(&staging->lock);
+
+    if(staging->staged.len)
+      write_staged(staging, 0, 0);
+
+    pthread_mutex_unlock(&staging->lock);
+  }
+}
@@ -1,1937 +1,591 @@
-#line 2 "src/parse-sse.c"
-
-#line 4 "src/parse-sse.c"
-
-#define  YY_INT_ALIGNED short int
-
-/* A lexical scanner generated by flex */
-
-#define FLEX_SCANNER
-#define YY_FLEX_MAJOR_VERSION 2
-#define YY_FLEX_MINOR_VERSION 5
-#define YY_FLEX_SUBMINOR_VERSION 35
-#if YY_FLEX_SUBMINOR_VERSION > 0
-#define FLEX_BETA
-#endif
-
-/* First, we deal with  platform-specific or compiler-specific issues. */
-
-/* begin standard C headers. */
-#include <stdio.h>
-#include <string.h>
-#include <errno.h>
-#include <stdlib.h>
-
-/* end standard C headers. */
-
-/* flex integer type definitions */
-
-#ifndef FLEXINT_H
-#define FLEXINT_H
-
-/* C99 systems have <inttypes.h>. Non-C99 systems may or may not. */
-
-#if defined (__STDC_VERSION__) && __STDC_VERSION__ >= 199901L
-
-/* C99 says to define __STDC_LIMIT_MACROS before including stdint.h,
- * if you want the limit (max/min) macros for int types. 
- */
-#ifndef __STDC_LIMIT_MACROS
-#define __STDC_LIMIT_MACROS 1
-#endif
-
-#include <inttypes.h>
-typedef int8_t flex_int8_t;
-typedef uint8_t flex_uint8_t;
-typedef int16_t flex_int16_t;
-typedef uint16_t flex_uint16_t;
-typedef int32_t flex_int32_t;
-typedef uint32_t flex_uint32_t;
-typedef uint64_t flex_uint64_t;
-#else
-typedef signed char flex_int8_t;
-typedef short int flex_int16_t;
-typedef int flex_int32_t;
-typedef unsigned char flex_uint8_t; 
-typedef unsigned short int flex_uint16_t;
-typedef unsigned int flex_uint32_t;
-#endif /* ! C99 */
-
-/* Limits of integral types. */
-#ifndef INT8_MIN
-#define INT8_MIN               (-128)
-#endif
-#ifndef INT16_MIN
-#define INT16_MIN              (-32767-1)
-#endif
-#ifndef INT32_MIN
-#define INT32_MIN              (-2147483647-1)
-#endif
-#ifndef INT8_MAX
-#define INT8_MAX               (127)
-#endif
-#ifndef INT16_MAX
-#define INT16_MAX              (32767)
-#endif
-#ifndef INT32_MAX
-#define INT32_MAX              (2147483647)
-#endif
-#ifndef UINT8_MAX
-#define UINT8_MAX              (255U)
-#endif
-#ifndef UINT16_MAX
-#define UINT16_MAX             (65535U)
-#endif
-#ifndef UINT32_MAX
-#define UINT32_MAX             (4294967295U)
-#endif
-
-#endif /* ! FLEXINT_H */
-
-#ifdef __cplusplus
-
-/* The "const" storage-class-modifier is valid. */
-#define YY_USE_CONST
-
-#else	/* ! __cplusplus */
-
-/* C99 requires __STDC__ to be defined as 1. */
-#if defined (__STDC__)
-
-#define YY_USE_CONST
-
-#endif	/* defined (__STDC__) */
-#endif	/* ! __cplusplus */
-
-#ifdef YY_USE_CONST
-#define yyconst const
-#else
-#define yyconst
-#endif
-
-/* Returned upon end-of-file. */
-#define YY_NULL 0
-
-/* Promotes a possibly negative, possibly signed char to an unsigned
- * integer for use as an array index.  If the signed char is negative,
- * we want to instead treat it as an 8-bit unsigned char, hence the
- * double cast.
- */
-#define YY_SC_TO_UI(c) ((unsigned int) (unsigned char) c)
-
-/* Enter a start condition.  This macro really ought to take a parameter,
- * but we do it the disgusting crufty way forced on us by the ()-less
- * definition of BEGIN.
- */
-#define BEGIN (yy_start) = 1 + 2 *
-
-/* Translate the current start state into a value that can be later handed
- * to BEGIN to return to the state.  The YYSTATE alias is for lex
- * compatibility.
- */
-#define YY_START (((yy_start) - 1) / 2)
-#define YYSTATE YY_START
-
-/* Action number for EOF rule of a given start state. */
-#define YY_STATE_EOF(state) (YY_END_OF_BUFFER + state + 1)
-
-/* Special action meaning "start processing a new file". */
-#define YY_NEW_FILE yyrestart(yyin  )
-
-#define YY_END_OF_BUFFER_CHAR 0
-
-/* Size of default input buffer. */
-#ifndef YY_BUF_SIZE
-#define YY_BUF_SIZE 16384
-#endif
-
-/* The state buf must be large enough to hold one state per character in the main buffer.
- */
-#define YY_STATE_BUF_SIZE   ((YY_BUF_SIZE + 2) * sizeof(yy_state_type))
-
-#ifndef YY_TYPEDEF_YY_BUFFER_STATE
-#define YY_TYPEDEF_YY_BUFFER_STATE
-typedef struct yy_buffer_state *YY_BUFFER_STATE;
-#endif
-
-#ifndef YY_TYPEDEF_YY_SIZE_T
-#define YY_TYPEDEF_YY_SIZE_T
-typedef size_t yy_size_t;
-#endif
-
-extern yy_size_t yyleng;
-
-extern FILE *yyin, *yyout;
-
-#define EOB_ACT_CONTINUE_SCAN 0
-#define EOB_ACT_END_OF_FILE 1
-#define EOB_ACT_LAST_MATCH 2
-
-    #define YY_LESS_LINENO(n)
-    
-/* Return all but the first "n" matched characters back to the input stream. */
-#define yyless(n) \
-	do \
-		{ \
-		/* Undo effects of setting up yytext. */ \
-        int yyless_macro_arg = (n); \
-        YY_LESS_LINENO(yyless_macro_arg);\
-		*yy_cp = (yy_hold_char); \
-		YY_RESTORE_YY_MORE_OFFSET \
-		(yy_c_buf_p) = yy_cp = yy_bp + yyless_macro_arg - YY_MORE_ADJ; \
-		YY_DO_BEFORE_ACTION; /* set up yytext again */ \
-		} \
-	while ( 0 )
-
-#define unput(c) yyunput( c, (yytext_ptr)  )
-
-#ifndef YY_STRUCT_YY_BUFFER_STATE
-#define YY_STRUCT_YY_BUFFER_STATE
-struct yy_buffer_state
-	{
-	FILE *yy_input_file;
-
-	char *yy_ch_buf;		/* input buffer */
-	char *yy_buf_pos;		/* current position in input buffer */
-
-	/* Size of input buffer in bytes, not including room for EOB
-	 * characters.
-	 */
-	yy_size_t yy_buf_size;
-
-	/* Number of characters read into yy_ch_buf, not including EOB
-	 * characters.
-	 */
-	yy_size_t yy_n_chars;
-
-	/* Whether we "own" the buffer - i.e., we know we created it,
-	 * and can realloc() it to grow it, and should free() it to
-	 * delete it.
-	 */
-	int yy_is_our_buffer;
-
-	/* Whether this is an "interactive" input source; if so, and
-	 * if we're using stdio for input, then we want to use getc()
-	 * instead of fread(), to make sure we stop fetching input after
-	 * each newline.
-	 */
-	int yy_is_interactive;
-
-	/* Whether we're considered to be at the beginning of a line.
-	 * If so, '^' rules will be active on the next match, otherwise
-	 * not.
-	 */
-	int yy_at_bol;
-
-    int yy_bs_lineno; /**< The line count. */
-    int yy_bs_column; /**< The column count. */
-    
-	/* Whether to try to fill the input buffer when we reach the
-	 * end of it.
-	 */
-	int yy_fill_buffer;
-
-	int yy_buffer_status;
-
-#define YY_BUFFER_NEW 0
-#define YY_BUFFER_NORMAL 1
-	/* When an EOF's been seen but there's still some text to process
-	 * then we mark the buffer as YY_EOF_PENDING, to indicate that we
-	 * shouldn't try reading from the input source any more.  We might
-	 * still have a bunch of tokens to match, though, because of
-	 * possible backing-up.
-	 *
-	 * When we actually see the EOF, we change the status to "new"
-	 * (via yyrestart()), so that the user can continue scanning by
-	 * just pointing yyin at a new input file.
-	 */
-#define YY_BUFFER_EOF_PENDING 2
-
-	};
-#endif /* !YY_STRUCT_YY_BUFFER_STATE */
-
-/* Stack of input buffers. */
-static size_t yy_buffer_stack_top = 0; /**< index of top of stack. */
-static size_t yy_buffer_stack_max = 0; /**< capacity of stack. */
-static YY_BUFFER_STATE * yy_buffer_stack = 0; /**< Stack as an array. */
-
-/* We provide macros for accessing buffer states in case in the
- * future we want to put the buffer states in a more general
- * "scanner state".
+/*
+ * This file is part of the sse package, copyright (c) 2011, 2012, @radiospiel.
+ * It is copyrighted under the terms of the modified BSD license, see LICENSE.BSD.
  *
- * Returns the top of the stack, or NULL.
- */
-#define YY_CURRENT_BUFFER ( (yy_buffer_stack) \
-                          ? (yy_buffer_stack)[(yy_buffer_stack_top)] \
-                          : NULL)
-
-/* Same as previous macro, but useful when we know that the buffer stack is not
- * NULL or when we need an lvalue. For internal use only.
+ * For more information see https://https://github.com/radiospiel/sse.
  */
-#define YY_CURRENT_BUFFER_LVALUE (yy_buffer_stack)[(yy_buffer_stack_top)]
-
-/* yy_hold_char holds the character lost when yytext is formed. */
-static char yy_hold_char;
-static yy_size_t yy_n_chars;		/* number of characters read into yy_ch_buf */
-yy_size_t yyleng;
 
-/* Points to current character in buffer. */
-static char *yy_c_buf_p = (char *) 0;
-static int yy_init = 0;		/* whether we need to initialize */
-static int yy_start = 0;	/* start state number */
-
-/* Flag which is used to allow yywrap()'s to do buffer switches
- * instead of setting up a fresh yyin.  A bit of a hack ...
+/*
+ * An incremental SSE parser.
+ *
+ * The parser is fed with whatever chunks curl hands us. Complete lines
+ * are scanned in place, right in the caller's buffer; only a line that
+ * is cut off at the end of a chunk is copied into the parser's tail
+ * buffer, where it waits for the rest of the line to arrive. This way
+ * the result does not depend on where the chunk boundaries fall.
+ *
+ * With an on_event callback the parser reports events as views into the
+ * input instead (see struct SSEEvent). In that case the tail buffer also
+ * holds those parts of an unfinished event that arrived with earlier
+ * chunks.
+ *
+ * In both modes an unfinished line may not grow beyond the data size
+ * limit (plus some room for the field name): such a line drops its
+ * event, and the rest of it is skipped without being kept.
  */
-static int yy_did_buffer_switch_on_eof;
-
-void yyrestart (FILE *input_file  );
-void yy_switch_to_buffer (YY_BUFFER_STATE new_buffer  );
-YY_BUFFER_STATE yy_create_buffer (FILE *file,int size  );
-void yy_delete_buffer (YY_BUFFER_STATE b  );
-void yy_flush_buffer (YY_BUFFER_STATE b  );
-void yypush_buffer_state (YY_BUFFER_STATE new_buffer  );
-void yypop_buffer_state (void );
-
-static void yyensure_buffer_stack (void );
-static void yy_load_buffer_state (void );
-static void yy_init_buffer (YY_BUFFER_STATE b,FILE *file  );
-
-#define YY_FLUSH_BUFFER yy_flush_buffer(YY_CURRENT_BUFFER )
-
-YY_BUFFER_STATE yy_scan_buffer (char *base,yy_size_t size  );
-YY_BUFFER_STATE yy_scan_string (yyconst char *yy_str  );
-YY_BUFFER_STATE yy_scan_bytes (yyconst char *bytes,yy_size_t len  );
-
-void *yyalloc (yy_size_t  );
-void *yyrealloc (void *,yy_size_t  );
-void yyfree (void *  );
-
-#define yy_new_buffer yy_create_buffer
-
-#define yy_set_interactive(is_interactive) \
-	{ \
-	if ( ! YY_CURRENT_BUFFER ){ \
-        yyensure_buffer_stack (); \
-		YY_CURRENT_BUFFER_LVALUE =    \
-            yy_create_buffer(yyin,YY_BUF_SIZE ); \
-	} \
-	YY_CURRENT_BUFFER_LVALUE->yy_is_interactive = is_interactive; \
-	}
-
-#define yy_set_bol(at_bol) \
-	{ \
-	if ( ! YY_CURRENT_BUFFER ){\
-        yyensure_buffer_stack (); \
-		YY_CURRENT_BUFFER_LVALUE =    \
-            yy_create_buffer(yyin,YY_BUF_SIZE ); \
-	} \
-	YY_CURRENT_BUFFER_LVALUE->yy_at_bol = at_bol; \
-	}
-
-#define YY_AT_BOL() (YY_CURRENT_BUFFER_LVALUE->yy_at_bol)
-
-/* Begin user sect3 */
-
-typedef unsigned char YY_CHAR;
-
-FILE *yyin = (FILE *) 0, *yyout = (FILE *) 0;
-
-typedef int yy_state_type;
 
-extern int yylineno;
+#include "sse.h"
 
-int yylineno = 1;
+/* room for a field name on top of max_data_size in a single line */
+#define LINE_SLACK  1024
 
-extern char *yytext;
-#define yytext_ptr yytext
+/* === data ======================================================== */
 
-static yy_state_type yy_get_previous_state (void );
-static yy_state_type yy_try_NUL_trans (yy_state_type current_state  );
-static int yy_get_next_buffer (void );
-static void yy_fatal_error (yyconst char msg[]  );
+static void set_reply_url(struct SSEParser* parser, const char* url, size_t len) {
+  parser->reply_url = url ? arena_strndup(&parser->arena, url, len) : 0;
+}
 
-/* Done after the current pattern has been matched and before the
- * corresponding action - sets up yytext.
- */
-#define YY_DO_BEFORE_ACTION \
-	(yytext_ptr) = yy_bp; \
-	yyleng = (yy_size_t) (yy_cp - yy_bp); \
-	(yy_hold_char) = *yy_cp; \
-	*yy_cp = '\0'; \
-	(yy_c_buf_p) = yy_cp;
-
-#define YY_NUM_RULES 11
-#define YY_END_OF_BUFFER 12
-/* This struct is not used in this scanner,
-   but its presence is necessary. */
-struct yy_trans_info
-	{
-	flex_int32_t yy_verify;
-	flex_int32_t yy_nxt;
-	};
-static yyconst flex_int16_t yy_accept[34] =
-    {   0,
-        0,    0,   12,    8,   10,    8,    7,    8,    8,    8,
-        9,    8,    6,    7,    8,    8,    6,    5,    8,    8,
-        5,    8,    8,    2,    8,    2,    1,    4,    1,    4,
-        3,    3,    0
-    } ;
-
-static yyconst flex_int32_t yy_ec[256] =
-    {   0,
-        1,    1,    1,    1,    1,    1,    1,    1,    1,    2,
-        1,    1,    1,    1,    1,    1,    1,    1,    1,    1,
-        1,    1,    1,    1,    1,    1,    1,    1,    1,    1,
-        1,    3,    1,    1,    1,    1,    1,    1,    1,    1,
-        1,    1,    1,    1,    4,    1,    1,    4,    4,    4,
-        4,    4,    4,    4,    4,    4,    4,    5,    1,    1,
-        1,    1,    1,    1,    1,    1,    1,    1,    1,    1,
-        1,    1,    1,    1,    1,    1,    1,    1,    1,    1,
-        1,    1,    1,    1,    1,    1,    1,    1,    1,    1,
-        1,    1,    1,    1,    4,    1,    6,    4,    4,    7,
-
-        8,    4,    4,    4,    4,    4,    4,    9,    4,    4,
-        4,   10,    4,   11,    4,   12,    4,    4,    4,    4,
-       13,    4,    1,    1,    1,    1,    1,    1,    1,    1,
-        1,    1,    1,    1,    1,    1,    1,    1,    1,    1,
-        1,    1,    1,    1,    1,    1,    1,    1,    1,    1,
-        1,    1,    1,    1,    1,    1,    1,    1,    1,    1,
-        1,    1,    1,    1,    1,    1,    1,    1,    1,    1,
-        1,    1,    1,    1,    1,    1,    1,    1,    1,    1,
-        1,    1,    1,    1,    1,    1,    1,    1,    1,    1,
-        1,    1,    1,    1,    1,    1,    1,    1,    1,    1,
-
-        1,    1,    1,    1,    1,    1,    1,    1,    1,    1,
-        1,    1,    1,    1,    1,    1,    1,    1,    1,    1,
-        1,    1,    1,    1,    1,    1,    1,    1,    1,    1,
-        1,    1,    1,    1,    1,    1,    1,    1,    1,    1,
-        1,    1,    1,    1,    1,    1,    1,    1,    1,    1,
-        1,    1,    1,    1,    1
-    } ;
-
-static yyconst flex_int32_t yy_meta[14] =
-    {   0,
-        1,    2,    1,    1,    1,    1,    1,    1,    1,    1,
-        1,    1,    1
-    } ;
-
-static yyconst flex_int16_t yy_base[43] =
-    {   0,
-        0,    0,   47,    0,   40,   13,    0,   18,   19,    0,
-       56,   35,   35,    0,   22,   29,    0,    0,   31,   34,
-        0,   39,   40,   33,   49,    0,    0,   30,    0,    0,
-        0,    0,   56,   31,   30,   29,   28,   25,   21,   19,
-       16,   14
-    } ;
-
-static yyconst flex_int16_t yy_def[43] =
-    {   0,
-       33,    1,   33,   34,   33,   35,   36,   35,    8,   34,
-       33,    8,   37,   36,    8,    8,   37,   38,    8,    8,
-       38,    8,    8,   39,    8,   39,   40,   41,   40,   41,
-       42,   42,    0,   33,   33,   33,   33,   33,   33,   33,
-       33,   33
-    } ;
-
-static yyconst flex_int16_t yy_nxt[70] =
-    {   0,
-        4,    5,    4,    6,    7,    6,    8,    6,    6,    6,
-        9,    6,    6,   10,   32,   10,   30,   13,   10,   29,
-       10,   26,   13,   15,   12,   21,   16,   12,   17,   14,
-       12,   10,   31,   19,   12,   27,   22,   18,   20,   12,
-       12,   11,   23,   24,   12,   12,   33,   33,   33,   33,
-       33,   33,   25,   28,   12,    3,   33,   33,   33,   33,
-       33,   33,   33,   33,   33,   33,   33,   33,   33
-    } ;
-
-static yyconst flex_int16_t yy_chk[70] =
-    {   0,
-        1,    1,    1,    1,    1,    1,    1,    1,    1,    1,
-        1,    1,    1,    6,   42,    6,   41,    6,    8,   40,
-        8,   39,    8,    8,    9,   38,    9,   15,   37,   36,
-       35,   34,   28,   15,   16,   24,   19,   13,   16,   20,
-       12,    5,   20,   22,   22,   23,    3,    0,    0,    0,
-        0,    0,   23,   25,   25,   33,   33,   33,   33,   33,
-       33,   33,   33,   33,   33,   33,   33,   33,   33
-    } ;
-
-static yy_state_type yy_last_accepting_state;
-static char *yy_last_accepting_cpos;
-
-extern int yy_flex_debug;
-int yy_flex_debug = 0;
-
-/* The intent behind this definition is that it'll catch
- * any uses of REJECT which flex missed.
- */
-#define REJECT reject_used_but_not_detected
-#define yymore() yymore_used_but_not_detected
-#define YY_MORE_ADJ 0
-#define YY_RESTORE_YY_MORE_OFFSET
-char *yytext;
-#line 1 "src/parse-sse.fl"
 /*
- * This file is part of the sse package, copyright (c) 2011, 2012, @radiospiel.
- * It is copyrighted under the terms of the modified BSD license, see LICENSE.BSD.
- *
- * For more information see https://https://github.com/radiospiel/sse.
+ * append a line to the event's data. Multiple data lines are joined
+ * with a newline. The buffer grows geometrically, so an event with many
+ * data lines still costs only linear time.
  */
-#line 11 "src/parse-sse.fl"
+static void data_add(struct SSEParser* parser, const char* string, size_t len)
+{
+  if(parser->discard)
+    return;
 
-#include "sse.h"
+  size_t sep = parser->data_buf ? 1 : 0;
+  size_t new_len = parser->data_len + sep + len;
 
-#ifndef NDEBUG
-#define YYDEBUG 1
-#endif
+  if(parser->max_data_size && new_len > parser->max_data_size) {
+    fprintf(stderr, "event data exceeds %lu byte, dropping event\n", (unsigned long) parser->max_data_size);
+    parser->discard = 1;
+    return;
+  }
 
-/* === data ======================================================== */
+  if(new_len + 1 > parser->data_cap) {
+    size_t new_cap = parser->data_cap ? parser->data_cap * 2 : 256;
+    while(new_cap < new_len + 1)
+      new_cap *= 2;
 
-static char* data_buf = 0;
-static const char* data = 0;
-static char* reply_url = 0;
+    parser->data_buf = arena_grow(&parser->arena, parser->data_buf, parser->data_len + 1, new_cap);
+    parser->data_cap = new_cap;
+  }
 
-static void set_reply_url(const char* url) {
-  free(reply_url);
-  reply_url = url ? strdup(url) : 0;
-}
+  if(sep)
+    parser->data_buf[parser->data_len] = '\n';
 
-/*
- * skip the first character in string, if there is one;
- * then replace the string in \a *pTarget with this string;
- * return a pointer to the string.
- */ 
-static void data_add(const char* string)
-{
-  /* NOTE: changing length was causing libcurl to crash, and data
-   * had undefined characters */
-  //size_t new_len = (data_buf ? strlen(data_buf) : 0) + strlen(string);
-  //data_buf = realloc(data_buf, new_len);
-  //strcat(data_buf, "\n");
-  //strcat(data_buf, string);
-  //data = data_buf;
-  data = string;
+  memcpy(parser->data_buf + parser->data_len + sep, string, len);
+  parser->data_buf[new_len] = 0;
+  parser->data_len = new_len;
 }
 
-static void data_reset()
+static void data_reset(struct SSEParser* parser)
 {
-  if(data_buf)
-    *data_buf = 0;
-
-  data = NULL;
+  parser->data_buf = NULL;
+  parser->data_len = parser->data_cap = 0;
+  parser->discard = 0;
 }
 
 /* === headers ===================================================== */
 
-static char* headers[MAX_HEADERS] = { 0 };
-static char** header_ptr = headers;
-
-static void headers_reset() {
-  char** ph = headers;
-  while(*ph) {
-    free(*ph);
-    *ph++ = 0;
-  }
-  
-  header_ptr = headers;
+static void headers_reset(struct SSEParser* parser) {
+  parser->headers[0] = NULL;
+  parser->header_ptr = parser->headers;
 }
 
-static void header_add(const char* s) {
-  if(header_ptr - headers < MAX_HEADERS - 1) {
-    *header_ptr++ = strdup(s);
-    *header_ptr = NULL;
+static void header_add(struct SSEParser* parser, char* s) {
+  if(parser->header_ptr - parser->headers < MAX_HEADERS - 1) {
+    *parser->header_ptr++ = s;
+    *parser->header_ptr = NULL;
   }
 }
 
-static void header_add_from_line(char* line)
+/*
+ * add a "NAME=value" header from a "name: value" line. \a colon points
+ * to the colon separating name and value; \a eol to the end of the line.
+ */
+static void header_add_from_line(struct SSEParser* parser, int id, const char* line,
+                                 const char* colon, const char* eol)
 {
-  char* colon = strchr(line, ':');
-  if(!colon || colon == line) return;
-  
-  *colon = '=';
+  const char* value = colon + 1;
 
   /*
-   * upcase all chars until colon
-   */
-  {
-    char* s;
-    for(s = line; s < colon; ++s) {
-      *s = toupper(*s);
-    }
-  }
-  
-  /* 
-   * if the value starts with a space we'll have to skip that. We do 
-   * this by memmoving the name one character to the right.
+   * if the value starts with a space we'll have to skip that.
    */
+  if(value < eol && *value == ' ')
+    value += 1;
 
-  if(isspace(colon[1])) {
-    memmove(line+1, line, colon - line);
-    colon[1] = '=';
-    line += 1;
-  }
-
-  header_add(line);
-}
-
-/* === flush the event ============================================= */
+  size_t name_len = colon - line, value_len = eol - value;
+  char* header = arena_alloc(&parser->arena, name_len + value_len + 2);
 
-static void flush()
-{
   /*
-   * If neither headers nor data are set, then we flush after some
-   * keep-alive traffic (or some other traffic that does not conform
-   * to SSE)
+   * known fields come with an uppercase name; all others are upcased 
+   * here.
    */
-  if(*headers || (data && *data)) {
-    on_sse_event(headers, data ? data : "", reply_url);
+  if(id != SSE_FIELD_OTHER) {
+    memcpy(header, sse_field_upcased(id), name_len);
+    parser->values[id] = header + name_len + 1;
+  }
+  else {
+    size_t i;
+    for(i = 0; i < name_len; ++i) {
+      header[i] = toupper(line[i]);
+    }
   }
 
-  set_reply_url(0);
-  data_reset();
-  headers_reset();
-}
-
-#line 595 "src/parse-sse.c"
-
-#define INITIAL 0
-
-#ifndef YY_NO_UNISTD_H
-/* Special case for "unistd.h", since it is non-ANSI. We include it way
- * down here because we want the user's section 1 to have been scanned first.
- * The user has a chance to override it with an option.
- */
-#include <unistd.h>
-#endif
-
-#ifndef YY_EXTRA_TYPE
-#define YY_EXTRA_TYPE void *
-#endif
-
-static int yy_init_globals (void );
-
-/* Accessor methods to globals.
-   These are made visible to non-reentrant scanners for convenience. */
-
-int yylex_destroy (void );
-
-int yyget_debug (void );
-
-void yyset_debug (int debug_flag  );
-
-YY_EXTRA_TYPE yyget_extra (void );
-
-void yyset_extra (YY_EXTRA_TYPE user_defined  );
-
-FILE *yyget_in (void );
-
-void yyset_in  (FILE * in_str  );
-
-FILE *yyget_out (void );
-
-void yyset_out  (FILE * out_str  );
+  header[name_len] = '=';
+  memcpy(header + name_len + 1, value, value_len);
+  header[name_len + 1 + value_len] = 0;
 
-yy_size_t yyget_leng (void );
+  header_add(parser, header);
+}
 
-char *yyget_text (void );
+/* === event views ================================================= */
 
-int yyget_lineno (void );
+/*
+ * When the parser has an on_event callback it does not copy anything.
+ * Instead it records each field as a pair of slices into the input; the
+ * bytes they point to stay where they are until the event is complete.
+ */
+static void field_add(struct SSEParser* parser, int type, const char* line,
+                      const char* colon, const char* value, const char* eol)
+{
+  if(parser->discard)
+    return;
+
+  if(type == SSE_FIELD_DATA) {
+    size_t new_len = parser->data_len + (parser->data_len ? 1 : 0) + (eol - value);
+    if(parser->max_data_size && new_len > parser->max_data_size) {
+      fprintf(stderr, "event data exceeds %lu byte, dropping event\n", (unsigned long) parser->max_data_size);
+      parser->discard = 1;
+      parser->nfields = 0;
+      return;
+    }
+    parser->data_len = new_len;
+  }
 
-void yyset_lineno (int line_number  );
+  if(parser->nfields == parser->fields_cap) {
+    unsigned cap = parser->fields_cap ? parser->fields_cap * 2 : 16;
+    parser->fields = arena_grow(&parser->arena, parser->fields, 
+                                parser->nfields * sizeof(struct SSEField), 
+                                cap * sizeof(struct SSEField));
+    parser->fields_cap = cap;
+  }
 
-/* Macros after this point can all be overridden by user definitions in
- * section 1.
- */
+  parser->slots[type] = parser->nfields + 1;
 
-#ifndef YY_SKIP_YYWRAP
-#ifdef __cplusplus
-extern "C" int yywrap (void );
-#else
-extern int yywrap (void );
-#endif
-#endif
-
-    static void yyunput (int c,char *buf_ptr  );
-    
-#ifndef yytext_ptr
-static void yy_flex_strncpy (char *,yyconst char *,int );
-#endif
-
-#ifdef YY_NEED_STRLEN
-static int yy_flex_strlen (yyconst char * );
-#endif
-
-#ifndef YY_NO_INPUT
-
-#ifdef __cplusplus
-static int yyinput (void );
-#else
-static int input (void );
-#endif
-
-#endif
-
-/* Amount of stuff to slurp up with each read. */
-#ifndef YY_READ_BUF_SIZE
-#define YY_READ_BUF_SIZE 8192
-#endif
-
-/* Copy whatever the last rule matched to the standard output. */
-#ifndef ECHO
-/* This used to be an fputs(), but since the string might contain NUL's,
- * we now use fwrite().
- */
-#define ECHO fwrite( yytext, yyleng, 1, yyout )
-#endif
+  struct SSEField* field = parser->fields + parser->nfields++;
+  field->type = type;
+  field->name.ptr = line;
+  field->name.len = colon - line;
+  field->value.ptr = value;
+  field->value.len = eol - value;
+}
 
-/* Gets input and stuffs it into "buf".  number of characters read, or YY_NULL,
- * is returned in "result".
- */
-#ifndef YY_INPUT
-#define YY_INPUT(buf,result,max_size) \
-	if ( YY_CURRENT_BUFFER_LVALUE->yy_is_interactive ) \
-		{ \
-		int c = '*'; \
-		yy_size_t n; \
-		for ( n = 0; n < max_size && \
-			     (c = getc( yyin )) != EOF && c != '\n'; ++n ) \
-			buf[n] = (char) c; \
-		if ( c == '\n' ) \
-			buf[n++] = (char) c; \
-		if ( c == EOF && ferror( yyin ) ) \
-			YY_FATAL_ERROR( "input in flex scanner failed" ); \
-		result = n; \
-		} \
-	else \
-		{ \
-		errno=0; \
-		while ( (result = fread(buf, 1, max_size, yyin))==0 && ferror(yyin)) \
-			{ \
-			if( errno != EINTR) \
-				{ \
-				YY_FATAL_ERROR( "input in flex scanner failed" ); \
-				break; \
-				} \
-			errno=0; \
-			clearerr(yyin); \
-			} \
-		}\
-\
-
-#endif
-
-/* No semi-colon after return; correct usage is to write "yyterminate();" -
- * we don't want an extra ';' after the "return" because that will cause
- * some compilers to complain about unreachable statements.
+/*
+ * fields that point into [from, to) are moved to \a new_base.
  */
-#ifndef yyterminate
-#define yyterminate() return YY_NULL
-#endif
-
-/* Number of entries by which start-condition stack grows. */
-#ifndef YY_START_STACK_INCR
-#define YY_START_STACK_INCR 25
-#endif
+static void fields_rebase(struct SSEParser* parser, const char* from, const char* to, const char* new_base)
+{
+  unsigned i;
+  for(i = 0; i < parser->nfields; ++i) {
+    struct SSEField* field = parser->fields + i;
+    if(field->name.ptr < from || field->name.ptr >= to)
+      continue;
 
-/* Report a fatal error. */
-#ifndef YY_FATAL_ERROR
-#define YY_FATAL_ERROR(msg) yy_fatal_error( msg )
-#endif
+    field->value.ptr = new_base + (field->value.ptr - from);
+    field->name.ptr = new_base + (field->name.ptr - from);
+  }
+}
 
-/* end tables serialization structures and prototypes */
+/* === flush the event ============================================= */
 
-/* Default declaration of generated scanner - a define so the user can
- * easily add parameters.
+/*
+ * remember the id of the event being flushed. Most events repeat or
+ * extend the last id, so the buffer is kept, and only grows.
  */
-#ifndef YY_DECL
-#define YY_DECL_IS_OURS 1
-
-extern int yylex (void);
+static void last_id_update(struct SSEParser* parser)
+{
+  const char* id = 0;
+  size_t len = 0;
 
-#define YY_DECL int yylex (void)
-#endif /* !YY_DECL */
+  if(parser->on_event) {
+    if(parser->slots[SSE_FIELD_ID]) {
+      const struct SSEField* field = parser->fields + parser->slots[SSE_FIELD_ID] - 1;
+      id = field->value.ptr;
+      len = field->value.len;
+    }
+  }
+  else if(parser->values[SSE_FIELD_ID]) {
+    id = parser->values[SSE_FIELD_ID];
+    len = strlen(id);
+  }
 
-/* Code executed at the beginning of each rule, after yytext and yyleng
- * have been set up.
- */
-#ifndef YY_USER_ACTION
-#define YY_USER_ACTION
-#endif
+  if(!id || (parser->last_id && strnlen(parser->last_id, len + 1) == len && !memcmp(parser->last_id, id, len)))
+    return;
 
-/* Code executed at the end of each rule. */
-#ifndef YY_BREAK
-#define YY_BREAK break;
-#endif
+  if(len + 1 > parser->last_id_cap) {
+    parser->last_id_cap = len + 1 > 64 ? len + 1 : 64;
+    parser->last_id = realloc(parser->last_id, parser->last_id_cap);
+    if(!parser->last_id)
+      die("realloc");
+  }
 
-#define YY_RULE_SETUP \
-	YY_USER_ACTION
+  memcpy(parser->last_id, id, len);
+  parser->last_id[len] = 0;
+}
 
-/** The main scanner function which does all the work.
- */
-YY_DECL
+static void event_reset(struct SSEParser* parser)
 {
-	register yy_state_type yy_current_state;
-	register char *yy_cp, *yy_bp;
-	register int yy_act;
-    
-#line 126 "src/parse-sse.fl"
-
-
-                  /* the data attribute is special: multiple lines are concatenated */
-#line 781 "src/parse-sse.c"
-
-	if ( !(yy_init) )
-		{
-		(yy_init) = 1;
-
-#ifdef YY_USER_INIT
-		YY_USER_INIT;
-#endif
-
-		if ( ! (yy_start) )
-			(yy_start) = 1;	/* first start state */
-
-		if ( ! yyin )
-			yyin = stdin;
-
-		if ( ! yyout )
-			yyout = stdout;
-
-		if ( ! YY_CURRENT_BUFFER ) {
-			yyensure_buffer_stack ();
-			YY_CURRENT_BUFFER_LVALUE =
-				yy_create_buffer(yyin,YY_BUF_SIZE );
-		}
-
-		yy_load_buffer_state( );
-		}
-
-	while ( 1 )		/* loops until end-of-file is reached */
-		{
-		yy_cp = (yy_c_buf_p);
-
-		/* Support of yytext. */
-		*yy_cp = (yy_hold_char);
-
-		/* yy_bp points to the position in yy_ch_buf of the start of
-		 * the current run.
-		 */
-		yy_bp = yy_cp;
-
-		yy_current_state = (yy_start);
-yy_match:
-		do
-			{
-			register YY_CHAR yy_c = yy_ec[YY_SC_TO_UI(*yy_cp)];
-			if ( yy_accept[yy_current_state] )
-				{
-				(yy_last_accepting_state) = yy_current_state;
-				(yy_last_accepting_cpos) = yy_cp;
-				}
-			while ( yy_chk[yy_base[yy_current_state] + yy_c] != yy_current_state )
-				{
-				yy_current_state = (int) yy_def[yy_current_state];
-				if ( yy_current_state >= 34 )
-					yy_c = yy_meta[(unsigned int) yy_c];
-				}
-			yy_current_state = yy_nxt[yy_base[yy_current_state] + (unsigned int) yy_c];
-			++yy_cp;
-			}
-		while ( yy_base[yy_current_state] != 56 );
-
-yy_find_action:
-		yy_act = yy_accept[yy_current_state];
-		if ( yy_act == 0 )
-			{ /* have to back up */
-			yy_cp = (yy_last_accepting_cpos);
-			yy_current_state = (yy_last_accepting_state);
-			yy_act = yy_accept[yy_current_state];
-			}
-
-		YY_DO_BEFORE_ACTION;
-
-do_action:	/* This label is used only to access EOF actions. */
-
-		switch ( yy_act )
-	{ /* beginning of action switch */
-			case 0: /* must back up */
-			/* undo the effects of YY_DO_BEFORE_ACTION */
-			*yy_cp = (yy_hold_char);
-			yy_cp = (yy_last_accepting_cpos);
-			yy_current_state = (yy_last_accepting_state);
-			goto yy_find_action;
-
-case 1:
-YY_RULE_SETUP
-#line 129 "src/parse-sse.fl"
-data_add(yytext + 6);
-	YY_BREAK
-case 2:
-YY_RULE_SETUP
-#line 130 "src/parse-sse.fl"
-data_add(yytext + 5);
-	YY_BREAK
-/* the data attribute is special: multiple lines are concatenated */
-case 3:
-YY_RULE_SETUP
-#line 133 "src/parse-sse.fl"
-set_reply_url(yytext + 7);
-	YY_BREAK
-case 4:
-YY_RULE_SETUP
-#line 134 "src/parse-sse.fl"
-set_reply_url(yytext + 6);
-	YY_BREAK
-/* all other attributes should appear only one */
-case 5:
-YY_RULE_SETUP
-#line 138 "src/parse-sse.fl"
-header_add_from_line(yytext);
-	YY_BREAK
-case 6:
-YY_RULE_SETUP
-#line 139 "src/parse-sse.fl"
-header_add_from_line(yytext);
-	YY_BREAK
-/* ignore lines starting with a colon. */
-case 7:
-YY_RULE_SETUP
-#line 142 "src/parse-sse.fl"
-;
-	YY_BREAK
-/* ignore lines without colon IN VIOLATION WITH THE SPECS. */
-case 8:
-YY_RULE_SETUP
-#line 145 "src/parse-sse.fl"
-;
-	YY_BREAK
-case 9:
-/* rule 9 can match eol */
-YY_RULE_SETUP
-#line 147 "src/parse-sse.fl"
-flush();
-	YY_BREAK
-case 10:
-/* rule 10 can match eol */
-YY_RULE_SETUP
-#line 148 "src/parse-sse.fl"
-/* no yet flushing - this is within an event */
-	YY_BREAK
-case 11:
-YY_RULE_SETUP
-#line 150 "src/parse-sse.fl"
-ECHO;
-	YY_BREAK
-#line 925 "src/parse-sse.c"
-case YY_STATE_EOF(INITIAL):
-	yyterminate();
-
-	case YY_END_OF_BUFFER:
-		{
-		/* Amount of text matched not including the EOB char. */
-		int yy_amount_of_matched_text = (int) (yy_cp - (yytext_ptr)) - 1;
-
-		/* Undo the effects of YY_DO_BEFORE_ACTION. */
-		*yy_cp = (yy_hold_char);
-		YY_RESTORE_YY_MORE_OFFSET
-
-		if ( YY_CURRENT_BUFFER_LVALUE->yy_buffer_status == YY_BUFFER_NEW )
-			{
-			/* We're scanning a new file or input source.  It's
-			 * possible that this happened because the user
-			 * just pointed yyin at a new source and called
-			 * yylex().  If so, then we have to assure
-			 * consistency between YY_CURRENT_BUFFER and our
-			 * globals.  Here is the right place to do so, because
-			 * this is the first action (other than possibly a
-			 * back-up) that will match for the new input source.
-			 */
-			(yy_n_chars) = YY_CURRENT_BUFFER_LVALUE->yy_n_chars;
-			YY_CURRENT_BUFFER_LVALUE->yy_input_file = yyin;
-			YY_CURRENT_BUFFER_LVALUE->yy_buffer_status = YY_BUFFER_NORMAL;
-			}
-
-		/* Note that here we test for yy_c_buf_p "<=" to the position
-		 * of the first EOB in the buffer, since yy_c_buf_p will
-		 * already have been incremented past the NUL character
-		 * (since all states make transitions on EOB to the
-		 * end-of-buffer state).  Contrast this with the test
-		 * in input().
-		 */
-		if ( (yy_c_buf_p) <= &YY_CURRENT_BUFFER_LVALUE->yy_ch_buf[(yy_n_chars)] )
-			{ /* This was really a NUL. */
-			yy_state_type yy_next_state;
-
-			(yy_c_buf_p) = (yytext_ptr) + yy_amount_of_matched_text;
-
-			yy_current_state = yy_get_previous_state(  );
-
-			/* Okay, we're now positioned to make the NUL
-			 * transition.  We couldn't have
-			 * yy_get_previous_state() go ahead and do it
-			 * for us because it doesn't know how to deal
-			 * with the possibility of jamming (and we don't
-			 * want to build jamming into it because then it
-			 * will run more slowly).
-			 */
-
-			yy_next_state = yy_try_NUL_trans( yy_current_state );
-
-			yy_bp = (yytext_ptr) + YY_MORE_ADJ;
-
-			if ( yy_next_state )
-				{
-				/* Consume the NUL. */
-				yy_cp = ++(yy_c_buf_p);
-				yy_current_state = yy_next_state;
-				goto yy_match;
-				}
-
-			else
-				{
-				yy_cp = (yy_c_buf_p);
-				goto yy_find_action;
-				}
-			}
-
-		else switch ( yy_get_next_buffer(  ) )
-			{
-			case EOB_ACT_END_OF_FILE:
-				{
-				(yy_did_buffer_switch_on_eof) = 0;
-
-				if ( yywrap( ) )
-					{
-					/* Note: because we've taken care in
-					 * yy_get_next_buffer() to have set up
-					 * yytext, we can now set up
-					 * yy_c_buf_p so that if some total
-					 * hoser (like flex itself) wants to
-					 * call the scanner after we return the
-					 * YY_NULL, it'll still work - another
-					 * YY_NULL will get returned.
-					 */
-					(yy_c_buf_p) = (yytext_ptr) + YY_MORE_ADJ;
-
-					yy_act = YY_STATE_EOF(YY_START);
-					goto do_action;
-					}
-
-				else
-					{
-					if ( ! (yy_did_buffer_switch_on_eof) )
-						YY_NEW_FILE;
-					}
-				break;
-				}
-
-			case EOB_ACT_CONTINUE_SCAN:
-				(yy_c_buf_p) =
-					(yytext_ptr) + yy_amount_of_matched_text;
-
-				yy_current_state = yy_get_previous_state(  );
-
-				yy_cp = (yy_c_buf_p);
-				yy_bp = (yytext_ptr) + YY_MORE_ADJ;
-				goto yy_match;
-
-			case EOB_ACT_LAST_MATCH:
-				(yy_c_buf_p) =
-				&YY_CURRENT_BUFFER_LVALUE->yy_ch_buf[(yy_n_chars)];
-
-				yy_current_state = yy_get_previous_state(  );
-
-				yy_cp = (yy_c_buf_p);
-				yy_bp = (yytext_ptr) + YY_MORE_ADJ;
-				goto yy_find_action;
-			}
-		break;
-		}
-
-	default:
-		YY_FATAL_ERROR(
-			"fatal flex scanner internal error--no action found" );
-	} /* end of action switch */
-		} /* end of scanning one token */
-} /* end of yylex */
-
-/* yy_get_next_buffer - try to read in a new buffer
- *
- * Returns a code representing an action:
- *	EOB_ACT_LAST_MATCH -
- *	EOB_ACT_CONTINUE_SCAN - continue scanning from current position
- *	EOB_ACT_END_OF_FILE - end of file
- */
-static int yy_get_next_buffer (void)
-{
-    	register char *dest = YY_CURRENT_BUFFER_LVALUE->yy_ch_buf;
-	register char *source = (yytext_ptr);
-	register int number_to_move, i;
-	int ret_val;
-
-	if ( (yy_c_buf_p) > &YY_CURRENT_BUFFER_LVALUE->yy_ch_buf[(yy_n_chars) + 1] )
-		YY_FATAL_ERROR(
-		"fatal flex scanner internal error--end of buffer missed" );
-
-	if ( YY_CURRENT_BUFFER_LVALUE->yy_fill_buffer == 0 )
-		{ /* Don't try to fill the buffer, so this is an EOF. */
-		if ( (yy_c_buf_p) - (yytext_ptr) - YY_MORE_ADJ == 1 )
-			{
-			/* We matched a single character, the EOB, so
-			 * treat this as a final EOF.
-			 */
-			return EOB_ACT_END_OF_FILE;
-			}
-
-		else
-			{
-			/* We matched some text prior to the EOB, first
-			 * process it.
-			 */
-			return EOB_ACT_LAST_MATCH;
-			}
-		}
-
-	/* Try to read more data. */
-
-	/* First move last chars to start of buffer. */
-	number_to_move = (int) ((yy_c_buf_p) - (yytext_ptr)) - 1;
-
-	for ( i = 0; i < number_to_move; ++i )
-		*(dest++) = *(source++);
-
-	if ( YY_CURRENT_BUFFER_LVALUE->yy_buffer_status == YY_BUFFER_EOF_PENDING )
-		/* don't do the read, it's not guaranteed to return an EOF,
-		 * just force an EOF
-		 */
-		YY_CURRENT_BUFFER_LVALUE->yy_n_chars = (yy_n_chars) = 0;
-
-	else
-		{
-			yy_size_t num_to_read =
-			YY_CURRENT_BUFFER_LVALUE->yy_buf_size - number_to_move - 1;
-
-		while ( num_to_read <= 0 )
-			{ /* Not enough room in the buffer - grow it. */
-
-			/* just a shorter name for the current buffer */
-			YY_BUFFER_STATE b = YY_CURRENT_BUFFER;
-
-			int yy_c_buf_p_offset =
-				(int) ((yy_c_buf_p) - b->yy_ch_buf);
-
-			if ( b->yy_is_our_buffer )
-				{
-				yy_size_t new_size = b->yy_buf_size * 2;
-
-				if ( new_size <= 0 )
-					b->yy_buf_size += b->yy_buf_size / 8;
-				else
-					b->yy_buf_size *= 2;
-
-				b->yy_ch_buf = (char *)
-					/* Include room in for 2 EOB chars. */
-					yyrealloc((void *) b->yy_ch_buf,b->yy_buf_size + 2  );
-				}
-			else
-				/* Can't grow it, we don't own it. */
-				b->yy_ch_buf = 0;
-
-			if ( ! b->yy_ch_buf )
-				YY_FATAL_ERROR(
-				"fatal error - scanner input buffer overflow" );
-
-			(yy_c_buf_p) = &b->yy_ch_buf[yy_c_buf_p_offset];
-
-			num_to_read = YY_CURRENT_BUFFER_LVALUE->yy_buf_size -
-						number_to_move - 1;
-
-			}
-
-		if ( num_to_read > YY_READ_BUF_SIZE )
-			num_to_read = YY_READ_BUF_SIZE;
-
-		/* Read in more data. */
-		YY_INPUT( (&YY_CURRENT_BUFFER_LVALUE->yy_ch_buf[number_to_move]),
-			(yy_n_chars), num_to_read );
-
-		YY_CURRENT_BUFFER_LVALUE->yy_n_chars = (yy_n_chars);
-		}
-
-	if ( (yy_n_chars) == 0 )
-		{
-		if ( number_to_move == YY_MORE_ADJ )
-			{
-			ret_val = EOB_ACT_END_OF_FILE;
-			yyrestart(yyin  );
-			}
-
-		else
-			{
-			ret_val = EOB_ACT_LAST_MATCH;
-			YY_CURRENT_BUFFER_LVALUE->yy_buffer_status =
-				YY_BUFFER_EOF_PENDING;
-			}
-		}
-
-	else
-		ret_val = EOB_ACT_CONTINUE_SCAN;
-
-	if ((yy_size_t) ((yy_n_chars) + number_to_move) > YY_CURRENT_BUFFER_LVALUE->yy_buf_size) {
-		/* Extend the array by 50%, plus the number we really need. */
-		yy_size_t new_size = (yy_n_chars) + number_to_move + ((yy_n_chars) >> 1);
-		YY_CURRENT_BUFFER_LVALUE->yy_ch_buf = (char *) yyrealloc((void *) YY_CURRENT_BUFFER_LVALUE->yy_ch_buf,new_size  );
-		if ( ! YY_CURRENT_BUFFER_LVALUE->yy_ch_buf )
-			YY_FATAL_ERROR( "out of dynamic memory in yy_get_next_buffer()" );
-	}
-
-	(yy_n_chars) += number_to_move;
-	YY_CURRENT_BUFFER_LVALUE->yy_ch_buf[(yy_n_chars)] = YY_END_OF_BUFFER_CHAR;
-	YY_CURRENT_BUFFER_LVALUE->yy_ch_buf[(yy_n_chars) + 1] = YY_END_OF_BUFFER_CHAR;
-
-	(yytext_ptr) = &YY_CURRENT_BUFFER_LVALUE->yy_ch_buf[0];
-
-	return ret_val;
-}
+  parser->fields = NULL;
+  parser->nfields = parser->fields_cap = 0;
+  memset(parser->slots, 0, sizeof(parser->slots));
+  memset(parser->values, 0, sizeof(parser->values));
 
-/* yy_get_previous_state - get the state just before the EOB char was reached */
+  set_reply_url(parser, 0, 0);
+  data_reset(parser);
+  headers_reset(parser);
 
-    static yy_state_type yy_get_previous_state (void)
-{
-	register yy_state_type yy_current_state;
-	register char *yy_cp;
-    
-	yy_current_state = (yy_start);
-
-	for ( yy_cp = (yytext_ptr) + YY_MORE_ADJ; yy_cp < (yy_c_buf_p); ++yy_cp )
-		{
-		register YY_CHAR yy_c = (*yy_cp ? yy_ec[YY_SC_TO_UI(*yy_cp)] : 1);
-		if ( yy_accept[yy_current_state] )
-			{
-			(yy_last_accepting_state) = yy_current_state;
-			(yy_last_accepting_cpos) = yy_cp;
-			}
-		while ( yy_chk[yy_base[yy_current_state] + yy_c] != yy_current_state )
-			{
-			yy_current_state = (int) yy_def[yy_current_state];
-			if ( yy_current_state >= 34 )
-				yy_c = yy_meta[(unsigned int) yy_c];
-			}
-		yy_current_state = yy_nxt[yy_base[yy_current_state] + (unsigned int) yy_c];
-		}
-
-	return yy_current_state;
+  /* all of the event's memory goes at once. */
+  arena_reset(&parser->arena);
 }
 
-/* yy_try_NUL_trans - try to make a transition on the NUL character
- *
- * synopsis
- *	next_state = yy_try_NUL_trans( current_state );
- */
-    static yy_state_type yy_try_NUL_trans  (yy_state_type yy_current_state )
+static void flush(struct SSEParser* parser)
 {
-	register int yy_is_jam;
-    	register char *yy_cp = (yy_c_buf_p);
-
-	register YY_CHAR yy_c = 1;
-	if ( yy_accept[yy_current_state] )
-		{
-		(yy_last_accepting_state) = yy_current_state;
-		(yy_last_accepting_cpos) = yy_cp;
-		}
-	while ( yy_chk[yy_base[yy_current_state] + yy_c] != yy_current_state )
-		{
-		yy_current_state = (int) yy_def[yy_current_state];
-		if ( yy_current_state >= 34 )
-			yy_c = yy_meta[(unsigned int) yy_c];
-		}
-	yy_current_state = yy_nxt[yy_base[yy_current_state] + (unsigned int) yy_c];
-	yy_is_jam = (yy_current_state == 33);
-
-	return yy_is_jam ? 0 : yy_current_state;
-}
+  /*
+   * If neither headers nor data are set, then we flush after some
+   * keep-alive traffic (or some other traffic that does not conform
+   * to SSE)
+   */
+  if(parser->discard) {
+    /* the event was too large, and has already been reported. */
+  }
+  else if(parser->on_event) {
+    if(parser->nfields) {
+      struct SSEEvent event = { parser->fields, parser->nfields };
+      memcpy(event.slots, parser->slots, sizeof(event.slots));
+      parser->on_event(&event, parser->context);
+      parser->events++;
+    }
+  }
+  else if(*parser->headers || parser->data_len) {
+    parser->values[SSE_FIELD_DATA] = parser->data_buf;
+    parser->values[SSE_FIELD_REPLY] = parser->reply_url;
+    parser->values[SSE_FIELD_STREAM] = parser->stream;
+
+    if(parser->stream) {
+      char* header = arena_alloc(&parser->arena, strlen(parser->stream) + 8);
+      sprintf(header, "STREAM=%s", parser->stream);
+      header_add(parser, header);
+    }
 
-    static void yyunput (int c, register char * yy_bp )
-{
-	register char *yy_cp;
-    
-    yy_cp = (yy_c_buf_p);
-
-	/* undo effects of setting up yytext */
-	*yy_cp = (yy_hold_char);
-
-	if ( yy_cp < YY_CURRENT_BUFFER_LVALUE->yy_ch_buf + 2 )
-		{ /* need to shift things up to make room */
-		/* +2 for EOB chars. */
-		register yy_size_t number_to_move = (yy_n_chars) + 2;
-		register char *dest = &YY_CURRENT_BUFFER_LVALUE->yy_ch_buf[
-					YY_CURRENT_BUFFER_LVALUE->yy_buf_size + 2];
-		register char *source =
-				&YY_CURRENT_BUFFER_LVALUE->yy_ch_buf[number_to_move];
-
-		while ( source > YY_CURRENT_BUFFER_LVALUE->yy_ch_buf )
-			*--dest = *--source;
-
-		yy_cp += (int) (dest - source);
-		yy_bp += (int) (dest - source);
-		YY_CURRENT_BUFFER_LVALUE->yy_n_chars =
-			(yy_n_chars) = YY_CURRENT_BUFFER_LVALUE->yy_buf_size;
-
-		if ( yy_cp < YY_CURRENT_BUFFER_LVALUE->yy_ch_buf + 2 )
-			YY_FATAL_ERROR( "flex scanner push-back overflow" );
-		}
-
-	*--yy_cp = (char) c;
-
-	(yytext_ptr) = yy_bp;
-	(yy_hold_char) = *yy_cp;
-	(yy_c_buf_p) = yy_cp;
-}
+    on_sse_event(parser->headers, parser->values, parser->data_buf ? parser->data_buf : "", parser->reply_url);
+    parser->events++;
+  }
 
-#ifndef YY_NO_INPUT
-#ifdef __cplusplus
-    static int yyinput (void)
-#else
-    static int input  (void)
-#endif
-{
-	int c;
-    
-	*(yy_c_buf_p) = (yy_hold_char);
-
-	if ( *(yy_c_buf_p) == YY_END_OF_BUFFER_CHAR )
-		{
-		/* yy_c_buf_p now points to the character we want to return.
-		 * If this occurs *before* the EOB characters, then it's a
-		 * valid NUL; if not, then we've hit the end of the buffer.
-		 */
-		if ( (yy_c_buf_p) < &YY_CURRENT_BUFFER_LVALUE->yy_ch_buf[(yy_n_chars)] )
-			/* This was really a NUL. */
-			*(yy_c_buf_p) = '\0';
-
-		else
-			{ /* need more input */
-			yy_size_t offset = (yy_c_buf_p) - (yytext_ptr);
-			++(yy_c_buf_p);
-
-			switch ( yy_get_next_buffer(  ) )
-				{
-				case EOB_ACT_LAST_MATCH:
-					/* This happens because yy_g_n_b()
-					 * sees that we've accumulated a
-					 * token and flags that we need to
-					 * try matching the token before
-					 * proceeding.  But for input(),
-					 * there's no matching to consider.
-					 * So convert the EOB_ACT_LAST_MATCH
-					 * to EOB_ACT_END_OF_FILE.
-					 */
-
-					/* Reset buffer status. */
-					yyrestart(yyin );
-
-					/*FALLTHROUGH*/
-
-				case EOB_ACT_END_OF_FILE:
-					{
-					if ( yywrap( ) )
-						return 0;
-
-					if ( ! (yy_did_buffer_switch_on_eof) )
-						YY_NEW_FILE;
-#ifdef __cplusplus
-					return yyinput();
-#else
-					return input();
-#endif
-					}
-
-				case EOB_ACT_CONTINUE_SCAN:
-					(yy_c_buf_p) = (yytext_ptr) + offset;
-					break;
-				}
-			}
-		}
-
-	c = *(unsigned char *) (yy_c_buf_p);	/* cast for 8-bit char's */
-	*(yy_c_buf_p) = '\0';	/* preserve yytext */
-	(yy_hold_char) = *++(yy_c_buf_p);
-
-	return c;
-}
-#endif	/* ifndef YY_NO_INPUT */
+  if(!parser->discard)
+    last_id_update(parser);
 
-/** Immediately switch to a different input stream.
- * @param input_file A readable stream.
- * 
- * @note This function does not reset the start condition to @c INITIAL .
- */
-    void yyrestart  (FILE * input_file )
-{
-    
-	if ( ! YY_CURRENT_BUFFER ){
-        yyensure_buffer_stack ();
-		YY_CURRENT_BUFFER_LVALUE =
-            yy_create_buffer(yyin,YY_BUF_SIZE );
-	}
-
-	yy_init_buffer(YY_CURRENT_BUFFER,input_file );
-	yy_load_buffer_state( );
+  event_reset(parser);
 }
 
-/** Switch to a different input buffer.
- * @param new_buffer The new input buffer.
- * 
- */
-    void yy_switch_to_buffer  (YY_BUFFER_STATE  new_buffer )
-{
-    
-	/* TODO. We should be able to replace this entire function body
-	 * with
-	 *		yypop_buffer_state();
-	 *		yypush_buffer_state(new_buffer);
-     */
-	yyensure_buffer_stack ();
-	if ( YY_CURRENT_BUFFER == new_buffer )
-		return;
-
-	if ( YY_CURRENT_BUFFER )
-		{
-		/* Flush out information for old buffer. */
-		*(yy_c_buf_p) = (yy_hold_char);
-		YY_CURRENT_BUFFER_LVALUE->yy_buf_pos = (yy_c_buf_p);
-		YY_CURRENT_BUFFER_LVALUE->yy_n_chars = (yy_n_chars);
-		}
-
-	YY_CURRENT_BUFFER_LVALUE = new_buffer;
-	yy_load_buffer_state( );
-
-	/* We don't actually know whether we did this switch during
-	 * EOF (yywrap()) processing, but the only time this flag
-	 * is looked at is after yywrap() is called, so it's safe
-	 * to go ahead and always set it.
-	 */
-	(yy_did_buffer_switch_on_eof) = 1;
-}
+/* === lines ======================================================= */
 
-static void yy_load_buffer_state  (void)
-{
-    	(yy_n_chars) = YY_CURRENT_BUFFER_LVALUE->yy_n_chars;
-	(yytext_ptr) = (yy_c_buf_p) = YY_CURRENT_BUFFER_LVALUE->yy_buf_pos;
-	yyin = YY_CURRENT_BUFFER_LVALUE->yy_input_file;
-	(yy_hold_char) = *(yy_c_buf_p);
+/*
+ * Is \a ch a valid character in a field name? We only accept field
+ * names matching [-_0-9a-z]+.
+ */
+static int is_name_char(char ch) {
+  return (ch >= 'a' && ch <= 'z') || (ch >= '0' && ch <= '9') || ch == '-' || ch == '_';
 }
 
-/** Allocate and initialize an input buffer state.
- * @param file A readable stream.
- * @param size The character buffer size in bytes. When in doubt, use @c YY_BUF_SIZE.
- * 
- * @return the allocated buffer state.
+/*
+ * process a single line, not including its terminating newline. \a colon
+ * points to the first colon in the line, or is NULL.
  */
-    YY_BUFFER_STATE yy_create_buffer  (FILE * file, int  size )
+static void parse_line(struct SSEParser* parser, const char* line, const char* colon, const char* eol)
 {
-	YY_BUFFER_STATE b;
-    
-	b = (YY_BUFFER_STATE) yyalloc(sizeof( struct yy_buffer_state )  );
-	if ( ! b )
-		YY_FATAL_ERROR( "out of dynamic memory in yy_create_buffer()" );
-
-	b->yy_buf_size = size;
-
-	/* yy_ch_buf has to be 2 characters longer than the size given because
-	 * we need to put in 2 end-of-buffer characters.
-	 */
-	b->yy_ch_buf = (char *) yyalloc(b->yy_buf_size + 2  );
-	if ( ! b->yy_ch_buf )
-		YY_FATAL_ERROR( "out of dynamic memory in yy_create_buffer()" );
-
-	b->yy_is_our_buffer = 1;
+  /* an empty line terminates the event. */
+  if(line == eol) {
+    flush(parser);
+    return;
+  }
 
-	yy_init_buffer(b,file );
+  /*
+   * ignore lines starting with a colon (comments), and lines without 
+   * colon IN VIOLATION WITH THE SPECS.
+   */
+  if(!colon || colon == line)
+    return;
 
-	return b;
-}
+  int type = sse_field_lookup(line, colon - line);
 
-/** Destroy the buffer.
- * @param b a buffer created with yy_create_buffer()
- * 
- */
-    void yy_delete_buffer (YY_BUFFER_STATE  b )
-{
-    
-	if ( ! b )
-		return;
+  /* the name of any other field must match [-_0-9a-z]+ */
+  if(type == SSE_FIELD_OTHER) {
+    const char* s;
+    for(s = line; s < colon; ++s) {
+      if(!is_name_char(*s))
+        return;
+    }
+  }
 
-	if ( b == YY_CURRENT_BUFFER ) /* Not sure if we should pop here. */
-		YY_CURRENT_BUFFER_LVALUE = (YY_BUFFER_STATE) 0;
+  const char* value = colon + 1;
+  if(value < eol && *value == ' ') ++value;
+
+  /* the reconnection time, if the value has only digits. */
+  if(type == SSE_FIELD_RETRY && value < eol) {
+    const char* s;
+    long retry = 0;
+    for(s = value; s < eol && *s >= '0' && *s <= '9'; ++s)
+      retry = retry < 86400000 ? retry * 10 + (*s - '0') : retry;
+    if(s == eol)
+      parser->retry = retry;
+  }
 
-	if ( b->yy_is_our_buffer )
-		yyfree((void *) b->yy_ch_buf  );
+  if(parser->on_event) {
+    field_add(parser, type, line, colon, value, eol);
+    return;
+  }
 
-	yyfree((void *) b  );
+  switch(type) {
+    case SSE_FIELD_DATA:
+      /* the data attribute is special: multiple lines are concatenated */
+      data_add(parser, value, eol - value);
+      break;
+    case SSE_FIELD_REPLY:
+      set_reply_url(parser, value, eol - value);
+      break;
+    default:
+      /* all other attributes should appear only once */
+      header_add_from_line(parser, type, line, colon, eol);
+  }
 }
 
-/* Initializes or reinitializes a buffer.
- * This function is sometimes called more than once on the same buffer,
- * such as during a yyrestart() or at EOF.
- */
-    static void yy_init_buffer  (YY_BUFFER_STATE  b, FILE * file )
+/* === tail buffer ================================================= */
 
+static void tail_append(struct SSEParser* parser, const char* ptr, size_t len)
 {
-	int oerrno = errno;
-    
-	yy_flush_buffer(b );
+  if(!len) return;
 
-	b->yy_input_file = file;
-	b->yy_fill_buffer = 1;
+  if(parser->tail_len + len > parser->tail_size) {
+    size_t new_size = parser->tail_size ? parser->tail_size : 256;
+    while(new_size < parser->tail_len + len)
+      new_size *= 2;
 
-    /* If b is the current buffer, then yy_init_buffer was _probably_
-     * called from yyrestart() or through yy_get_next_buffer.
-     * In that case, we don't want to reset the lineno or column.
+    /*
+     * event fields might point into the tail; these are rebased before
+     * the old tail is released.
      */
-    if (b != YY_CURRENT_BUFFER){
-        b->yy_bs_lineno = 1;
-        b->yy_bs_column = 0;
+    char* tail = malloc(new_size);
+    if(!tail)
+      die("malloc");
+
+    if(parser->tail_len) {
+      memcpy(tail, parser->tail, parser->tail_len);
+      fields_rebase(parser, parser->tail, parser->tail + parser->tail_len, tail);
     }
 
-	b->yy_is_interactive = 1;
+    free(parser->tail);
+    parser->tail = tail;
+    parser->tail_size = new_size;
+  }
 
-	errno = oerrno;
+  memcpy(parser->tail + parser->tail_len, ptr, len);
+  parser->tail_len += len;
 }
 
-/** Discard all buffered characters. On the next scan, YY_INPUT will be called.
- * @param b the buffer state to be flushed, usually @c YY_CURRENT_BUFFER.
- * 
+/*
+ * drop the part of the tail that is no longer needed, i.e. everything
+ * before the unfinished line and before the earliest field of the
+ * current event that points into the tail.
  */
-    void yy_flush_buffer (YY_BUFFER_STATE  b )
+static void tail_compact(struct SSEParser* parser)
 {
-    	if ( ! b )
-		return;
-
-	b->yy_n_chars = 0;
+  size_t from = parser->line_start;
+  unsigned i;
 
-	/* We always need two end-of-buffer characters.  The first causes
-	 * a transition to the end-of-buffer state.  The second causes
-	 * a jam in that state.
-	 */
-	b->yy_ch_buf[0] = YY_END_OF_BUFFER_CHAR;
-	b->yy_ch_buf[1] = YY_END_OF_BUFFER_CHAR;
+  for(i = 0; i < parser->nfields; ++i) {
+    const char* p = parser->fields[i].name.ptr;
+    if(p >= parser->tail && p < parser->tail + parser->tail_len && (size_t)(p - parser->tail) < from)
+      from = p - parser->tail;
+  }
 
-	b->yy_buf_pos = &b->yy_ch_buf[0];
+  if(!from)
+    return;
 
-	b->yy_at_bol = 1;
-	b->yy_buffer_status = YY_BUFFER_NEW;
+  memmove(parser->tail, parser->tail + from, parser->tail_len - from);
+  fields_rebase(parser, parser->tail + from, parser->tail + parser->tail_len, parser->tail);
 
-	if ( b == YY_CURRENT_BUFFER )
-		yy_load_buffer_state( );
+  parser->tail_len -= from;
+  parser->line_start -= from;
 }
 
-/** Pushes the new state onto the stack. The new state becomes
- *  the current state. This function will allocate the stack
- *  if necessary.
- *  @param new_buffer The new state.
- *  
+/*
+ * is an unfinished line of \a len bytes longer than any line we keep?
  */
-void yypush_buffer_state (YY_BUFFER_STATE new_buffer )
+static int line_too_long(struct SSEParser* parser, size_t len)
 {
-    	if (new_buffer == NULL)
-		return;
-
-	yyensure_buffer_stack();
-
-	/* This block is copied from yy_switch_to_buffer. */
-	if ( YY_CURRENT_BUFFER )
-		{
-		/* Flush out information for old buffer. */
-		*(yy_c_buf_p) = (yy_hold_char);
-		YY_CURRENT_BUFFER_LVALUE->yy_buf_pos = (yy_c_buf_p);
-		YY_CURRENT_BUFFER_LVALUE->yy_n_chars = (yy_n_chars);
-		}
-
-	/* Only push if top exists. Otherwise, replace top. */
-	if (YY_CURRENT_BUFFER)
-		(yy_buffer_stack_top)++;
-	YY_CURRENT_BUFFER_LVALUE = new_buffer;
-
-	/* copied from yy_switch_to_buffer. */
-	yy_load_buffer_state( );
-	(yy_did_buffer_switch_on_eof) = 1;
+  return parser->max_data_size && len > parser->max_data_size + LINE_SLACK;
 }
 
-/** Removes and deletes the top of the stack, if present.
- *  The next element becomes the new top.
- *  
+/*
+ * drop the unfinished line in the tail, and its event.
  */
-void yypop_buffer_state (void)
+static void line_drop(struct SSEParser* parser)
 {
-    	if (!YY_CURRENT_BUFFER)
-		return;
-
-	yy_delete_buffer(YY_CURRENT_BUFFER );
-	YY_CURRENT_BUFFER_LVALUE = NULL;
-	if ((yy_buffer_stack_top) > 0)
-		--(yy_buffer_stack_top);
-
-	if (YY_CURRENT_BUFFER) {
-		yy_load_buffer_state( );
-		(yy_did_buffer_switch_on_eof) = 1;
-	}
-}
+  if(!parser->discard)
+    fprintf(stderr, "line exceeds %lu byte, dropping event\n", (unsigned long) parser->max_data_size);
 
-/* Allocates the stack if it does not exist.
- *  Guarantees space for at least one push.
- */
-static void yyensure_buffer_stack (void)
-{
-	yy_size_t num_to_alloc;
-    
-	if (!(yy_buffer_stack)) {
-
-		/* First allocation is just for 2 elements, since we don't know if this
-		 * scanner will even need a stack. We use 2 instead of 1 to avoid an
-		 * immediate realloc on the next call.
-         */
-		num_to_alloc = 1;
-		(yy_buffer_stack) = (struct yy_buffer_state**)yyalloc
-								(num_to_alloc * sizeof(struct yy_buffer_state*)
-								);
-		if ( ! (yy_buffer_stack) )
-			YY_FATAL_ERROR( "out of dynamic memory in yyensure_buffer_stack()" );
-								  
-		memset((yy_buffer_stack), 0, num_to_alloc * sizeof(struct yy_buffer_state*));
-				
-		(yy_buffer_stack_max) = num_to_alloc;
-		(yy_buffer_stack_top) = 0;
-		return;
-	}
-
-	if ((yy_buffer_stack_top) >= ((yy_buffer_stack_max)) - 1){
-
-		/* Increase the buffer to prepare for a possible push. */
-		int grow_size = 8 /* arbitrary grow size */;
-
-		num_to_alloc = (yy_buffer_stack_max) + grow_size;
-		(yy_buffer_stack) = (struct yy_buffer_state**)yyrealloc
-								((yy_buffer_stack),
-								num_to_alloc * sizeof(struct yy_buffer_state*)
-								);
-		if ( ! (yy_buffer_stack) )
-			YY_FATAL_ERROR( "out of dynamic memory in yyensure_buffer_stack()" );
-
-		/* zero only the new slots.*/
-		memset((yy_buffer_stack) + (yy_buffer_stack_max), 0, grow_size * sizeof(struct yy_buffer_state*));
-		(yy_buffer_stack_max) = num_to_alloc;
-	}
+  parser->discard = 1;
+  parser->nfields = 0;
+  parser->tail_len = parser->line_start;
 }
 
-/** Setup the input buffer state to scan directly from a user-specified character buffer.
- * @param base the character buffer
- * @param size the size in bytes of the character buffer
- * 
- * @return the newly allocated buffer state object. 
- */
-YY_BUFFER_STATE yy_scan_buffer  (char * base, yy_size_t  size )
-{
-	YY_BUFFER_STATE b;
-    
-	if ( size < 2 ||
-	     base[size-2] != YY_END_OF_BUFFER_CHAR ||
-	     base[size-1] != YY_END_OF_BUFFER_CHAR )
-		/* They forgot to leave room for the EOB's. */
-		return 0;
-
-	b = (YY_BUFFER_STATE) yyalloc(sizeof( struct yy_buffer_state )  );
-	if ( ! b )
-		YY_FATAL_ERROR( "out of dynamic memory in yy_scan_buffer()" );
-
-	b->yy_buf_size = size - 2;	/* "- 2" to take care of EOB's */
-	b->yy_buf_pos = b->yy_ch_buf = base;
-	b->yy_is_our_buffer = 0;
-	b->yy_input_file = 0;
-	b->yy_n_chars = b->yy_buf_size;
-	b->yy_is_interactive = 0;
-	b->yy_at_bol = 1;
-	b->yy_fill_buffer = 0;
-	b->yy_buffer_status = YY_BUFFER_NEW;
-
-	yy_switch_to_buffer(b  );
-
-	return b;
-}
+/* === API ========================================================= */
 
-/** Setup the input buffer state to scan a string. The next call to yylex() will
- * scan from a @e copy of @a str.
- * @param yystr a NUL-terminated string to scan
- * 
- * @return the newly allocated buffer state object.
- * @note If you want to scan bytes that may contain NUL values, then use
- *       yy_scan_bytes() instead.
- */
-YY_BUFFER_STATE yy_scan_string (yyconst char * yystr )
+void sse_parser_init(struct SSEParser* parser)
 {
-    
-	return yy_scan_bytes(yystr,strlen(yystr) );
-}
+  memset(parser, 0, sizeof(*parser));
+  parser->header_ptr = parser->headers;
+  parser->retry = -1;
 
-/** Setup the input buffer state to scan the given bytes. The next call to yylex() will
- * scan from a @e copy of @a bytes.
- * @param bytes the byte buffer to scan
- * @param len the number of bytes in the buffer pointed to by @a bytes.
- * 
- * @return the newly allocated buffer state object.
- */
-YY_BUFFER_STATE yy_scan_bytes  (yyconst char * yybytes, yy_size_t  _yybytes_len )
-{
-	YY_BUFFER_STATE b;
-	char *buf;
-	yy_size_t n, i;
-    
-	/* Get memory for full buffer, including space for trailing EOB's. */
-	n = _yybytes_len + 2;
-	buf = (char *) yyalloc(n  );
-	if ( ! buf )
-		YY_FATAL_ERROR( "out of dynamic memory in yy_scan_bytes()" );
-
-	for ( i = 0; i < _yybytes_len; ++i )
-		buf[i] = yybytes[i];
-
-	buf[_yybytes_len] = buf[_yybytes_len+1] = YY_END_OF_BUFFER_CHAR;
-
-	b = yy_scan_buffer(buf,n );
-	if ( ! b )
-		YY_FATAL_ERROR( "bad buffer in yy_scan_bytes()" );
-
-	/* It's okay to grow etc. this buffer, and we should throw it
-	 * away when we're done.
-	 */
-	b->yy_is_our_buffer = 1;
-
-	return b;
+  arena_init(&parser->arena, EVENT_ARENA_SIZE);
 }
 
-#ifndef YY_EXIT_FAILURE
-#define YY_EXIT_FAILURE 2
-#endif
-
-static void yy_fatal_error (yyconst char* msg )
+void sse_parser_free(struct SSEParser* parser)
 {
-    	(void) fprintf( stderr, "%s\n", msg );
-	exit( YY_EXIT_FAILURE );
-}
+  arena_free(&parser->arena);
+  free(parser->tail);
+  free(parser->last_id);
 
-/* Redefine yyless() so it works in section 3 code. */
-
-#undef yyless
-#define yyless(n) \
-	do \
-		{ \
-		/* Undo effects of setting up yytext. */ \
-        int yyless_macro_arg = (n); \
-        YY_LESS_LINENO(yyless_macro_arg);\
-		yytext[yyleng] = (yy_hold_char); \
-		(yy_c_buf_p) = yytext + yyless_macro_arg; \
-		(yy_hold_char) = *(yy_c_buf_p); \
-		*(yy_c_buf_p) = '\0'; \
-		yyleng = yyless_macro_arg; \
-		} \
-	while ( 0 )
-
-/* Accessor  methods (get/set functions) to struct members. */
-
-/** Get the current line number.
- * 
- */
-int yyget_lineno  (void)
-{
-        
-    return yylineno;
+  memset(parser, 0, sizeof(*parser));
 }
 
-/** Get the input stream.
- * 
- */
-FILE *yyget_in  (void)
+void sse_parser_reset(struct SSEParser* parser)
 {
-        return yyin;
+  event_reset(parser);
+  parser->tail_len = parser->line_start = 0;
+  parser->skip_line = 0;
 }
 
-/** Get the output stream.
- * 
+/*
+ * feed some data into the parser.
  */
-FILE *yyget_out  (void)
+void sse_parser_feed(struct SSEParser* parser, const char* ptr, size_t len)
 {
-        return yyout;
-}
+  const char* start = ptr;
+  const char* end = ptr + len;
+  const char* eol;
+  const char* colon;
 
-/** Get the length of the current token.
- * 
- */
-yy_size_t yyget_leng  (void)
-{
-        return yyleng;
-}
+  /* skip the rest of an overlong line. */
+  if(parser->skip_line) {
+    eol = sse_scan_line(ptr, end, &colon);
+    if(!eol)
+      return;
 
-/** Get the current token.
- * 
- */
+    parser->skip_line = 0;
+    ptr = eol + 1;
+  }
 
-char *yyget_text  (void)
-{
-        return yytext;
-}
+  /*
+   * If a line was left unfinished by the previous chunk, complete it
+   * first. If this chunk doesn't finish it either we just hold on to it.
+   */
+  if(parser->tail_len > parser->line_start) {
+    size_t pending = parser->tail_len - parser->line_start;
+
+    eol = sse_scan_line(ptr, end, &colon);
+    if(line_too_long(parser, pending + ((eol ? eol : end) - ptr))) {
+      line_drop(parser);
+      if(!eol) {
+        parser->skip_line = 1;
+        return;
+      }
+      ptr = eol + 1;
+    }
+    else if(!eol) {
+      tail_append(parser, ptr, end - ptr);
+      return;
+    }
+    else {
+      tail_append(parser, ptr, eol - ptr);
 
-/** Set the current line number.
- * @param line_number
- * 
- */
-void yyset_lineno (int  line_number )
-{
-    
-    yylineno = line_number;
-}
+      const char* line = parser->tail + parser->line_start;
+      const char* line_end = parser->tail + parser->tail_len;
+      parser->line_start = parser->tail_len;
 
-/** Set the input stream. This does not discard the current
- * input buffer.
- * @param in_str A readable stream.
- * 
- * @see yy_switch_to_buffer
- */
-void yyset_in (FILE *  in_str )
-{
-        yyin = in_str ;
-}
+      parse_line(parser, line, memchr(line, ':', line_end - line), line_end);
+      ptr = eol + 1;
+    }
+  }
 
-void yyset_out (FILE *  out_str )
-{
-        yyout = out_str ;
-}
+  /* scan all complete lines in place. */
+  while(ptr < end && (eol = sse_scan_line(ptr, end, &colon)) != NULL) {
+    parse_line(parser, ptr, colon, eol);
+    ptr = eol + 1;
+  }
 
-int yyget_debug  (void)
-{
-        return yy_flex_debug;
-}
+  /*
+   * Keep the unfinished rest for the next call. If the current event has
+   * fields pointing into this chunk, these must be kept as well, because
+   * the caller is free to reuse its buffer once we return.
+   */
+  tail_compact(parser);
 
-void yyset_debug (int  bdebug )
-{
-        yy_flex_debug = bdebug ;
-}
+  if(line_too_long(parser, end - ptr)) {
+    line_drop(parser);
+    parser->skip_line = 1;
+    return;
+  }
 
-static int yy_init_globals (void)
-{
-        /* Initialization is the same as for the non-reentrant scanner.
-     * This function is called from yylex_destroy(), so don't allocate here.
-     */
+  const char* keep = ptr;
+  unsigned i;
+  for(i = 0; i < parser->nfields; ++i) {
+    const char* p = parser->fields[i].name.ptr;
+    if(p >= start && p < keep)
+      keep = p;
+  }
 
-    (yy_buffer_stack) = 0;
-    (yy_buffer_stack_top) = 0;
-    (yy_buffer_stack_max) = 0;
-    (yy_c_buf_p) = (char *) 0;
-    (yy_init) = 0;
-    (yy_start) = 0;
-
-/* Defined in main.c */
-#ifdef YY_STDINIT
-    yyin = stdin;
-    yyout = stdout;
-#else
-    yyin = (FILE *) 0;
-    yyout = (FILE *) 0;
-#endif
-
-    /* For future reference: Set errno on error, since we are called by
-     * yylex_init()
-     */
-    return 0;
-}
+  size_t base = parser->tail_len;
+  tail_append(parser, keep, end - keep);
+  fields_rebase(parser, keep, end, parser->tail + base);
 
-/* yylex_destroy is for both reentrant and non-reentrant scanners. */
-int yylex_destroy  (void)
-{
-    
-    /* Pop the buffer stack, destroying each element. */
-	while(YY_CURRENT_BUFFER){
-		yy_delete_buffer(YY_CURRENT_BUFFER  );
-		YY_CURRENT_BUFFER_LVALUE = NULL;
-		yypop_buffer_state();
-	}
-
-	/* Destroy the stack itself. */
-	yyfree((yy_buffer_stack) );
-	(yy_buffer_stack) = NULL;
-
-    /* Reset the globals. This is important in a non-reentrant scanner so the next time
-     * yylex() is called, initialization will occur. */
-    yy_init_globals( );
-
-    return 0;
+  parser->line_start = base + (ptr - keep);
 }
 
 /*
- * Internal utility routines.
+ * returns a copy of \a event, which is allocated in a single block and
+ * must be released via free(3). All names and values in the copy are
+ * NUL terminated.
  */
-
-#ifndef yytext_ptr
-static void yy_flex_strncpy (char* s1, yyconst char * s2, int n )
-{
-	register int i;
-	for ( i = 0; i < n; ++i )
-		s1[i] = s2[i];
-}
-#endif
-
-#ifdef YY_NEED_STRLEN
-static int yy_flex_strlen (yyconst char * s )
-{
-	register int n;
-	for ( n = 0; s[n]; ++n )
-		;
-
-	return n;
-}
-#endif
-
-void *yyalloc (yy_size_t  size )
-{
-	return (void *) malloc( size );
-}
-
-void *yyrealloc  (void * ptr, yy_size_t  size )
-{
-	/* The cast to (char *) in the following accommodates both
-	 * implementations that use char* generic pointers, and those
-	 * that use void* generic pointers.  It works with the latter
-	 * because both ANSI C and C++ allow castless assignment from
-	 * any pointer type to void*, and deal with argument conversions
-	 * as though doing an assignment.
-	 */
-	return (void *) realloc( (char *) ptr, size );
-}
-
-void yyfree (void * ptr )
+struct SSEEvent* sse_event_copy(const struct SSEEvent* event)
 {
-	free( (char *) ptr );	/* see yyrealloc() for (char *) cast */
-}
+  size_t size = sizeof(struct SSEEvent) + event->nfields * sizeof(struct SSEField);
+  unsigned i;
 
-#define YYTABLES_NAME "yytables"
+  for(i = 0; i < event->nfields; ++i)
+    size += event->fields[i].name.len + event->fields[i].value.len + 2;
 
-#line 150 "src/parse-sse.fl"
+  struct SSEEvent* copy = malloc(size);
+  if(!copy)
+    die("malloc");
 
+  copy->fields = (struct SSEField*) (copy + 1);
+  copy->nfields = event->nfields;
+  memcpy(copy->slots, event->slots, sizeof(copy->slots));
 
+  char* p = (char*) (copy->fields + event->nfields);
+  for(i = 0; i < event->nfields; ++i) {
+    const struct SSEField* field = event->fields + i;
+    struct SSEField* dest = copy->fields + i;
 
-/*
- * curl callback to feed some data into the lexer.
- */
-void parse_sse(char *ptr, size_t size) {
-  (void)yyunput;
+    dest->type = field->type;
 
+    memcpy(p, field->name.ptr, field->name.len);
+    p[field->name.len] = 0;
+    dest->name.ptr = p;
+    dest->name.len = field->name.len;
+    p += field->name.len + 1;
 
-  YY_BUFFER_STATE buffer = yy_scan_bytes(ptr, size);
-  while(yylex());
-  yy_delete_buffer(buffer);
-}
+    memcpy(p, field->value.ptr, field->value.len);
+    p[field->value.len] = 0;
+    dest->value.ptr = p;
+    dest->value.len = field->value.len;
+    p += field->value.len + 1;
+  }
 
-int yywrap() { 
-  return 1; 
+  return copy;
 }
-
-
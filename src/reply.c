@@ -0,0 +1,572 @@
+/*
+ * This file is part of the sse package, copyright (c) 2011, 2012, @radiospiel.
+ * It is copyrighted under the terms of the modified BSD license, see LICENSE.BSD.
+ *
+ * For more information see https://https://github.com/radiospiel/sse.
+ */
+
+/*
+ * Posting replies (the SSE "reply" attribute).
+ *
+ * Replies are posted in the background, so that the stream is read on
+ * while they are in flight. send_reply() queues a reply, and the reply
+ * thread runs the queued replies through a curl multi handle, up to
+ * REPLY_TRANSFERS at a time. The multi handle keeps connections open,
+ * and its easy handles share DNS and TLS session caches; so replies to
+ * the same host go out over a few reused connections.
+ *
+ * With --reply-batch <n>, replies to the same URL are collected into a
+ * group, which is posted as one request once it holds <n> replies, or
+ * --reply-window msecs after its first reply. Its body is a JSON array
+ * with an object per event:
+ *
+ *   [{"id":"<event id>","body":"<reply>"},...]
+ *
+ * The outcome of a request is accounted to each of its events. A request
+ * that fails is reported, and retried after a growing delay; up to
+ * REPLY_ATTEMPTS times, or - with --reply-spool - until it goes through.
+ * When sse ends, the retries go on until they run out, which takes
+ * some 15 secs at most; a spooled request is left in the spool instead.
+ * A request that cannot succeed (see reply_failed_for_good) is not
+ * retried. A failing reply never stops sse.
+ *
+ * With --reply-spool <dir> each request is written to a spool (see
+ * spool.c) when it is queued, and what was not delivered when sse ends
+ * is posted when it is started again. send_reply() then does not wait
+ * for the queue: the requests' bodies are kept in the spool, not in
+ * memory. A request the spool cannot take is kept in memory; it is
+ * spooled when it is retried, if the spool takes it by then.
+ */
+
+#include <pthread.h>
+#include <time.h>
+#include "sse.h"
+#include "http.h"
+
+#define REPLY_QUEUE_LIMIT       1024  // requests queued before send_reply() waits
+#define REPLY_TRANSFERS         16    // requests in flight at the same time
+#define REPLY_HOST_CONNECTIONS  4     // connections per host
+#define REPLY_ATTEMPTS          5     // attempts per request, without a spool
+#define REPLY_BACKOFF_MAX       60    // max. secs between attempts
+
+/*
+ * a request, replying to one or more events.
+ */
+struct Reply {
+  char*         url;
+  struct Buffer body;
+  int           nevents;
+  char**        ids;            // the events' ids; entries may be NULL
+  int           batched;        // set if body is a JSON array
+  struct timespec since;        // when the first event came in
+  const char*   payload;        // the body to post: body, or the spool's copy
+  size_t        payload_len;
+  const void*   spooled;        // the spool entry, or NULL
+  int           attempts;
+  struct timespec retry_at;
+  char          error[CURL_ERROR_SIZE];
+  struct Reply* next;
+};
+
+static struct Reply* queue = 0;
+static struct Reply** queue_tail = &queue;
+static int queued = 0;
+static struct Reply* groups = 0;  // replies being collected, one group per URL
+static int closing = 0;
+
+static unsigned long delivered = 0, failed = 0, left = 0;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  dequeued = PTHREAD_COND_INITIALIZER;
+static pthread_t thread;
+
+/* owned by the reply thread */
+static CURLM* multi = 0;
+static CURLSH* share = 0;
+static struct curl_slist* reply_headers = 0;
+static struct curl_slist* batch_headers = 0;
+static CURL* idle[REPLY_TRANSFERS];
+static int nidle = 0;
+static int running = 0;
+static struct Reply* retries = 0;   // requests waiting for another attempt
+
+static struct Reply* reply_new(const char* url, int max_events)
+{
+  struct Reply* reply = calloc(1, sizeof(*reply));
+  if(!reply)
+    die("calloc");
+
+  reply->url = strdup(url);
+  reply->ids = calloc(max_events, sizeof(char*));
+  if(!reply->url || !reply->ids)
+    die("malloc");
+
+  return reply;
+}
+
+static void reply_free(struct Reply* reply)
+{
+  int i;
+  for(i = 0; i < reply->nevents; ++i)
+    free(reply->ids[i]);
+
+  free(reply->ids);
+  free(reply->url);
+  free(reply->body.data);
+  free(reply);
+}
+
+/*
+ * queue \a reply for posting. Must be called with the lock held.
+ */
+static void reply_queue(struct Reply* reply)
+{
+  if(options.reply_spool && !reply->spooled) {
+    reply->spooled = spool_append(reply->url, reply->ids, reply->nevents, reply->batched,
+      reply->body.data ? reply->body.data : "", reply->body.len, &reply->payload);
+    reply->payload_len = reply->body.len;
+
+    if(reply->spooled) {
+      free(reply->body.data);
+      memset(&reply->body, 0, sizeof(reply->body));
+    }
+  }
+
+  if(!reply->spooled) {
+    reply->payload = reply->body.data ? reply->body.data : "";
+    reply->payload_len = reply->body.len;
+  }
+
+  *queue_tail = reply;
+  queue_tail = &reply->next;
+  reply->next = 0;
+  queued++;
+}
+
+/*
+ * add an event's reply to the group for \a url, and queue the group
+ * once it is full. Must be called with the lock held; returns 1 if a
+ * group was started.
+ */
+static int reply_coalesce(const char* url, const char* id, const char* body, size_t len)
+{
+  struct Reply** p = &groups;
+  int started = 0;
+
+  while(*p && strcmp((*p)->url, url))
+    p = &(*p)->next;
+
+  if(!*p) {
+    *p = reply_new(url, options.reply_batch);
+    (*p)->batched = 1;
+    clock_gettime(CLOCK_MONOTONIC, &(*p)->since);
+    buffer_append(&(*p)->body, "[", 1);
+    started = 1;
+  }
+
+  struct Reply* group = *p;
+
+  if(group->nevents)
+    buffer_append(&group->body, ",", 1);
+
+  buffer_append(&group->body, "{\"id\":", 6);
+  if(id)
+    buffer_append_json_string(&group->body, id, strlen(id));
+  else
+    buffer_append(&group->body, "null", 4);
+
+  buffer_append(&group->body, ",\"body\":", 8);
+  buffer_append_json_string(&group->body, body, len);
+  buffer_append(&group->body, "}", 1);
+
+  group->ids[group->nevents++] = id ? strdup(id) : 0;
+
+  if(group->nevents == options.reply_batch) {
+    *p = group->next;
+    buffer_append(&group->body, "]", 1);
+    reply_queue(group);
+  }
+
+  return started;
+}
+
+/*
+ * queue the groups whose window has passed - or all of them, when
+ * closing. Must be called with the lock held. Returns the msecs until
+ * the next group is due, or -1.
+ */
+static long reply_groups_due()
+{
+  struct timespec now;
+  struct Reply** p = &groups;
+  long next = -1;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  while(*p) {
+    struct Reply* group = *p;
+    long age = (now.tv_sec - group->since.tv_sec) * 1000 + (now.tv_nsec - group->since.tv_nsec) / 1000000;
+
+    if(!closing && age < options.reply_window) {
+      if(next < 0 || options.reply_window - age < next)
+        next = options.reply_window - age;
+      p = &group->next;
+      continue;
+    }
+
+    *p = group->next;
+    buffer_append(&group->body, "]", 1);
+    reply_queue(group);
+  }
+
+  return next;
+}
+
+/*
+ * start posting \a reply.
+ */
+static void reply_start(struct Reply* reply)
+{
+  CURL* curl = nidle ? idle[--nidle] : 0;
+
+  if(!curl) {
+    curl = curl_easy_init();
+    if(!curl)
+      die("curl");
+
+    http_setup(curl);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 10L);
+    curl_easy_setopt(curl, CURLOPT_SHARE, share);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, http_ignore_data);
+    curl_easy_setopt(curl, CURLOPT_POST, 1L);
+  }
+
+  curl_easy_setopt(curl, CURLOPT_URL, reply->url);
+  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, reply->batched ? batch_headers : reply_headers);
+  curl_easy_setopt(curl, CURLOPT_POSTFIELDS, reply->payload);
+  curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long) reply->payload_len);
+  curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, reply->error);
+  curl_easy_setopt(curl, CURLOPT_PRIVATE, reply);
+
+  *reply->error = 0;
+  curl_multi_add_handle(multi, curl);
+  running++;
+}
+
+/*
+ * try \a reply again later: after 1, 2, 4... secs.
+ */
+static void reply_retry(struct Reply* reply)
+{
+  int delay = reply->attempts < 6 ? 1 << reply->attempts : REPLY_BACKOFF_MAX;
+  if(delay > REPLY_BACKOFF_MAX)
+    delay = REPLY_BACKOFF_MAX;
+
+  reply->attempts++;
+  clock_gettime(CLOCK_MONOTONIC, &reply->retry_at);
+  reply->retry_at.tv_sec += delay;
+
+  reply->next = retries;
+  retries = reply;
+}
+
+/*
+ * queue the requests that are due for another attempt. When closing,
+ * a spooled request is not tried again, but left in the spool. Must be
+ * called with the lock held. Returns the msecs until the next one is
+ * due, or -1.
+ */
+static long reply_retries_due()
+{
+  struct timespec now;
+  struct Reply** p = &retries;
+  long next = -1;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  while(*p) {
+    struct Reply* reply = *p;
+    long wait = (reply->retry_at.tv_sec - now.tv_sec) * 1000 + (reply->retry_at.tv_nsec - now.tv_nsec) / 1000000;
+
+    if(closing && reply->spooled) {
+      *p = reply->next;
+      left += reply->nevents;
+      reply_free(reply);
+      continue;
+    }
+
+    if(wait > 0) {
+      if(next < 0 || wait < next)
+        next = wait;
+      p = &reply->next;
+      continue;
+    }
+
+    *p = reply->next;
+    reply_queue(reply);
+  }
+
+  return next;
+}
+
+/*
+ * would \a reply fail again, however often it is retried? This is the
+ * case for a client error other than 408 (Request Timeout) and 429 (Too
+ * Many Requests), and for a URL that curl cannot handle.
+ */
+static int reply_failed_for_good(CURLcode result, long response_code)
+{
+  switch(result) {
+  case CURLE_OK:
+    return response_code >= 400 && response_code < 500 &&
+      response_code != 408 && response_code != 429;
+  case CURLE_URL_MALFORMAT:
+  case CURLE_UNSUPPORTED_PROTOCOL:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+/*
+ * report and free the replies that are done.
+ */
+static void replies_done()
+{
+  CURLMsg* msg;
+  int n;
+
+  while((msg = curl_multi_info_read(multi, &n)) != 0) {
+    if(msg->msg != CURLMSG_DONE)
+      continue;
+
+    CURL* curl = msg->easy_handle;
+    struct Reply* reply;
+    long response_code = 0;
+    char status[64];
+    const char* error = 0;
+
+    curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char**) &reply);
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
+
+    if(msg->data.result != CURLE_OK) {
+      error = *reply->error ? reply->error : curl_easy_strerror(msg->data.result);
+    }
+    else if(response_code < 200 || response_code >= 300) {
+      sprintf(status, "HTTP(S) status code %ld", response_code);
+      error = status;
+    }
+
+    curl_multi_remove_handle(multi, curl);
+    idle[nidle++] = curl;
+    running--;
+
+    int retry = error && !reply_failed_for_good(msg->data.result, response_code) &&
+      (reply->spooled || reply->attempts + 1 < REPLY_ATTEMPTS);
+
+    if(error) {
+      int i;
+      for(i = 0; i < reply->nevents; ++i)
+        fprintf(stderr, "REPLY %s failed for event %s: %s%s\n", reply->url,
+          reply->ids[i] && *reply->ids[i] ? reply->ids[i] : "-", error, retry ? ", retrying" : ", giving up");
+    }
+
+    if(retry) {
+      reply_retry(reply);
+      continue;
+    }
+
+    pthread_mutex_lock(&lock);
+    if(error)
+      failed += reply->nevents;
+    else
+      delivered += reply->nevents;
+    pthread_mutex_unlock(&lock);
+
+    if(reply->spooled)
+      spool_done(reply->spooled);
+
+    reply_free(reply);
+  }
+}
+
+static void* reply_thread(void* arg)
+{
+  while(1) {
+    /* take what fits from the queue */
+    struct Reply* start = 0;
+    int stopping;
+
+    pthread_mutex_lock(&lock);
+
+    long timeout = 1000, due;
+
+    if((due = reply_groups_due()) >= 0 && due < timeout)
+      timeout = due;
+    if((due = reply_retries_due()) >= 0 && due < timeout)
+      timeout = due;
+
+    if(queue && running < REPLY_TRANSFERS) {
+      struct Reply** p = &queue;
+      int n;
+
+      for(n = running; *p && n < REPLY_TRANSFERS; ++n)
+        p = &(*p)->next, --queued;
+
+      start = queue;
+      queue = *p;
+      *p = 0;
+      if(!queue)
+        queue_tail = &queue;
+
+      pthread_cond_broadcast(&dequeued);
+    }
+
+    stopping = closing && !queue && !retries;
+
+    pthread_mutex_unlock(&lock);
+
+    if(stopping && !start && !running)
+      break;
+
+    while(start) {
+      struct Reply* next = start->next;
+      reply_start(start);
+      start = next;
+    }
+
+    int still_running;
+    curl_multi_perform(multi, &still_running);
+    replies_done();
+
+    if(options.reply_spool && (due = spool_sync(0)) < timeout)
+      timeout = due;
+
+    if(!stopping || running)
+      curl_multi_poll(multi, 0, 0, (int) timeout, 0);
+  }
+
+  return 0;
+}
+
+/*
+ * queue a request that was left in the spool.
+ */
+static void reply_unspool(const struct SpoolEntry* entry)
+{
+  struct Reply* reply = reply_new(entry->url, entry->nevents ? entry->nevents : 1);
+  const char* id = entry->ids;
+
+  for(reply->nevents = 0; reply->nevents < entry->nevents; ++reply->nevents) {
+    reply->ids[reply->nevents] = strdup(id);
+    id += strlen(id) + 1;
+  }
+
+  reply->batched = entry->batched;
+  reply->payload = entry->body;
+  reply->payload_len = entry->len;
+  reply->spooled = entry->handle;
+
+  pthread_mutex_lock(&lock);
+  reply_queue(reply);
+  pthread_mutex_unlock(&lock);
+}
+
+void replies_start()
+{
+  /* curl must outlive the reply thread; see replies_drain(). */
+  curl_global_init(CURL_GLOBAL_ALL);
+
+  multi = curl_multi_init();
+  share = curl_share_init();
+  if(!multi || !share)
+    die("curl");
+
+  curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long) REPLY_HOST_CONNECTIONS);
+  curl_multi_setopt(multi, CURLMOPT_MAXCONNECTS, (long) REPLY_TRANSFERS);
+
+  /* all handles are used by the reply thread only, so no locking is needed. */
+  curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+  curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+
+  /*
+   * "Expect:" turns off the "Expect: 100-continue" header, which some
+   * servers do not answer - leading to a delay of a second or two. Our
+   * bodies are small anyways.
+   */
+  reply_headers = curl_slist_append(reply_headers, "Content-Type:");
+  reply_headers = curl_slist_append(reply_headers, "Expect:");
+
+  batch_headers = curl_slist_append(batch_headers, "Content-Type: application/json");
+  batch_headers = curl_slist_append(batch_headers, "Expect:");
+
+  if(options.reply_spool)
+    spool_open(options.reply_spool, reply_unspool);
+
+  if(pthread_create(&thread, 0, reply_thread, 0))
+    die("pthread_create");
+
+  atexit(replies_drain);
+}
+
+void send_reply(const char* reply_url, const char* event_id, const char* body, size_t len)
+{
+  int wake = 1;
+
+  if(options.verbosity)
+    fprintf(stderr, "REPLY %s (%d byte)\n", reply_url, (int) len);
+
+  pthread_mutex_lock(&lock);
+
+  while(queued >= REPLY_QUEUE_LIMIT && !options.reply_spool)
+    pthread_cond_wait(&dequeued, &lock);
+
+  if(options.reply_batch > 1) {
+    /* the reply thread only needs to know about new and full groups. */
+    int n = queued;
+    wake = reply_coalesce(reply_url, event_id, body, len) || queued > n;
+  }
+  else {
+    struct Reply* reply = reply_new(reply_url, 1);
+    reply->ids[reply->nevents++] = event_id ? strdup(event_id) : 0;
+    buffer_append(&reply->body, body, len);
+    reply_queue(reply);
+  }
+
+  pthread_mutex_unlock(&lock);
+
+  if(wake)
+    curl_multi_wakeup(multi);
+}
+
+void replies_drain()
+{
+  if(!multi)
+    return;
+
+  pthread_mutex_lock(&lock);
+  closing = 1;
+  pthread_mutex_unlock(&lock);
+
+  curl_multi_wakeup(multi);
+  pthread_join(thread, 0);
+
+  if(options.reply_spool)
+    spool_close();
+
+  if(failed || left || (options.verbosity && delivered))
+    fprintf(stderr, "replies: %lu delivered, %lu failed, %lu left in the spool\n", delivered, failed, left);
+
+  int i;
+  for(i = 0; i < nidle; ++i)
+    curl_easy_cleanup(idle[i]);
+
+  curl_multi_cleanup(multi);
+  curl_share_cleanup(share);
+  curl_slist_free_all(reply_headers);
+  curl_slist_free_all(batch_headers);
+  multi = 0;
+
+  curl_global_cleanup();
+}
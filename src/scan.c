@@ -0,0 +1,175 @@
+/*
+ * This file is part of the sse package, copyright (c) 2011, 2012, @radiospiel.
+ * It is copyrighted under the terms of the modified BSD license, see LICENSE.BSD.
+ *
+ * For more information see https://https://github.com/radiospiel/sse.
+ */
+
+/*
+ * Line scanner for the SSE parser.
+ *
+ * sse_scan_line finds the end of a line and the first colon in it. On
+ * x86 this looks at 16 (SSE2) or 32 (AVX2) bytes at a time; which
+ * implementation is used is decided once at runtime via cpuid. Other
+ * platforms get a portable fallback.
+ */
+
+#include "sse.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+typedef const char* (*scan_line_fn)(const char* p, const char* end, const char** pcolon);
+
+/* === portable fallback =========================================== */
+
+static const char* scan_line_scalar(const char* p, const char* end, const char** pcolon)
+{
+  const char* eol = memchr(p, '\n', end - p);
+  if(eol)
+    *pcolon = memchr(p, ':', eol - p);
+
+  return eol;
+}
+
+#ifdef SCAN_X86
+
+/*
+ * scan the last few bytes that don't fill a complete vector.
+ */
+static const char* scan_line_rest(const char* p, const char* end, const char* colon, const char** pcolon)
+{
+  for(; p < end; ++p) {
+    if(*p == '\n') {
+      *pcolon = colon;
+      return p;
+    }
+    if(*p == ':' && !colon)
+      colon = p;
+  }
+
+  return NULL;
+}
+
+/* === SSE2 ======================================================== */
+
+__attribute__((target("sse2")))
+static const char* scan_line_sse2(const char* p, const char* end, const char** pcolon)
+{
+  const __m128i nl = _mm_set1_epi8('\n');
+  const __m128i co = _mm_set1_epi8(':');
+  const char* colon = NULL;
+
+  for(; end - p >= 16; p += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)p);
+    unsigned nl_mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+
+    if(!colon) {
+      unsigned co_mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, co));
+      if(nl_mask)
+        co_mask &= (nl_mask & -nl_mask) - 1;   /* colons before the newline only */
+      if(co_mask)
+        colon = p + __builtin_ctz(co_mask);
+    }
+
+    if(nl_mask) {
+      *pcolon = colon;
+      return p + __builtin_ctz(nl_mask);
+    }
+  }
+
+  return scan_line_rest(p, end, colon, pcolon);
+}
+
+/* === AVX2 ======================================================== */
+
+__attribute__((target("avx2")))
+static const char* scan_line_avx2(const char* p, const char* end, const char** pcolon)
+{
+  const __m256i nl = _mm256_set1_epi8('\n');
+  const __m256i co = _mm256_set1_epi8(':');
+  const char* colon = NULL;
+
+  for(; end - p >= 32; p += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)p);
+    unsigned nl_mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+
+    if(!colon) {
+      unsigned co_mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, co));
+      if(nl_mask)
+        co_mask &= (nl_mask & -nl_mask) - 1;   /* colons before the newline only */
+      if(co_mask)
+        colon = p + __builtin_ctz(co_mask);
+    }
+
+    if(nl_mask) {
+      *pcolon = colon;
+      return p + __builtin_ctz(nl_mask);
+    }
+  }
+
+  return scan_line_rest(p, end, colon, pcolon);
+}
+
+#endif
+
+/* === dispatch ==================================================== */
+
+static const char* scan_line_resolve(const char* p, const char* end, const char** pcolon);
+
+static scan_line_fn scan_line = scan_line_resolve;
+
+/*
+ * pick the best implementation on the first call. Stream threads may
+ * race to do that; they all pick the same.
+ */
+static const char* scan_line_resolve(const char* p, const char* end, const char** pcolon)
+{
+  scan_line_fn fn = scan_line_scalar;
+
+#ifdef SCAN_X86
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2"))
+    fn = scan_line_avx2;
+  else if(__builtin_cpu_supports("sse2"))
+    fn = scan_line_sse2;
+#endif
+
+  __atomic_store_n(&scan_line, fn, __ATOMIC_RELAXED);
+  return fn(p, end, pcolon);
+}
+
+int sse_scan_select(const char* name)
+{
+  scan_line_fn fn = 0;
+
+  if(!strcmp(name, "scalar"))
+    fn = scan_line_scalar;
+
+#ifdef SCAN_X86
+  __builtin_cpu_init();
+  if(!strcmp(name, "avx2") && __builtin_cpu_supports("avx2"))
+    fn = scan_line_avx2;
+  else if(!strcmp(name, "sse2") && __builtin_cpu_supports("sse2"))
+    fn = scan_line_sse2;
+#endif
+
+  if(!fn)
+    return -1;
+
+  __atomic_store_n(&scan_line, fn, __ATOMIC_RELAXED);
+  return 0;
+}
+
+/*
+ * find the end of the line starting at \a p. Returns a pointer to the
+ * terminating newline, or NULL if there is no newline before \a end.
+ * If a newline is found, \a *pcolon is set to the first colon in the
+ * line, or to NULL if there is none.
+ */
+const char* sse_scan_line(const char* p, const char* end, const char** pcolon)
+{
+  return __atomic_load_n(&scan_line, __ATOMIC_RELAXED)(p, end, pcolon);
+}
@@ -0,0 +1,415 @@
+/*
+ * This file is part of the sse package, copyright (c) 2011, 2012, @radiospiel.
+ * It is copyrighted under the terms of the modified BSD license, see LICENSE.BSD.
+ *
+ * For more information see https://https://github.com/radiospiel/sse.
+ */
+
+/*
+ * Fan-out to local clients (--serve <socket-path>).
+ *
+ * sse listens on a Unix socket, and writes each event's output to all
+ * connected clients, in the selected output format. A client may send
+ * a line "events <type>,<type>..." to receive only events of these
+ * types; an event without a type has the type "message".
+ *
+ * Output is written to a client with a non-blocking send right away.
+ * What does not go out is queued, and a server thread writes it once
+ * the client is ready. A client's queue is bounded; events that do not
+ * fit are dropped for that client.
+ */
+
+#include <pthread.h>
+#include <poll.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "sse.h"
+
+#define SERVE_MAX_FILTER 512
+
+struct Client {
+  int           fd;
+  struct Buffer queue;            // output not yet sent
+  size_t        sent;             // bytes of queue already sent
+  unsigned long dropped;          // events dropped for this client
+  char          filter[SERVE_MAX_FILTER]; // ",type,type,", or empty for all events
+  char          line[SERVE_MAX_FILTER];   // incoming command line
+  size_t        line_len;
+  struct Client* next;
+};
+
+static struct Client* clients = 0;
+static struct Buffer preamble;
+static int listen_fd = -1;
+static int wake_fds[2];           // wakes up the server thread
+static int closing = 0;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  drained = PTHREAD_COND_INITIALIZER;
+
+static void wake_server()
+{
+  char ch = 0;
+  if(write(wake_fds[1], &ch, 1) < 0 && errno != EAGAIN)
+    die("write");
+}
+
+static size_t queued(const struct Client* client)
+{
+  return client->queue.len - client->sent;
+}
+
+/*
+ * send as much of \a len bytes from \a data to \a client as possible
+ * without blocking. Returns the number of bytes sent, or -1 if the
+ * client is gone.
+ */
+static ssize_t send_some(struct Client* client, const char* data, size_t len)
+{
+  ssize_t sent = send(client->fd, data, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+  if(sent >= 0)
+    return sent;
+
+  return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+}
+
+/*
+ * queue \a len bytes for \a client, after trying to send them right
+ * away. Must be called with the lock held.
+ */
+static int client_write(struct Client* client, const char* data, size_t len)
+{
+  ssize_t sent = 0;
+
+  if(!queued(client)) {
+    sent = send_some(client, data, len);
+    if(sent < 0)
+      return -1;
+
+    data += sent, len -= sent;
+    if(!len)
+      return 0;
+  }
+
+  /* once part of an event is sent, the rest must follow. */
+  if(!sent && queued(client) + len > options.serve_queue) {
+    if(!client->dropped++ || options.verbosity)
+      fprintf(stderr, "serve: client %d is too slow, dropping events\n", client->fd);
+    return 0;
+  }
+
+  /* compact the queue when most of it is sent */
+  if(client->sent > client->queue.size / 2) {
+    memmove(client->queue.data, client->queue.data + client->sent, queued(client));
+    client->queue.len -= client->sent;
+    client->sent = 0;
+  }
+
+  int was_empty = !queued(client);
+  buffer_append(&client->queue, data, len);
+  if(was_empty)
+    wake_server();
+
+  return 0;
+}
+
+/*
+ * does \a client want events of type \a type?
+ */
+static int client_wants(const struct Client* client, const char* type)
+{
+  if(!*client->filter)
+    return 1;
+
+  if(!type || !*type)
+    type = "message";
+
+  size_t len = strlen(type);
+  const char* p = client->filter;
+  while((p = strstr(p, type)) != 0) {
+    if(p[-1] == ',' && p[len] == ',')
+      return 1;
+    p += len;
+  }
+
+  return 0;
+}
+
+/*
+ * handle a command line from \a client.
+ */
+static void client_command(struct Client* client, const char* line)
+{
+  const char* types = strseq(line, "events ");
+  if(!types) {
+    fprintf(stderr, "serve: invalid command from client %d: %s\n", client->fd, line);
+    return;
+  }
+
+  if(strlen(types) + 3 > sizeof(client->filter)) {
+    fprintf(stderr, "serve: event filter too long\n");
+    return;
+  }
+
+  /* ",type,type," */
+  char* d = client->filter;
+  *d++ = ',';
+  for(; *types; ++types) {
+    if(*types != ' ')
+      *d++ = *types;
+  }
+  *d++ = ',';
+  *d = 0;
+
+  if(!strcmp(client->filter, ",*,") || !strcmp(client->filter, ",,"))
+    *client->filter = 0;
+}
+
+/*
+ * read commands from \a client. Returns -1 if the client is gone.
+ */
+static int client_read(struct Client* client)
+{
+  char buf[1024];
+  ssize_t n = recv(client->fd, buf, sizeof(buf), MSG_DONTWAIT);
+  if(n == 0)
+    return -1;
+  if(n < 0)
+    return errno == EAGAIN || errno == EINTR ? 0 : -1;
+
+  ssize_t i;
+  for(i = 0; i < n; ++i) {
+    if(buf[i] == '\n') {
+      client->line[client->line_len] = 0;
+      if(client->line_len && client->line[client->line_len - 1] == '\r')
+        client->line[client->line_len - 1] = 0;
+
+      client_command(client, client->line);
+      client->line_len = 0;
+    }
+    else if(client->line_len < sizeof(client->line) - 1) {
+      client->line[client->line_len++] = buf[i];
+    }
+  }
+
+  return 0;
+}
+
+static void client_free(struct Client* client)
+{
+  if(options.verbosity)
+    fprintf(stderr, "serve: client %d disconnected\n", client->fd);
+
+  close(client->fd);
+  free(client->queue.data);
+  free(client);
+}
+
+static void client_accept()
+{
+  int fd = accept(listen_fd, 0, 0);
+  if(fd < 0)
+    return;
+
+  struct Client* client = calloc(1, sizeof(*client));
+  if(!client)
+    die("calloc");
+  client->fd = fd;
+
+  if(options.verbosity)
+    fprintf(stderr, "serve: client %d connected\n", fd);
+
+  pthread_mutex_lock(&lock);
+
+  client->next = clients;
+  clients = client;
+
+  if(preamble.len && client_write(client, preamble.data, preamble.len) < 0) {
+    clients = client->next;
+    client_free(client);
+  }
+
+  pthread_mutex_unlock(&lock);
+}
+
+/*
+ * the server thread accepts clients, reads their commands, and writes
+ * queued output.
+ */
+static void* serve_thread(void* arg)
+{
+  struct pollfd* fds = 0;
+  size_t fds_size = 0;
+
+  while(1) {
+    pthread_mutex_lock(&lock);
+
+    size_t nclients = 0, n = 2;
+    struct Client* client;
+    for(client = clients; client; client = client->next)
+      nclients++;
+
+    if(2 + nclients > fds_size) {
+      fds_size = 2 * (2 + nclients);
+      fds = realloc(fds, fds_size * sizeof(*fds));
+      if(!fds)
+        die("realloc");
+    }
+
+    fds[0].fd = listen_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = wake_fds[0];
+    fds[1].events = POLLIN;
+
+    for(client = clients; client; client = client->next, ++n) {
+      fds[n].fd = client->fd;
+      fds[n].events = POLLIN | (queued(client) ? POLLOUT : 0);
+    }
+
+    pthread_mutex_unlock(&lock);
+
+    if(poll(fds, n, -1) < 0) {
+      if(errno == EINTR)
+        continue;
+      die("poll");
+    }
+
+    if(fds[1].revents & POLLIN) {
+      char buf[256];
+      while(read(wake_fds[0], buf, sizeof(buf)) > 0)
+        ;
+    }
+
+    if(fds[0].revents & POLLIN)
+      client_accept();
+
+    /*
+     * Clients may have come and gone since fds was set up; so they are
+     * looked up by their fd.
+     */
+    pthread_mutex_lock(&lock);
+
+    size_t i;
+    for(i = 2; i < n; ++i) {
+      if(!fds[i].revents)
+        continue;
+
+      struct Client** pclient = &clients;
+      while(*pclient && (*pclient)->fd != fds[i].fd)
+        pclient = &(*pclient)->next;
+
+      if(!(client = *pclient))
+        continue;
+
+      int gone = 0;
+
+      if(fds[i].revents & (POLLIN | POLLHUP | POLLERR))
+        gone = client_read(client) < 0;
+
+      if(!gone && queued(client) && (fds[i].revents & POLLOUT)) {
+        ssize_t sent = send_some(client, client->queue.data + client->sent, queued(client));
+        if(sent < 0)
+          gone = 1;
+        else if((client->sent += sent) == client->queue.len)
+          client->sent = client->queue.len = 0;
+      }
+
+      if(gone) {
+        *pclient = client->next;
+        client_free(client);
+      }
+    }
+
+    if(closing)
+      pthread_cond_broadcast(&drained);
+
+    pthread_mutex_unlock(&lock);
+  }
+
+  return 0;
+}
+
+void serve_init(const char* path)
+{
+  struct sockaddr_un addr;
+
+  if(strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "--serve: socket path too long\n");
+    exit(1);
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(listen_fd < 0)
+    die("socket");
+
+  unlink(path);
+  if(bind(listen_fd, (struct sockaddr*) &addr, sizeof(addr)) < 0)
+    die(path);
+  if(listen(listen_fd, 64) < 0)
+    die("listen");
+
+  if(pipe(wake_fds) < 0)
+    die("pipe");
+  fcntl(wake_fds[0], F_SETFL, O_NONBLOCK);
+  fcntl(wake_fds[1], F_SETFL, O_NONBLOCK);
+
+  pthread_t thread;
+  if(pthread_create(&thread, 0, serve_thread, 0))
+    die("pthread_create");
+  pthread_detach(thread);
+}
+
+void serve_preamble(const char* data, size_t len)
+{
+  pthread_mutex_lock(&lock);
+  buffer_append(&preamble, data, len);
+  pthread_mutex_unlock(&lock);
+}
+
+void serve_write(const char* type, const char* data, size_t len)
+{
+  pthread_mutex_lock(&lock);
+
+  struct Client** pclient = &clients;
+  while(*pclient) {
+    struct Client* client = *pclient;
+
+    if(client_wants(client, type) && client_write(client, data, len) < 0) {
+      *pclient = client->next;
+      client_free(client);
+      continue;
+    }
+
+    pclient = &client->next;
+  }
+
+  pthread_mutex_unlock(&lock);
+}
+
+void serve_close()
+{
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += 1;
+
+  pthread_mutex_lock(&lock);
+  closing = 1;
+
+  /* give clients a second to take what is queued for them. */
+  while(1) {
+    struct Client* client = clients;
+    while(client && !queued(client))
+      client = client->next;
+
+    if(!client || pthread_cond_timedwait(&drained, &lock, &deadline) == ETIMEDOUT)
+      break;
+  }
+
+  pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,162 @@
+/*
+ * This file is part of the sse package, copyright (c) 2011, 2012, @radiospiel.
+ * It is copyrighted under the terms of the modified BSD license, see LICENSE.BSD.
+ *
+ * For more information see https://https://github.com/radiospiel/sse.
+ */
+
+/*
+ * The reading side of the shared-memory ring; see shm-ring.h. Like
+ * sse-reader.c, this is built into bin/libsse-reader.a.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "shm-ring.h"
+
+#define ALIGN16(n) (((n) + 15) & ~(uint64_t) 15)
+
+int sse_shm_reader_open(struct SSEShmReader* reader, const char* name)
+{
+  memset(reader, 0, sizeof(*reader));
+
+  int fd = shm_open(name, O_RDWR, 0);
+  if(fd < 0)
+    return -1;
+
+  struct stat st;
+  if(fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(struct SSEShmHeader)) {
+    close(fd);
+    errno = EINVAL;
+    return -1;
+  }
+
+  struct SSEShmHeader* ring = mmap(0, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(ring == MAP_FAILED)
+    return -1;
+
+  if(memcmp(ring->magic, SSE_SHM_MAGIC, 4) || ring->version != SSE_SHM_VERSION ||
+     ring->data_offset + ring->capacity > (uint64_t) st.st_size) {
+    munmap(ring, st.st_size);
+    errno = EINVAL;
+    return -1;
+  }
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+  reader->ring = ring;
+  reader->map_size = st.st_size;
+  reader->data = (const char*) ring + ring->data_offset;
+
+  /* claim a slot */
+  uint32_t pid = getpid();
+  int i;
+  for(i = 0; i < SSE_SHM_MAX_READERS; ++i) {
+    uint32_t free_pid = 0;
+    if(__atomic_compare_exchange_n(&ring->readers[i].pid, &free_pid, pid, 0,
+                                   __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+      break;
+  }
+
+  if(i == SSE_SHM_MAX_READERS) {
+    munmap(ring, st.st_size);
+    memset(reader, 0, sizeof(*reader));
+    errno = EBUSY;
+    return -1;
+  }
+
+  /* until the cursor is set the writer does not wait for this slot. */
+  reader->slot = ring->readers + i;
+  reader->cursor = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  reader->next_seq = __atomic_load_n(&ring->seq, __ATOMIC_RELAXED);
+  reader->slot->lost = 0;
+  __atomic_store_n(&reader->slot->cursor, reader->cursor, __ATOMIC_RELEASE);
+
+  return 0;
+}
+
+void sse_shm_reader_close(struct SSEShmReader* reader)
+{
+  if(!reader->ring)
+    return;
+
+  __atomic_store_n(&reader->slot->cursor, SSE_SHM_NO_CURSOR, __ATOMIC_RELAXED);
+  __atomic_store_n(&reader->slot->pid, 0, __ATOMIC_RELEASE);
+  munmap(reader->ring, reader->map_size);
+  memset(reader, 0, sizeof(*reader));
+}
+
+size_t sse_shm_reader_next(struct SSEShmReader* reader, char* buf, size_t size)
+{
+  struct SSEShmHeader* ring = reader->ring;
+  uint64_t capacity = ring->capacity;
+
+  while(1) {
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    if(reader->cursor == head)
+      return 0;
+
+    /* overwritten: continue at the oldest record. */
+    uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if(reader->cursor < tail)
+      reader->cursor = tail;
+
+    uint64_t offset = reader->cursor & (capacity - 1);
+    struct SSEShmRecord record;
+    memcpy(&record, reader->data + offset, sizeof(record));
+
+    /*
+     * The record may be overwritten while we read it. A record that looks
+     * broken, or that turns out to be before tail afterwards, is discarded.
+     */
+    size_t len = 0;
+    if(record.len <= capacity - offset - sizeof(record) && !(record.flags & SSE_SHM_RECORD_PAD)) {
+      len = record.len;
+      memcpy(buf, reader->data + offset + sizeof(record), len < size ? len : size);
+    }
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if(reader->cursor < __atomic_load_n(&ring->tail, __ATOMIC_RELAXED))
+      continue;
+
+    /* cannot happen with an intact ring */
+    if(record.len > capacity - offset - sizeof(record)) {
+      reader->cursor = head;
+      continue;
+    }
+
+    reader->cursor += sizeof(record) + ALIGN16(record.len);
+    __atomic_store_n(&reader->slot->cursor, reader->cursor, __ATOMIC_RELEASE);
+
+    if(record.flags & SSE_SHM_RECORD_PAD)
+      continue;
+
+    if(record.seq > reader->next_seq)
+      reader->slot->lost += record.seq - reader->next_seq;
+    reader->next_seq = record.seq + 1;
+
+    return len;
+  }
+}
+
+int sse_shm_reader_eof(struct SSEShmReader* reader)
+{
+  struct SSEShmHeader* ring = reader->ring;
+
+  if(!__atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE))
+    return 0;
+  if(reader->cursor != __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE))
+    return 0;
+
+  /* events dropped after the last one published are lost, too. */
+  if(ring->seq > reader->next_seq) {
+    reader->slot->lost += ring->seq - reader->next_seq;
+    reader->next_seq = ring->seq;
+  }
+
+  return 1;
+}
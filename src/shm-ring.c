@@ -0,0 +1,205 @@
+/*
+ * This file is part of the sse package, copyright (c) 2011, 2012, @radiospiel.
+ * It is copyrighted under the terms of the modified BSD license, see LICENSE.BSD.
+ *
+ * For more information see https://https://github.com/radiospiel/sse.
+ */
+
+/*
+ * The writing side of the shared-memory ring; see shm-ring.h.
+ */
+
+#include <fcntl.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "sse.h"
+#include "shm-ring.h"
+
+#define ALIGN16(n) (((n) + 15) & ~(uint64_t) 15)
+
+static struct SSEShmHeader* ring = 0;
+static char* ring_data;
+
+void shm_ring_create(const char* name, size_t capacity, int policy)
+{
+  size_t size = 4096;
+  while(size < capacity)
+    size *= 2;
+  capacity = size;
+
+  size_t data_offset = (sizeof(struct SSEShmHeader) + 4095) & ~(size_t) 4095;
+
+  shm_unlink(name);
+  int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+  if(fd < 0)
+    die(name);
+
+  if(ftruncate(fd, data_offset + capacity) < 0)
+    die("ftruncate");
+
+  ring = mmap(0, data_offset + capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if(ring == MAP_FAILED)
+    die("mmap");
+  close(fd);
+
+  ring_data = (char*) ring + data_offset;
+
+  int i;
+  for(i = 0; i < SSE_SHM_MAX_READERS; ++i)
+    ring->readers[i].cursor = SSE_SHM_NO_CURSOR;
+
+  ring->version = SSE_SHM_VERSION;
+  ring->policy = policy;
+  ring->capacity = capacity;
+  ring->data_offset = data_offset;
+
+  /* readers check the magic to see whether the ring is ready. */
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy(ring->magic, SSE_SHM_MAGIC, 4);
+}
+
+void shm_ring_preamble(const char* data, size_t len)
+{
+  if(len > SSE_SHM_PREAMBLE) {
+    fprintf(stderr, "--shm: output header exceeds %d byte\n", SSE_SHM_PREAMBLE);
+    exit(1);
+  }
+
+  memcpy(ring->preamble, data, len);
+  __atomic_store_n(&ring->preamble_len, len, __ATOMIC_RELEASE);
+}
+
+/*
+ * returns the position of the slowest reader, or head if there are no
+ * readers. Slots of readers that died without detaching are freed.
+ */
+static uint64_t slowest_reader(uint64_t head, int check_pids)
+{
+  uint64_t slowest = head;
+  int i;
+
+  for(i = 0; i < SSE_SHM_MAX_READERS; ++i) {
+    struct SSEShmReaderSlot* slot = ring->readers + i;
+    uint32_t pid = __atomic_load_n(&slot->pid, __ATOMIC_ACQUIRE);
+    if(!pid)
+      continue;
+
+    if(check_pids && kill(pid, 0) < 0 && errno == ESRCH) {
+      __atomic_store_n(&slot->cursor, SSE_SHM_NO_CURSOR, __ATOMIC_RELAXED);
+      __atomic_compare_exchange_n(&slot->pid, &pid, 0, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+      continue;
+    }
+
+    uint64_t cursor = __atomic_load_n(&slot->cursor, __ATOMIC_ACQUIRE);
+    if(cursor < slowest)
+      slowest = cursor;
+  }
+
+  return slowest;
+}
+
+/*
+ * wait until all readers are past position \a pos. Returns 0, or -1 if
+ * the event is to be dropped.
+ *
+ * A reader that died without detaching holds up the ring until its slot
+ * is freed; when dropping, the readers' pids are checked at most once a
+ * second.
+ */
+static int make_room(uint64_t pos)
+{
+  static time_t pids_checked;
+
+  uint64_t head = ring->head;
+  if(slowest_reader(head, 0) >= pos)
+    return 0;
+
+  if(ring->policy == SSE_SHM_DROP) {
+    time_t now = time(0);
+    if(now == pids_checked)
+      return -1;
+
+    pids_checked = now;
+    return slowest_reader(head, 1) >= pos ? 0 : -1;
+  }
+
+  while(slowest_reader(head, 1) < pos)
+    usleep(100);
+
+  return 0;
+}
+
+/*
+ * advance tail, record by record, past position \a pos. Readers still
+ * reading a record before tail see that it changed, and discard what
+ * they read.
+ */
+static void advance_tail(uint64_t pos)
+{
+  uint64_t tail = ring->tail;
+
+  while(tail < pos) {
+    const struct SSEShmRecord* record = (const void*) (ring_data + (tail & (ring->capacity - 1)));
+    tail += sizeof(*record) + ALIGN16(record->len);
+  }
+
+  __atomic_store_n(&ring->tail, tail, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/*
+ * write a record at head; it must fit before the end of the ring.
+ */
+static void put_record(uint32_t flags, uint64_t seq, const char* data, size_t len)
+{
+  uint64_t head = ring->head;
+  struct SSEShmRecord* record = (void*) (ring_data + (head & (ring->capacity - 1)));
+
+  record->len = len;
+  record->flags = flags;
+  record->seq = seq;
+  if(data)
+    memcpy(record + 1, data, len);
+
+  __atomic_store_n(&ring->head, head + sizeof(*record) + ALIGN16(len), __ATOMIC_RELEASE);
+}
+
+void shm_ring_publish(const char* data, size_t len)
+{
+  uint64_t capacity = ring->capacity;
+  uint64_t seq = ring->seq;
+  uint64_t size = sizeof(struct SSEShmRecord) + ALIGN16(len);
+
+  __atomic_store_n(&ring->seq, seq + 1, __ATOMIC_RELAXED);
+
+  if(size > capacity / 2) {
+    fprintf(stderr, "--shm: event of %lu byte does not fit into the ring, dropping it\n", (unsigned long) len);
+    return;
+  }
+
+  /* a record does not wrap around; pad up to the end of the ring. */
+  uint64_t head = ring->head;
+  uint64_t to_end = capacity - (head & (capacity - 1));
+  uint64_t pad = to_end < size ? to_end : 0;
+  uint64_t end = head + pad + size;
+
+  if(ring->policy == SSE_SHM_OVERWRITE) {
+    if(end > capacity)
+      advance_tail(end - capacity);
+  }
+  else if(end > capacity && make_room(end - capacity) < 0) {
+    return;
+  }
+
+  if(pad)
+    put_record(SSE_SHM_RECORD_PAD, seq, 0, pad - sizeof(struct SSEShmRecord));
+
+  put_record(0, seq, data, len);
+}
+
+void shm_ring_close()
+{
+  __atomic_store_n(&ring->closed, 1, __ATOMIC_RELEASE);
+}
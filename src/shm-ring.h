@@ -0,0 +1,173 @@
+/*
+ * This file is part of the sse package, copyright (c) 2011, 2012, @radiospiel.
+ * It is copyrighted under the terms of the modified BSD license, see LICENSE.BSD.
+ *
+ * For more information see https://https://github.com/radiospiel/sse.
+ */
+
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * A shared-memory ring (--shm <name>).
+ *
+ * sse publishes each event's output as one record into a ring in a POSIX
+ * shared memory object, /dev/shm/<name>. Any number of local processes
+ * read it, each with its own cursor; neither side makes a system call
+ * per event.
+ *
+ * Positions in the ring count bytes since the ring was created, and only
+ * grow; the byte at position p lives at data[p % capacity]. The writer
+ * publishes a record by advancing head. Records start with a struct
+ * SSEShmRecord and are 16-byte aligned; a record never wraps around the
+ * end of the ring - the rest of the ring is filled with a padding record
+ * instead.
+ *
+ * What happens when a reader falls behind depends on the policy:
+ *
+ * - SSE_SHM_BLOCK: the writer waits until the slowest reader made room.
+ * - SSE_SHM_DROP: the writer drops the event.
+ * - SSE_SHM_OVERWRITE: the writer overwrites the oldest records, and
+ *   advances tail past them. A reader that finds itself behind tail
+ *   continues at tail.
+ *
+ * Every event gets a sequence number, dropped or not; readers count the
+ * gaps as lost events.
+ *
+ * A reader claims a free slot by setting its pid, and then sets its
+ * cursor; a slot is freed with its cursor reset to SSE_SHM_NO_CURSOR, so
+ * the writer never waits for the cursor of a previous reader. The writer
+ * frees the slots of readers that died without detaching.
+ */
+
+#define SSE_SHM_MAGIC       "SSEQ"
+#define SSE_SHM_VERSION     1
+#define SSE_SHM_MAX_READERS 64
+#define SSE_SHM_PREAMBLE    16384
+#define SSE_SHM_NO_CURSOR   UINT64_MAX
+
+enum {
+  SSE_SHM_BLOCK = 0,
+  SSE_SHM_DROP,
+  SSE_SHM_OVERWRITE
+};
+
+struct SSEShmReaderSlot {
+  uint32_t  pid;                  // the reader's pid, 0 if the slot is free
+  uint32_t  reserved;
+  uint64_t  cursor;               // position of the next record to read;
+                                  // SSE_SHM_NO_CURSOR until the reader set it
+  uint64_t  lost;                 // events this reader missed
+  char      pad[40];
+};
+
+#define SSE_SHM_RECORD_PAD  1     // padding up to the end of the ring
+
+struct SSEShmRecord {
+  uint32_t  len;                  // length of the event output
+  uint32_t  flags;                // SSE_SHM_RECORD_*
+  uint64_t  seq;                  // sequence number of the event
+};
+
+struct SSEShmHeader {
+  char      magic[4];             // SSE_SHM_MAGIC
+  uint32_t  version;              // SSE_SHM_VERSION
+  uint32_t  policy;               // SSE_SHM_*
+  uint32_t  closed;               // set once the writer is done
+  uint64_t  capacity;             // size of the data area, a power of 2
+  uint64_t  data_offset;          // offset of the data area in the mapping
+  uint32_t  preamble_len;         // length of preamble
+  char      pad0[28];
+
+  uint64_t  head;                 // end of the last published record
+  uint64_t  tail;                 // start of the oldest record
+  uint64_t  seq;                  // sequence number of the next event
+  char      pad1[40];
+
+  struct SSEShmReaderSlot readers[SSE_SHM_MAX_READERS];
+
+  /*
+   * output that goes before all events, like the header of the binary
+   * format. Readers that attach later find it here.
+   */
+  char      preamble[SSE_SHM_PREAMBLE];
+};
+
+/* === reading ===================================================== */
+
+struct SSEShmReader {
+  struct SSEShmHeader* ring;
+  size_t    map_size;
+  const char* data;
+  struct SSEShmReaderSlot* slot;
+  uint64_t  cursor;
+  uint64_t  next_seq;             // expected sequence number
+};
+
+/*
+ * attach \a reader to the ring \a name. The reader starts with the next
+ * event published. Returns 0, or -1 with errno set; EBUSY means all
+ * reader slots are taken.
+ */
+extern int sse_shm_reader_open(struct SSEShmReader* reader, const char* name);
+
+/*
+ * detach \a reader from its ring.
+ */
+extern void sse_shm_reader_close(struct SSEShmReader* reader);
+
+/*
+ * copy the next event's output into \a buf, which has room for \a size
+ * bytes. Returns the length of the output, which is larger than \a size
+ * if it was truncated; or 0 if no event is available yet. This does not
+ * wait; poll again later.
+ */
+extern size_t sse_shm_reader_next(struct SSEShmReader* reader, char* buf, size_t size);
+
+/*
+ * returns the number of events this reader has missed.
+ */
+static inline uint64_t sse_shm_reader_lost(const struct SSEShmReader* reader) {
+  return reader->slot->lost;
+}
+
+/*
+ * returns the ring's preamble, and sets \a *len to its length.
+ */
+static inline const char* sse_shm_reader_preamble(const struct SSEShmReader* reader, size_t* len) {
+  *len = reader->ring->preamble_len;
+  return reader->ring->preamble;
+}
+
+/*
+ * returns true once the writer has finished and all events are read.
+ */
+extern int sse_shm_reader_eof(struct SSEShmReader* reader);
+
+/* === writing ===================================================== */
+
+/*
+ * create the ring \a name with a data area of at least \a capacity bytes.
+ */
+extern void shm_ring_create(const char* name, size_t capacity, int policy);
+
+/*
+ * set the ring's preamble.
+ */
+extern void shm_ring_preamble(const char* data, size_t len);
+
+/*
+ * publish one event's output.
+ */
+extern void shm_ring_publish(const char* data, size_t len);
+
+/*
+ * mark the ring as closed.
+ */
+extern void shm_ring_close();
+
+#endif
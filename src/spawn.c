@@ -0,0 +1,697 @@
+/*
+ * This file is part of the sse package, copyright (c) 2011, 2012, @radiospiel.
+ * It is copyrighted under the terms of the modified BSD license, see LICENSE.BSD.
+ *
+ * For more information see https://https://github.com/radiospiel/sse.
+ */
+
+/*
+ * Running the <command> once per event.
+ *
+ * Each event starts a child via posix_spawnp, which does not copy the
+ * parent's page tables (glibc uses vfork semantics), so it stays cheap
+ * however much memory sse holds. The event's attributes are passed in
+ * the environment as SSE_<NAME>=value; the environment block is put
+ * together directly from the event's headers. The data is written to
+ * the child's stdin, and its stdout is collected as the result.
+ *
+ * Up to -J <n> children run at the same time. Their stdin, stdout, and
+ * exit (via a pidfd, where available) are all watched with poll(2) by
+ * the spawn thread, so one slow child does not hold up the others, nor
+ * the stream - until all slots are taken; and a child's result is
+ * passed on as soon as it is done, also while the stream is idle. With
+ * --ordered, events with the same id are run one after the other.
+ *
+ * With --batch <n> a child gets up to <n> events at once. They are
+ * written to its stdin as frames, in the format used for -w workers;
+ * SSE_BATCH_SIZE tells how many. The child answers with one result per
+ * event, again as for -w workers: a length line followed by the result.
+ * A batch is started once it is full, or - by the spawn thread -
+ * --batch-wait msecs after its first event came in.
+ *
+ * A child's input is a copy of the event (or the batch) that belongs to
+ * the child until it is done. So larger inputs are spliced into its
+ * stdin instead of being copied once more; see pipe_write(). The pipe is
+ * enlarged for such inputs, up to PIPE_SIZE_MAX; what does not fit is
+ * written by the spawn thread as the child reads it. A spliced pipe
+ * refers to the input's pages until they are read, also after the child
+ * exited; so sse keeps a read end of it, and reads out what is left
+ * before the input is freed. The child's output
+ * is read into one of a pool of buffers, which is reused for the next
+ * child.
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE             /* F_SETPIPE_SZ */
+#endif
+
+#include <spawn.h>
+#include <poll.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include "sse.h"
+
+extern char** environ;
+
+struct ChildEvent {
+  char*         id;
+  char*         type;
+  char*         reply_url;
+};
+
+struct Child {
+  pid_t         pid;
+  int           pidfd;          // -1 if pidfds are not available
+  int           in;             // the child's stdin, -1 once closed
+  int           out;            // the child's stdout, -1 once closed
+  int           unread;         // our read end of a spliced stdin, or -1
+  int           exited;
+  int           status;
+
+  char*         data;           // what to write to stdin
+  size_t        data_len;
+  size_t        written;        // bytes of data written to stdin
+
+  struct Buffer result;         // what the child wrote to stdout
+  size_t        result_limit;
+
+  struct ChildEvent* events;    // the events handled by this child
+  int           nevents;
+  int           batched;        // set if events and results are framed
+};
+
+static struct Child* children = 0;
+static int nchildren = 0;
+
+/*
+ * the largest stdin pipe to ask for; the default limit for unprivileged
+ * processes (see /proc/sys/fs/pipe-max-size).
+ */
+#define PIPE_SIZE_MAX 1024 * 1024
+
+/*
+ * the pool of result buffers, one per -J slot.
+ */
+#define RESULT_CHUNK  64 * 1024
+
+static struct Buffer* results = 0;
+static int nresults = 0;
+
+/*
+ * the batch being collected.
+ */
+static struct Buffer batch;
+static struct ChildEvent* batch_events = 0;
+static int batch_len = 0;
+static struct timespec batch_since;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  child_freed = PTHREAD_COND_INITIALIZER;
+static int wake[2];             // a pipe to wake up the spawn thread
+
+static char* strdup_or_null(const char* s)
+{
+  return s ? strdup(s) : 0;
+}
+
+static int open_pidfd(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+  int fd = syscall(SYS_pidfd_open, pid, 0);
+  if(fd >= 0)
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+  return fd;
+#else
+  return -1;
+#endif
+}
+
+/*
+ * build the child's environment: ours, plus an SSE_<NAME>=value entry
+ * per "NAME=value" header. SSE_* entries of our own are left out, so a
+ * child does not see an attribute the event does not have.
+ */
+static char** child_environment(char** headers)
+{
+  static struct Buffer strings, pointers;
+  char** env;
+  size_t nenv = 0, nheaders = 0, i;
+
+  while(environ[nenv])
+    nenv++;
+  while(headers[nheaders])
+    nheaders++;
+
+  strings.len = 0;
+  for(i = 0; i < nheaders; ++i) {
+    buffer_append(&strings, "SSE_", 4);
+    buffer_append(&strings, headers[i], strlen(headers[i]) + 1);
+  }
+
+  pointers.len = 0;
+  env = (char**) buffer_reserve(&pointers, (nenv + nheaders + 1) * sizeof(char*));
+
+  nenv = 0;
+  for(i = 0; environ[i]; ++i) {
+    if(strncmp(environ[i], "SSE_", 4))
+      env[nenv++] = environ[i];
+  }
+
+  char* s = strings.data;
+  for(i = 0; i < nheaders; ++i) {
+    env[nenv + i] = s;
+    s += strlen(s) + 1;
+  }
+  env[nenv + nheaders] = 0;
+
+  return env;
+}
+
+static void child_close_in(struct Child* child)
+{
+  if(child->in >= 0) {
+    close(child->in);
+    child->in = -1;
+  }
+}
+
+/*
+ * write more data to the child's stdin.
+ */
+static void child_write(struct Child* child)
+{
+  while(child->written < child->data_len) {
+    ssize_t n = pipe_write(child->in, child->data + child->written, child->data_len - child->written);
+    if(n < 0) {
+      if(errno == EINTR)
+        continue;
+      if(errno != EAGAIN)
+        child_close_in(child);    /* the child does not read its input */
+      return;
+    }
+    child->written += n;
+  }
+
+  child_close_in(child);
+}
+
+/*
+ * read the child's stdout; keep at most result_limit bytes.
+ */
+static void child_read(struct Child* child)
+{
+  struct Buffer* result = &child->result;
+  char discard[8192];
+  char* p = discard;
+  size_t room = result->len < child->result_limit ? child->result_limit - result->len : 0;
+  size_t size = sizeof(discard);
+
+  if(room) {
+    size = room < RESULT_CHUNK ? room : RESULT_CHUNK;
+    p = buffer_reserve(result, size);
+  }
+
+  ssize_t n = read(child->out, p, size);
+
+  if(n < 0 && (errno == EINTR || errno == EAGAIN))
+    return;
+
+  if(n <= 0) {
+    close(child->out);
+    child->out = -1;
+    return;
+  }
+
+  if(room)
+    result->len += n;
+}
+
+static void child_reap(struct Child* child, int options)
+{
+  if(waitpid(child->pid, &child->status, options) == child->pid)
+    child->exited = 1;
+}
+
+/*
+ * pass on the result for \a event.
+ */
+static void event_result(const struct ChildEvent* event, const char* result, size_t len)
+{
+  if(event->reply_url)
+    send_reply(event->reply_url, event->id, result ? result : "", len);
+  else
+    output_write(event->type, result, len);
+}
+
+/*
+ * split the result of a batch into the results of its events.
+ */
+static void batch_results(struct Child* child)
+{
+  const char* p = child->result.data;
+  const char* end = p + child->result.len;
+  int i;
+
+  for(i = 0; i < child->nevents; ++i) {
+    char* nl;
+    unsigned long len = p < end ? strtoul(p, &nl, 10) : 0;
+
+    if(p >= end || nl == p || nl >= end || *nl != '\n' || len > (size_t) (end - nl - 1)) {
+      fprintf(stderr, "%s: invalid result for event %d of the batch\n", options.command[0], i);
+      return;
+    }
+
+    event_result(child->events + i, nl + 1, len);
+    p = nl + 1 + len;
+  }
+}
+
+/*
+ * free \a child, and its slot. What is left in a spliced stdin is read
+ * out first, so that the pipe no longer refers to the child's data; as
+ * its write end is closed by now, this does not block.
+ */
+static void child_free(struct Child* child)
+{
+  int i;
+
+  if(child->unread >= 0) {
+    char discard[8192];
+    ssize_t n;
+
+    while((n = read(child->unread, discard, sizeof(discard))) > 0 || (n < 0 && errno == EINTR))
+      ;
+    close(child->unread);
+  }
+
+  for(i = 0; i < child->nevents; ++i) {
+    free(child->events[i].id);
+    free(child->events[i].type);
+    free(child->events[i].reply_url);
+  }
+
+  free(child->events);
+  free(child->data);
+
+  child->result.len = 0;
+  results[nresults++] = child->result;
+
+  *child = children[--nchildren];
+}
+
+/*
+ * pass on the result of a finished child, and free it.
+ */
+static void child_done(struct Child* child)
+{
+  if(WIFEXITED(child->status) && WEXITSTATUS(child->status))
+    fprintf(stderr, "%s exited with status %d\n", options.command[0], WEXITSTATUS(child->status));
+  else if(WIFSIGNALED(child->status))
+    fprintf(stderr, "%s was killed by signal %d\n", options.command[0], WTERMSIG(child->status));
+
+  if(child->batched)
+    batch_results(child);
+  else
+    event_result(child->events, child->result.data, child->result.len);
+
+  child_close_in(child);
+  if(child->pidfd >= 0)
+    close(child->pidfd);
+
+  child_free(child);
+}
+
+/*
+ * wake up the spawn thread, to watch a new child or to reconsider the
+ * batch. Must be called with the lock held.
+ */
+static void spawn_wake()
+{
+  if(write(wake[1], "", 1) < 0 && errno != EAGAIN)
+    die("write");
+}
+
+/*
+ * wait up to \a timeout msecs for the children to make progress. Must be
+ * called with the lock held; it is released while waiting. Children
+ * started meanwhile are watched from the next call on.
+ */
+static void spawn_poll(int timeout)
+{
+  int npolled = nchildren;
+  struct pollfd fds[3 * npolled + 1];
+  int i, n = 0;
+
+  for(i = 0; i < npolled; ++i) {
+    struct Child* child = children + i;
+
+    if(child->in >= 0)
+      fds[n].fd = child->in, fds[n++].events = POLLOUT;
+    if(child->out >= 0)
+      fds[n].fd = child->out, fds[n++].events = POLLIN;
+    if(child->pidfd >= 0 && !child->exited)
+      fds[n].fd = child->pidfd, fds[n++].events = POLLIN;
+  }
+
+  fds[n].fd = wake[0], fds[n++].events = POLLIN;
+
+  for(i = 0; i < n; ++i)
+    fds[i].revents = 0;
+
+  pthread_mutex_unlock(&lock);
+  int rc = poll(fds, n, timeout);
+  pthread_mutex_lock(&lock);
+
+  if(rc < 0 && errno != EINTR)
+    die("poll");
+
+  if(fds[n - 1].revents) {
+    char buf[64];
+    while(read(wake[0], buf, sizeof(buf)) > 0)
+      ;
+  }
+
+  /*
+   * the fds are in the same order as the children; only this thread
+   * changes the children that were polled.
+   */
+  n = 0;
+  for(i = 0; i < npolled; ++i) {
+    struct Child* child = children + i;
+
+    if(child->in >= 0 && fds[n++].revents)
+      child_write(child);
+    if(child->out >= 0 && fds[n++].revents)
+      child_read(child);
+    if(child->pidfd >= 0 && !child->exited && fds[n++].revents)
+      child_reap(child, WNOHANG);
+  }
+
+  /*
+   * A child is done once it closed its stdout and exited. Without a
+   * pidfd we wait for it once its stdout is closed.
+   */
+  int freed = 0;
+
+  for(i = nchildren; i-- > 0; ) {
+    struct Child* child = children + i;
+
+    if(child->out >= 0)
+      continue;
+    if(!child->exited && child->pidfd < 0)
+      child_reap(child, 0);
+    if(child->exited) {
+      child_done(child);
+      freed = 1;
+    }
+  }
+
+  if(freed)
+    pthread_cond_broadcast(&child_freed);
+}
+
+/*
+ * is any of the \a n \a events still running?
+ */
+static int running(const struct ChildEvent* events, int n)
+{
+  int i, j, k;
+
+  for(i = 0; i < nchildren; ++i) {
+    const struct Child* child = children + i;
+
+    for(j = 0; j < child->nevents; ++j) {
+      if(!child->events[j].id)
+        continue;
+
+      for(k = 0; k < n; ++k) {
+        if(events[k].id && !strcmp(child->events[j].id, events[k].id))
+          return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+/*
+ * can a child for the \a n \a events be started right now?
+ */
+static int can_start(const struct ChildEvent* events, int n)
+{
+  if(nchildren == options.command_jobs)
+    return 0;
+
+  return !options.ordered || !running(events, n);
+}
+
+/*
+ * start a child for \a nevents \a events, and write \a data_len bytes
+ * from \a data to its stdin. The child takes over \a data and \a events.
+ * Waits for a free slot; must be called with the lock held.
+ */
+static void spawn_child(char** headers, char* data, size_t data_len,
+                        struct ChildEvent* events, int nevents, int batched)
+{
+  while(!can_start(events, nevents))
+    pthread_cond_wait(&child_freed, &lock);
+
+  int in[2], out[2];
+  if(pipe(in) < 0 || pipe(out) < 0)
+    die("pipe");
+
+  fcntl(in[1], F_SETFD, FD_CLOEXEC);
+  fcntl(out[0], F_SETFD, FD_CLOEXEC);
+  fcntl(in[1], F_SETFL, O_NONBLOCK);
+
+  /* keep a read end of a pipe that may be spliced into; see child_free(). */
+  int unread = -1;
+  if(data_len >= SPLICE_MIN) {
+    unread = fcntl(in[0], F_DUPFD_CLOEXEC, 0);
+    if(unread < 0)
+      die("fcntl");
+  }
+
+#ifdef F_SETPIPE_SZ
+  /* take a larger input in one go, if we may. */
+  if(data_len > SPLICE_MIN)
+    fcntl(in[1], F_SETPIPE_SZ, (int) (data_len < PIPE_SIZE_MAX ? data_len : PIPE_SIZE_MAX));
+#endif
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, in[0], 0);
+  posix_spawn_file_actions_adddup2(&actions, out[1], 1);
+  posix_spawn_file_actions_addclose(&actions, in[0]);
+  posix_spawn_file_actions_addclose(&actions, out[1]);
+
+  pid_t pid;
+  int rc = posix_spawnp(&pid, options.command[0], &actions, 0, options.command, child_environment(headers));
+  posix_spawn_file_actions_destroy(&actions);
+
+  close(in[0]);
+  close(out[1]);
+
+  struct Child* child = children + nchildren++;
+  memset(child, 0, sizeof(*child));
+
+  child->in = in[1];
+  child->out = out[0];
+  child->unread = unread;
+  child->data = data;
+  child->data_len = data_len;
+  child->events = events;
+  child->nevents = nevents;
+  child->batched = batched;
+  child->result = results[--nresults];
+  child->result_limit = (size_t) RESPONSE_LIMIT * nevents;
+
+  if(rc) {
+    errno = rc;
+    perror(options.command[0]);
+
+    close(child->in);
+    close(child->out);
+    child_free(child);
+    return;
+  }
+
+  child->pid = pid;
+  child->pidfd = open_pidfd(pid);
+
+  child_write(child);
+  spawn_wake();
+}
+
+/*
+ * start a child for the current batch. Must be called with the lock
+ * held.
+ */
+static void batch_flush()
+{
+  if(!batch_len)
+    return;
+
+  /*
+   * the child takes over the batch's memory. As spawn_child may wait
+   * for a free slot, releasing the lock, the next batch is started
+   * before: neither the spawn thread nor another submitter may see this
+   * one again.
+   */
+  struct Buffer data = batch;
+  struct ChildEvent* events = batch_events;
+  int nevents = batch_len;
+
+  memset(&batch, 0, sizeof(batch));
+  batch_events = 0;
+  batch_len = 0;
+
+  char count[32];
+  sprintf(count, "BATCH_SIZE=%d", nevents);
+  char* headers[] = { count, 0 };
+
+  spawn_child(headers, data.data, data.len, events, nevents, 1);
+}
+
+/*
+ * returns the msecs until the current batch is due.
+ */
+static long batch_due_in()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return options.batch_wait - (now.tv_sec - batch_since.tv_sec) * 1000 -
+    (now.tv_nsec - batch_since.tv_nsec) / 1000000;
+}
+
+/*
+ * the spawn thread feeds the children, passes on their results, and
+ * starts a batch once it has waited for long enough.
+ */
+static void* spawn_thread(void* arg)
+{
+  pthread_mutex_lock(&lock);
+
+  while(1) {
+    long timeout = -1;
+
+    if(batch_len && options.batch_wait > 0) {
+      timeout = batch_due_in();
+      if(timeout <= 0) {
+        if(can_start(batch_events, batch_len)) {
+          batch_flush();
+          continue;
+        }
+
+        /* wait for a child to finish */
+        timeout = -1;
+      }
+    }
+
+    spawn_poll((int) timeout);
+  }
+
+  return 0;
+}
+
+void spawn_start()
+{
+  signal(SIGPIPE, SIG_IGN);
+
+  if(options.command_jobs <= 0)
+    options.command_jobs = 1;
+
+  children = calloc(options.command_jobs, sizeof(struct Child));
+  results = calloc(options.command_jobs, sizeof(struct Buffer));
+  if(!children || !results)
+    die("calloc");
+
+  for(nresults = 0; nresults < options.command_jobs; ++nresults)
+    buffer_reserve(results + nresults, RESULT_CHUNK);
+
+  if(pipe(wake) < 0)
+    die("pipe");
+
+  int i;
+  for(i = 0; i < 2; ++i) {
+    fcntl(wake[i], F_SETFD, FD_CLOEXEC);
+    fcntl(wake[i], F_SETFL, O_NONBLOCK);
+  }
+
+  pthread_t thread;
+  if(pthread_create(&thread, 0, spawn_thread, 0))
+    die("pthread_create");
+  pthread_detach(thread);
+
+  atexit(spawn_drain);
+}
+
+void spawn_submit(char** headers, const char** values, const char* data, const char* reply_url)
+{
+  pthread_mutex_lock(&lock);
+
+  if(options.batch_size > 1) {
+    if(!batch_events) {
+      batch_events = calloc(options.batch_size, sizeof(struct ChildEvent));
+      if(!batch_events)
+        die("calloc");
+    }
+
+    struct ChildEvent* event = batch_events + batch_len++;
+    event->id = strdup_or_null(values[SSE_FIELD_ID]);
+    event->type = strdup_or_null(values[SSE_FIELD_EVENT]);
+    event->reply_url = strdup_or_null(reply_url);
+
+    format_frame(headers, data, &batch);
+
+    /* with a --batch-wait of 0 there is no waiting for more events. */
+    if(batch_len == options.batch_size || options.batch_wait <= 0) {
+      batch_flush();
+    }
+    else if(batch_len == 1) {
+      clock_gettime(CLOCK_MONOTONIC, &batch_since);
+      spawn_wake();
+    }
+  }
+  else {
+    struct ChildEvent* event = calloc(1, sizeof(struct ChildEvent));
+    size_t data_len = strlen(data);
+    char* copy = 0;
+
+    /* page-aligned, so that spliced pages are filled completely. */
+    if(data_len >= SPLICE_MIN) {
+      if(posix_memalign((void**) &copy, 4096, data_len + 1))
+        die("posix_memalign");
+    }
+    else
+      copy = malloc(data_len + 1);
+
+    if(!event || !copy)
+      die("malloc");
+
+    memcpy(copy, data, data_len);
+    event->id = strdup_or_null(values[SSE_FIELD_ID]);
+    event->type = strdup_or_null(values[SSE_FIELD_EVENT]);
+    event->reply_url = strdup_or_null(reply_url);
+
+    spawn_child(headers, copy, data_len, event, 1, 0);
+  }
+
+  pthread_mutex_unlock(&lock);
+}
+
+void spawn_drain()
+{
+  pthread_mutex_lock(&lock);
+
+  batch_flush();
+  while(nchildren)
+    pthread_cond_wait(&child_freed, &lock);
+
+  pthread_mutex_unlock(&lock);
+}
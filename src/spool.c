@@ -0,0 +1,479 @@
+/*
+ * This file is part of the sse package, copyright (c) 2011, 2012, @radiospiel.
+ * It is copyrighted under the terms of the modified BSD license, see LICENSE.BSD.
+ *
+ * For more information see https://https://github.com/radiospiel/sse.
+ */
+
+/*
+ * The reply spool (--reply-spool <dir>).
+ *
+ * Each reply request is appended to the spool before it is posted, and
+ * marked as done once it was delivered. The spool is a series of
+ * segment files, <dir>/<n>.spool, which are memory-mapped; a record is
+ * written straight into the mapping, so it survives a crash of sse
+ * right away. Records are not synced one by one, though: the reply
+ * thread calls spool_sync(), which msyncs the segments with new records
+ * or done marks at most every SPOOL_SYNC_MS msecs. A crash of the system
+ * may lose the records of that last interval.
+ *
+ * The segment records are appended to is kept until it is full; any
+ * other segment is removed once all its records are done. The next
+ * segment is created ahead of time by the reply thread, so that the
+ * threads appending records do not wait for the disk. When no segment
+ * can be created - say, the disk is full - a reply is not spooled, but
+ * kept in memory. On start the
+ * segments left behind are read, and their pending records are posted
+ * again. As the done marks are synced lazily, too, a reply may be posted
+ * twice after a crash.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "sse.h"
+
+#define SPOOL_MAGIC     0x4c4f5053    // "SPOL"
+#define SPOOL_PENDING   1
+#define SPOOL_DONE      2
+
+#define SPOOL_SEGMENT   4 * 1024 * 1024
+#define SPOOL_SYNC_MS   50
+
+#define ALIGN8(n) (((n) + 7) & ~(size_t) 7)
+
+struct SpoolRecord {
+  uint32_t  magic;              // SPOOL_MAGIC, once the record is complete
+  uint32_t  state;              // SPOOL_PENDING or SPOOL_DONE
+  uint32_t  size;               // size of the record, with this header
+  uint32_t  sum;                // checksum of the rest of the record
+  uint32_t  nevents;
+  uint32_t  batched;
+  uint32_t  url_len;            // length of the URL, without its NUL
+  uint32_t  ids_len;            // length of the ids, each NUL-terminated
+  uint64_t  body_len;
+  /* followed by the URL, the ids, and the body */
+};
+
+struct Segment {
+  unsigned long seq;
+  char*         path;
+  char*         map;
+  size_t        size;
+  size_t        used;           // bytes taken by records
+  size_t        synced;         // bytes written to disk
+  int           dirty;          // set if records were marked as done
+  int           pending;        // records not yet done
+  struct Segment* next;
+};
+
+static char* spool_dir = 0;
+static struct Segment* segments = 0;
+static struct Segment* active = 0;    // the segment records are appended to
+static struct Segment* spare = 0;     // the segment to append to next
+static unsigned long next_seq = 1;
+static struct timespec last_sync;
+static int failing = 0;               // set if the last segment could not be mapped
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t checksum(const char* p, size_t len)
+{
+  uint32_t sum = 2166136261u;
+  while(len--)
+    sum = (sum ^ (unsigned char) *p++) * 16777619u;
+  return sum;
+}
+
+static char* segment_path(unsigned long seq)
+{
+  char* path = malloc(strlen(spool_dir) + 32);
+  if(!path)
+    die("malloc");
+
+  sprintf(path, "%s/%010lu.spool", spool_dir, seq);
+  return path;
+}
+
+/*
+ * map the segment \a seq, creating it with \a size bytes if needed. The
+ * blocks of a new segment are allocated right away, so that a full disk
+ * shows here, and not as a SIGBUS when a record is written. Reports
+ * an error, and returns NULL, if the segment cannot be mapped.
+ */
+static struct Segment* segment_map(unsigned long seq, size_t size)
+{
+  struct Segment* segment = calloc(1, sizeof(*segment));
+  if(!segment)
+    die("calloc");
+
+  segment->seq = seq;
+  segment->path = segment_path(seq);
+
+  int fd = open(segment->path, O_RDWR | O_CREAT, 0600), err = 0;
+  struct stat st;
+
+  if(fd < 0 || fstat(fd, &st) < 0)
+    err = errno;
+  else if((size_t) st.st_size < size)
+    err = posix_fallocate(fd, 0, size);
+  else
+    size = st.st_size;
+
+  if(!err) {
+    segment->size = size;
+    segment->map = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(segment->map == MAP_FAILED)
+      err = errno;
+  }
+
+  if(fd >= 0)
+    close(fd);
+
+  if(err) {
+    /* report each failure once, until a segment can be mapped again */
+    if(!failing)
+      fprintf(stderr, "spool: %s: %s\n", segment->path, strerror(err));
+    failing = 1;
+
+    if(size)
+      unlink(segment->path);
+    free(segment->path);
+    free(segment);
+    return 0;
+  }
+
+  failing = 0;
+  return segment;
+}
+
+/*
+ * create the segment the next records go to, once the active one is
+ * full; see spool_append().
+ */
+static void spare_create()
+{
+  pthread_mutex_lock(&lock);
+  unsigned long seq = spare ? 0 : next_seq++;
+  pthread_mutex_unlock(&lock);
+
+  if(!seq)
+    return;
+
+  struct Segment* segment = segment_map(seq, SPOOL_SEGMENT);
+
+  pthread_mutex_lock(&lock);
+  spare = segment;
+  pthread_mutex_unlock(&lock);
+}
+
+/*
+ * unmap \a segment, and free it.
+ */
+static void segment_free(struct Segment* segment)
+{
+  munmap(segment->map, segment->size);
+  free(segment->path);
+  free(segment);
+}
+
+static void segment_remove(struct Segment* segment)
+{
+  struct Segment** p = &segments;
+  while(*p != segment)
+    p = &(*p)->next;
+  *p = segment->next;
+
+  unlink(segment->path);
+  segment_free(segment);
+}
+
+/*
+ * read the pending records of an old segment.
+ */
+static void segment_load(struct Segment* segment, void (*on_entry)(const struct SpoolEntry* entry))
+{
+  size_t pos = 0;
+
+  while(pos + sizeof(struct SpoolRecord) <= segment->size) {
+    struct SpoolRecord* record = (struct SpoolRecord*) (segment->map + pos);
+
+    /* the end, or a record that did not make it to disk completely */
+    if(record->magic != SPOOL_MAGIC || record->size > segment->size - pos ||
+       record->size < sizeof(*record) ||
+       record->sum != checksum((char*) (record + 1), record->size - sizeof(*record)))
+      break;
+
+    if(record->state == SPOOL_PENDING) {
+      struct SpoolEntry entry;
+      const char* p = (const char*) (record + 1);
+
+      entry.url = p;
+      entry.ids = p + record->url_len + 1;
+      entry.nevents = record->nevents;
+      entry.batched = record->batched;
+      entry.body = entry.ids + record->ids_len;
+      entry.len = record->body_len;
+      entry.handle = record;
+
+      segment->pending++;
+      on_entry(&entry);
+    }
+
+    pos += record->size;
+  }
+
+  segment->used = segment->synced = pos;
+}
+
+static int compare_seqs(const void* a, const void* b)
+{
+  unsigned long x = *(const unsigned long*) a, y = *(const unsigned long*) b;
+  return x < y ? -1 : x > y;
+}
+
+void spool_open(const char* dir, void (*on_entry)(const struct SpoolEntry* entry))
+{
+  spool_dir = strdup(dir);
+
+  if(mkdir(dir, 0700) < 0 && errno != EEXIST)
+    die(dir);
+
+  DIR* d = opendir(dir);
+  if(!d)
+    die(dir);
+
+  /* the old segments, oldest first */
+  struct Buffer seqs = { 0 };
+  struct dirent* de;
+
+  while((de = readdir(d)) != 0) {
+    unsigned long seq;
+    char suffix[8];
+
+    if(sscanf(de->d_name, "%lu.%7s", &seq, suffix) == 2 && !strcmp(suffix, "spool"))
+      buffer_append(&seqs, (const char*) &seq, sizeof(seq));
+  }
+  closedir(d);
+
+  unsigned long* seq = (unsigned long*) seqs.data;
+  size_t nseqs = seqs.len / sizeof(*seq), i;
+  qsort(seq, nseqs, sizeof(*seq), compare_seqs);
+
+  for(i = 0; i < nseqs; ++i) {
+    struct Segment* segment = segment_map(seq[i], 0);
+    if(!segment)
+      continue;
+
+    segment->next = segments;
+    segments = segment;
+    segment_load(segment, on_entry);
+
+    if(!segment->pending)
+      segment_remove(segment);
+
+    if(seq[i] >= next_seq)
+      next_seq = seq[i] + 1;
+  }
+
+  free(seqs.data);
+
+  int pending = 0;
+  struct Segment* segment;
+  for(segment = segments; segment; segment = segment->next)
+    pending += segment->pending;
+
+  if(pending)
+    fprintf(stderr, "spool: %s has %d pending replies\n", dir, pending);
+
+  spare_create();
+  clock_gettime(CLOCK_MONOTONIC, &last_sync);
+}
+
+const void* spool_append(const char* url, char** ids, int nevents, int batched,
+                         const char* body, size_t len, const char** spooled_body)
+{
+  size_t url_len = strlen(url), ids_len = 0;
+  int i;
+
+  for(i = 0; i < nevents; ++i)
+    ids_len += (ids[i] ? strlen(ids[i]) : 0) + 1;
+
+  size_t size = ALIGN8(sizeof(struct SpoolRecord) + url_len + 1 + ids_len + len + 1);
+
+  pthread_mutex_lock(&lock);
+
+  /*
+   * when this segment is full, go on with the spare one. Only a record
+   * that is too large for it, or one that comes in before the reply
+   * thread made a new spare, needs a segment to be created here.
+   */
+  struct Segment* segment = active;
+  if(!segment || segment->used + size > segment->size) {
+    if(spare && size <= spare->size) {
+      segment = spare;
+      spare = 0;
+    }
+    else if((segment = segment_map(next_seq++, size > SPOOL_SEGMENT ? size : SPOOL_SEGMENT)) == 0) {
+      pthread_mutex_unlock(&lock);
+      return 0;
+    }
+
+    active = segment;
+    segment->next = segments;
+    segments = segment;
+  }
+
+  struct SpoolRecord* record = (struct SpoolRecord*) (segment->map + segment->used);
+  char* p = (char*) (record + 1);
+
+  record->state = SPOOL_PENDING;
+  record->size = size;
+  record->nevents = nevents;
+  record->batched = batched;
+  record->url_len = url_len;
+  record->ids_len = ids_len;
+  record->body_len = len;
+
+  memcpy(p, url, url_len + 1);
+  p += url_len + 1;
+
+  for(i = 0; i < nevents; ++i) {
+    size_t n = ids[i] ? strlen(ids[i]) : 0;
+    memcpy(p, ids[i] ? ids[i] : "", n + 1);
+    p += n + 1;
+  }
+
+  *spooled_body = p;
+  memcpy(p, body, len);
+  p[len] = 0;
+
+  record->sum = checksum((char*) (record + 1), size - sizeof(*record));
+  __atomic_store_n(&record->magic, SPOOL_MAGIC, __ATOMIC_RELEASE);
+
+  segment->used += size;
+  segment->pending++;
+
+  pthread_mutex_unlock(&lock);
+
+  return record;
+}
+
+void spool_done(const void* handle)
+{
+  struct SpoolRecord* record = (struct SpoolRecord*) handle;
+
+  pthread_mutex_lock(&lock);
+
+  struct Segment* segment = segments;
+  while(segment && !((char*) record >= segment->map && (char*) record < segment->map + segment->size))
+    segment = segment->next;
+
+  if(segment) {
+    record->state = SPOOL_DONE;
+    segment->dirty = 1;
+
+    if(!--segment->pending && segment != active)
+      segment_remove(segment);
+  }
+
+  pthread_mutex_unlock(&lock);
+}
+
+int spool_sync(int force)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  long age = (now.tv_sec - last_sync.tv_sec) * 1000 + (now.tv_nsec - last_sync.tv_nsec) / 1000000;
+  if(!force && age < SPOOL_SYNC_MS)
+    return SPOOL_SYNC_MS - age;
+
+  last_sync = now;
+
+  spare_create();
+
+  /*
+   * Segments are only removed by spool_done() and spool_sync(), which
+   * are both called by the reply thread; so the segments collected here
+   * can be synced without the lock. Records added meanwhile go with the
+   * next sync, SPOOL_SYNC_MS later.
+   */
+  pthread_mutex_lock(&lock);
+
+  struct Segment* segment = segments;
+  int n = 0;
+
+  /* a segment that was filled up while its records were done */
+  while(segment) {
+    struct Segment* next = segment->next;
+    if(!segment->pending && segment != active)
+      segment_remove(segment);
+    segment = next;
+  }
+
+  for(segment = segments; segment; segment = segment->next)
+    n++;
+
+  if(!n) {
+    pthread_mutex_unlock(&lock);
+    return SPOOL_SYNC_MS;
+  }
+
+  struct { char* map; size_t len; } ranges[n];
+  n = 0;
+
+  for(segment = segments; segment; segment = segment->next) {
+    if(segment->synced == segment->used && !segment->dirty)
+      continue;
+
+    ranges[n].map = segment->map;
+    ranges[n++].len = segment->used;
+    segment->synced = segment->used;
+    segment->dirty = 0;
+  }
+
+  pthread_mutex_unlock(&lock);
+
+  int i;
+  for(i = 0; i < n; ++i) {
+    if(msync(ranges[i].map, ranges[i].len, MS_SYNC) < 0)
+      perror("spool: msync");
+  }
+
+  return SPOOL_SYNC_MS;
+}
+
+void spool_close()
+{
+  spool_sync(1);
+
+  pthread_mutex_lock(&lock);
+
+  active = 0;
+
+  if(spare) {
+    unlink(spare->path);
+    segment_free(spare);
+    spare = 0;
+  }
+
+  while(segments) {
+    struct Segment* segment = segments;
+
+    if(!segment->pending) {
+      segment_remove(segment);
+      continue;
+    }
+
+    segments = segment->next;
+    segment_free(segment);
+  }
+
+  pthread_mutex_unlock(&lock);
+}
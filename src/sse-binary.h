@@ -0,0 +1,112 @@
+/*
+ * This file is part of the sse package, copyright (c) 2011, 2012, @radiospiel.
+ * It is copyrighted under the terms of the modified BSD license, see LICENSE.BSD.
+ *
+ * For more information see https://https://github.com/radiospiel/sse.
+ */
+
+#ifndef SSE_BINARY_H
+#define SSE_BINARY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * The binary output format (--format=binary).
+ *
+ * The output starts with a struct SSEBinaryHeader, followed by the JSON
+ * paths that were projected, as NUL-terminated strings. Then follows one
+ * record per event. Each record starts with a struct SSEBinaryRecord; it
+ * holds the size of the record, the location of the event's id, type and
+ * data, and a table of the projected values. The strings themselves
+ * follow the table; each is NUL-terminated, which is not included in
+ * its length.
+ *
+ * All offsets are relative to the start of the record, or header; all
+ * numbers are little endian. Headers and records are padded to a
+ * multiple of 8 bytes, so a memory-mapped file can be read in place.
+ * As sizes are 32 bit, a record is less than 4 GByte; sse drops events
+ * that do not fit.
+ */
+
+#define SSE_BINARY_MAGIC    "SSEB"
+#define SSE_BINARY_VERSION  1
+#define SSE_BINARY_MAX_PATHS 64
+
+struct SSEBinaryHeader {
+  char      magic[4];       // SSE_BINARY_MAGIC
+  uint32_t  version;        // SSE_BINARY_VERSION
+  uint32_t  size;           // size of the header, including the paths
+  uint32_t  npaths;         // number of paths
+};
+
+/*
+ * a string in a record; an absent string has offset 0.
+ */
+struct SSEBinarySlice {
+  uint32_t  offset;
+  uint32_t  len;
+};
+
+struct SSEBinaryValue {
+  uint32_t  path;           // index of the JSON path
+  uint32_t  index;          // index of the value among the path's values
+  struct SSEBinarySlice value;  // the value; strings are unescaped
+};
+
+struct SSEBinaryRecord {
+  uint32_t  size;           // size of the record, including padding
+  uint32_t  nvalues;        // number of entries in values
+  struct SSEBinarySlice id;
+  struct SSEBinarySlice event;
+  struct SSEBinarySlice data;
+  struct SSEBinaryValue values[];
+};
+
+/* === reading ===================================================== */
+
+/*
+ * A reader over binary output in memory, or in a memory-mapped file.
+ * Records are returned in place; the reader does not allocate.
+ */
+struct SSEReader {
+  const char* base;
+  size_t      size;
+  size_t      pos;          // offset of the next record
+  int         mapped;       // set if base is mapped by sse_reader_open
+  const char* paths[SSE_BINARY_MAX_PATHS]; // the projected JSON paths
+  unsigned    npaths;
+};
+
+/*
+ * set up \a reader over the \a size bytes at \a data. Returns 0, or -1
+ * if the data does not start with a valid header.
+ */
+extern int sse_reader_init(struct SSEReader* reader, const void* data, size_t size);
+
+/*
+ * memory-map the file \a path, and set up \a reader over it. Returns 0,
+ * or -1 with errno set.
+ */
+extern int sse_reader_open(struct SSEReader* reader, const char* path);
+
+/*
+ * unmap a file opened via sse_reader_open.
+ */
+extern void sse_reader_close(struct SSEReader* reader);
+
+/*
+ * returns the next record, or NULL at the end of the data. A record
+ * that is truncated or malformed ends the data, too.
+ */
+extern const struct SSEBinaryRecord* sse_reader_next(struct SSEReader* reader);
+
+/*
+ * returns the string \a slice in \a record, or NULL if it is absent.
+ */
+static inline const char* sse_record_string(const struct SSEBinaryRecord* record,
+                                            const struct SSEBinarySlice* slice) {
+  return slice->offset ? (const char*) record + slice->offset : NULL;
+}
+
+#endif
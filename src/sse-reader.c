@@ -0,0 +1,131 @@
+/*
+ * This file is part of the sse package, copyright (c) 2011, 2012, @radiospiel.
+ * It is copyrighted under the terms of the modified BSD license, see LICENSE.BSD.
+ *
+ * For more information see https://https://github.com/radiospiel/sse.
+ */
+
+/*
+ * A reader for the binary output format. This file does not depend on
+ * the rest of sse; it is built into bin/libsse-reader.a.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "sse-binary.h"
+
+int sse_reader_init(struct SSEReader* reader, const void* data, size_t size)
+{
+  const struct SSEBinaryHeader* header = data;
+
+  memset(reader, 0, sizeof(*reader));
+  reader->base = data;
+  reader->size = size;
+
+  if(size < sizeof(*header) || memcmp(header->magic, SSE_BINARY_MAGIC, 4))
+    return -1;
+  if(header->version != SSE_BINARY_VERSION)
+    return -1;
+  if(header->size < sizeof(*header) || header->size > size || header->size % 8)
+    return -1;
+  if(header->npaths > SSE_BINARY_MAX_PATHS)
+    return -1;
+
+  /* the paths */
+  const char* p = (const char*) (header + 1);
+  const char* end = reader->base + header->size;
+
+  while(reader->npaths < header->npaths) {
+    const char* nul = memchr(p, 0, end - p);
+    if(!nul)
+      return -1;
+
+    reader->paths[reader->npaths++] = p;
+    p = nul + 1;
+  }
+
+  reader->pos = header->size;
+  return 0;
+}
+
+int sse_reader_open(struct SSEReader* reader, const char* path)
+{
+  int fd = open(path, O_RDONLY);
+  if(fd < 0)
+    return -1;
+
+  struct stat st;
+  if(fstat(fd, &st) < 0) {
+    close(fd);
+    return -1;
+  }
+
+  void* data = st.st_size ? mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+  close(fd);
+
+  if(data == MAP_FAILED) {
+    if(!st.st_size)
+      errno = EINVAL;
+    return -1;
+  }
+
+  if(sse_reader_init(reader, data, st.st_size) < 0) {
+    munmap(data, st.st_size);
+    errno = EINVAL;
+    return -1;
+  }
+
+  reader->mapped = 1;
+  return 0;
+}
+
+void sse_reader_close(struct SSEReader* reader)
+{
+  if(reader->mapped)
+    munmap((void*) reader->base, reader->size);
+
+  memset(reader, 0, sizeof(*reader));
+}
+
+/*
+ * is \a slice within a record of \a size bytes?
+ */
+static int slice_valid(const struct SSEBinarySlice* slice, uint32_t size)
+{
+  if(!slice->offset)
+    return 1;
+
+  return slice->offset < size && slice->len < size - slice->offset;
+}
+
+const struct SSEBinaryRecord* sse_reader_next(struct SSEReader* reader)
+{
+  size_t avail = reader->size - reader->pos;
+  const struct SSEBinaryRecord* record = (const struct SSEBinaryRecord*) (reader->base + reader->pos);
+
+  if(avail < sizeof(*record))
+    return NULL;
+
+  /* a record must at least advance the reader, in aligned steps. */
+  if(record->size < sizeof(*record) || record->size > avail || record->size % 8)
+    return NULL;
+  if(record->nvalues > (record->size - sizeof(*record)) / sizeof(struct SSEBinaryValue))
+    return NULL;
+
+  if(!slice_valid(&record->id, record->size) || !slice_valid(&record->event, record->size) ||
+     !slice_valid(&record->data, record->size))
+    return NULL;
+
+  uint32_t i;
+  for(i = 0; i < record->nvalues; ++i) {
+    if(!slice_valid(&record->values[i].value, record->size))
+      return NULL;
+  }
+
+  reader->pos += record->size;
+  return record;
+}
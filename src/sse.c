@@ -6,8 +6,8 @@
  */
 
 #include <regex.h>
+#include <getopt.h>
 #include "sse.h"
-#include "http.h"
 
 /*
  * process command line.
@@ -17,45 +17,31 @@
  */
 static void parse_arguments(int argc, char** argv);
 
-static size_t on_data(char *ptr, size_t size, size_t nmemb, void *userdata)
-{  
-  parse_sse(ptr, size * nmemb);
-  return size * nmemb;
-} 
-
-static const char* verify_sse_response(CURL* curl) {
-  #define EXPECTED_CONTENT_TYPE "text/event-stream"
-  
-  static const char expected_content_type[] = EXPECTED_CONTENT_TYPE;
-
-  char* content_type;
-  curl_easy_getinfo(curl, CURLINFO_CONTENT_TYPE, &content_type); 
-  if(!content_type) content_type = "";
-
-  if(!strncmp(content_type, expected_content_type, strlen(expected_content_type)))
-    return 0;
-  
-  return "Invalid content_type, should be '" EXPECTED_CONTENT_TYPE "'.";
-}
-
 int sse_main(int argc, char** argv) 
 {
   /* pass in arguments that will be used in REST call/connection*/
   parse_arguments(argc, argv);
+  parse_json_init();
+  output_init();
+  replies_start();
 
-  const char* headers[] = {
-    "Accept: text/event-stream",
-    NULL
-  };
+  if(options.command_workers)
+    workers_start(options.command_workers);
+  else if(options.command)
+    spawn_start();
+  else if(options.decode_workers && options.format != FORMAT_BINARY)
+    decode_pool_start(options.decode_workers);
 
-  /* calls libcurl */
-  http(HTTP_GET, options.url, headers, 0, 0, on_data, verify_sse_response);
-  return 0;
+  if(options.format == FORMAT_BINARY)
+    binary_init();
+
+  return streams_run();
 }
 
 static char* help[] = {
   "",
   "sse [ <options> ] URL [ <command> ... ]",
+  "sse [ <options> ] --stream URL ... [ <command> ... ]",
   "",
   "sse connects to an URL, where it expects a stream of server sent events. "
   "On each incoming event it runs a command specified on the command line, passing "
@@ -65,9 +51,52 @@ static char* help[] = {
   "",
   "  -a <ca>      ... set PEM CA file",
   "  -c <cert>    ... set PEM certificate file",
+  "  -f <name>    ... register an additional field name; can be set multiple times",
   "  -i           ... insecure: allow HTTP and non-certified HTTPS connections",
+  "  -j <path>    ... print only the JSON value at <path> in the event data, e.g. 'metrics.messages[].message';",
+  "                   can be set multiple times. The default is 'metrics.messages[].message'",
+  "  -J <n>       ... run the <command> for up to <n> events at the same time (default: number of CPUs)",
   "  -l <limit>   ... limit number of events",
+  "  -m <size>    ... drop events with more than <size> bytes of data (default: 16 MByte, 0: no limit)",
+  "  -P <n>       ... extract JSON with <n> threads; output stays in stream order",
+  "  -t           ... prefix each JSON record with the event id and its index in the event",
   "  -v           ... be verbose; can be set multiple times",
+  "  -w <n>       ... run <command> as <n> persistent workers, which read events as frames",
+  "                   from stdin (see src/workers.c)",
+  "",
+  "  --format <f>        ... output format: text (default); ndjson, one JSON object per event;",
+  "                          or binary, length-prefixed records (see src/sse-binary.h)",
+  "  --shm <name>        ... publish the output into the shared memory ring /dev/shm/<name>",
+  "                          instead of writing it to stdout (see src/shm-ring.h)",
+  "  --shm-size <n>      ... size of the shared memory ring (default: 16 MByte)",
+  "  --shm-policy <p>    ... what to do when a reader falls behind: block, drop the event,",
+  "                          or overwrite the oldest events (default)",
+  "  --serve <path>      ... serve the output to any number of clients on the Unix socket <path>",
+  "                          instead of writing it to stdout. A client may send a line",
+  "                          \"events <type>,...\" to receive only events of these types",
+  "  --serve-queue <n>   ... output queued per client before events are dropped (default: 4 MByte)",
+  "  --ordered           ... do not run the <command> for events with the same id at the same time",
+  "  --batch <n>         ... run the <command> for up to <n> events at once, which it reads as",
+  "                          frames from stdin (see src/spawn.c)",
+  "  --batch-wait <ms>   ... start a batch at most <ms> milliseconds after its first event (default: 100);",
+  "                          0 starts each event right away",
+  "  --reply-batch <n>   ... post up to <n> replies to the same URL as one JSON array (see src/reply.c)",
+  "  --reply-window <ms> ... post replies at most <ms> milliseconds after the first one (default: 100)",
+  "  --reply-spool <dir> ... keep replies in <dir> until they are delivered, retrying failed ones;",
+  "                          what is left is posted when sse is started again",
+  "  --reconnect         ... reconnect whenever the stream ends, resuming after the last event",
+  "                          (via Last-Event-ID); waits as long as the server's \"retry\" field says",
+  "  --idle-timeout <s>  ... end a connection that received nothing for <s> seconds, as failed;",
+  "                          with --reconnect it is read again (default: 0, never)",
+  "  --stream [<tag>=]<url> ... read the stream at <url>; can be set multiple times. All streams",
+  "                          are read at once, and with more than one each event is tagged with",
+  "                          its stream: with <tag>, the URL's streamID parameter, or the URL",
+  "  --streams <file>    ... read the streams listed in <file>, one \"[<tag>=]<url>\" per line",
+  "  --threads <n>       ... read the streams with <n> threads (default: 1)",
+  "  --flush-bytes <n>   ... write output once <n> bytes are buffered (default: 64 kByte)",
+  "  --flush-events <n>  ... write output once <n> events are buffered (default: 1024)",
+  "  --flush-ms <ms>     ... write output at most <ms> milliseconds after an event (default: 100);",
+  "                          0 writes each event right away",
   "",
   "On each incoming event the <command> is run. The event's data attribute is written "
   "to the command's standard input, all other attributes are written to the environment "
@@ -85,6 +114,56 @@ static void usage() {
   exit(1);
 }
 
+/*
+ * long options without a short equivalent.
+ */
+enum {
+  OPT_FLUSH_BYTES = 256,
+  OPT_FLUSH_EVENTS,
+  OPT_FLUSH_MS,
+  OPT_FORMAT,
+  OPT_SHM,
+  OPT_SHM_SIZE,
+  OPT_SHM_POLICY,
+  OPT_SERVE,
+  OPT_SERVE_QUEUE,
+  OPT_ORDERED,
+  OPT_BATCH,
+  OPT_BATCH_WAIT,
+  OPT_REPLY_BATCH,
+  OPT_REPLY_WINDOW,
+  OPT_REPLY_SPOOL,
+  OPT_RECONNECT,
+  OPT_STREAM,
+  OPT_STREAMS,
+  OPT_THREADS,
+  OPT_IDLE_TIMEOUT
+};
+
+static struct option long_options[] = {
+  { "flush-bytes",  required_argument, 0, OPT_FLUSH_BYTES },
+  { "flush-events", required_argument, 0, OPT_FLUSH_EVENTS },
+  { "flush-ms",     required_argument, 0, OPT_FLUSH_MS },
+  { "format",       required_argument, 0, OPT_FORMAT },
+  { "shm",          required_argument, 0, OPT_SHM },
+  { "shm-size",     required_argument, 0, OPT_SHM_SIZE },
+  { "shm-policy",   required_argument, 0, OPT_SHM_POLICY },
+  { "serve",        required_argument, 0, OPT_SERVE },
+  { "serve-queue",  required_argument, 0, OPT_SERVE_QUEUE },
+  { "ordered",      no_argument,       0, OPT_ORDERED },
+  { "batch",        required_argument, 0, OPT_BATCH },
+  { "batch-wait",   required_argument, 0, OPT_BATCH_WAIT },
+  { "reply-batch",  required_argument, 0, OPT_REPLY_BATCH },
+  { "reply-window", required_argument, 0, OPT_REPLY_WINDOW },
+  { "reply-spool",  required_argument, 0, OPT_REPLY_SPOOL },
+  { "reconnect",    no_argument,       0, OPT_RECONNECT },
+  { "stream",       required_argument, 0, OPT_STREAM },
+  { "streams",      required_argument, 0, OPT_STREAMS },
+  { "threads",      required_argument, 0, OPT_THREADS },
+  { "idle-timeout", required_argument, 0, OPT_IDLE_TIMEOUT },
+  { 0, 0, 0, 0 }
+};
+
 static void parse_arguments(int argc, char** argv)
 {
   /* set default url and allow_insecure is always set to true for now */
@@ -93,15 +172,93 @@ static void parse_arguments(int argc, char** argv)
   //options.url = "https://10.25.24.156:8080/v1/stream/cray-logs-containers";
     
   while(1) {
-    int ch = getopt(argc, argv, "vic:a:l:?h");
+    int ch = getopt_long(argc, argv, "+vic:a:f:j:J:l:m:P:tw:?h", long_options, 0);
     if(ch == -1) break;
     
     switch (ch) {
     case 'c': options.ssl_cert = optarg; break;
     case 'a': options.ca_info = optarg; break;
+    case 'f': sse_field_register(optarg); break;
     case 'i': options.allow_insecure = 1; break;
+    case 'j':
+      if(parse_json_add(optarg) < 0) {
+        fprintf(stderr, "Invalid JSON path '%s'.\n", optarg);
+        exit(1);
+      }
+      options.json_paths++;
+      break;
+    case 'J': options.command_jobs = atoi(optarg); break;
     case 'l': options.limit = atol(optarg); break;
+    case 't': options.tag_records = 1; break;
+    case 'P':
+      options.decode_workers = atoi(optarg);
+      if(options.decode_workers < 0) {
+        fprintf(stderr, "Invalid number of decode threads '%s'.\n", optarg);
+        exit(1);
+      }
+      break;
+    case 'm': options.max_event_size = strtoul(optarg, 0, 10); break;
     case 'v': options.verbosity += 1; break;
+    case 'w': options.command_workers = atoi(optarg); break;
+    case OPT_FLUSH_BYTES:  options.flush_bytes = strtoul(optarg, 0, 10); break;
+    case OPT_FLUSH_EVENTS: options.flush_events = atoi(optarg); break;
+    case OPT_FLUSH_MS:     options.flush_ms = atoi(optarg); break;
+    case OPT_FORMAT:
+      if(!strcmp(optarg, "text"))
+        options.format = FORMAT_TEXT;
+      else if(!strcmp(optarg, "ndjson"))
+        options.format = FORMAT_NDJSON;
+      else if(!strcmp(optarg, "binary"))
+        options.format = FORMAT_BINARY;
+      else {
+        fprintf(stderr, "Invalid format '%s'.\n", optarg);
+        exit(1);
+      }
+      break;
+    case OPT_SHM:      options.shm_name = optarg; break;
+    case OPT_SHM_SIZE: options.shm_size = strtoul(optarg, 0, 10); break;
+    case OPT_SHM_POLICY:
+      if(!strcmp(optarg, "block"))
+        options.shm_policy = SSE_SHM_BLOCK;
+      else if(!strcmp(optarg, "drop"))
+        options.shm_policy = SSE_SHM_DROP;
+      else if(!strcmp(optarg, "overwrite"))
+        options.shm_policy = SSE_SHM_OVERWRITE;
+      else {
+        fprintf(stderr, "Invalid shm policy '%s'.\n", optarg);
+        exit(1);
+      }
+      break;
+    case OPT_SERVE:       options.serve_path = optarg; break;
+    case OPT_SERVE_QUEUE: options.serve_queue = strtoul(optarg, 0, 10); break;
+    case OPT_ORDERED:     options.ordered = 1; break;
+    case OPT_BATCH:       options.batch_size = atoi(optarg); break;
+    case OPT_BATCH_WAIT:  options.batch_wait = atoi(optarg); break;
+    case OPT_REPLY_BATCH:  options.reply_batch = atoi(optarg); break;
+    case OPT_REPLY_WINDOW: options.reply_window = atoi(optarg); break;
+    case OPT_REPLY_SPOOL:  options.reply_spool = optarg; break;
+    case OPT_RECONNECT:    options.reconnect = 1; break;
+    case OPT_IDLE_TIMEOUT: options.idle_timeout = atoi(optarg); break;
+    case OPT_STREAM:
+      streams_add(optarg);
+      options.streams++;
+      break;
+    case OPT_STREAMS: {
+      int n = streams_load(optarg);
+      if(!n) {
+        fprintf(stderr, "No streams in '%s'.\n", optarg);
+        exit(1);
+      }
+      options.streams += n;
+      break;
+    }
+    case OPT_THREADS:
+      options.threads = atoi(optarg);
+      if(options.threads < 1) {
+        fprintf(stderr, "Invalid number of threads '%s'.\n", optarg);
+        exit(1);
+      }
+      break;
     case '?':
     case 'h':
     default:
@@ -112,17 +269,32 @@ static void parse_arguments(int argc, char** argv)
   argc -= optind;
   argv += optind;
 
-  if(*argv) {
-    options.url = *argv++;
+  /* with --stream or --streams all arguments are the <command>. */
+  if(!options.streams) {
+    if(*argv)
+      options.url = *argv++;
+
+    streams_add(options.url);
+  }
+
+  if(*argv)
+    options.command = argv;
+
+  if(!options.command_jobs)
+    options.command_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+
+  if(options.command_workers && !options.command) {
+    fprintf(stderr, "-w needs a <command>.\n");
+    exit(1);
   }
   
-  if(!options.url)
-    usage();
-    
-  if(!options.allow_insecure) {
-    if(strncmp(options.url, "https:", 6)) {
-      fprintf(stderr, "Insecure connections not allowed, use -i, if necessary.\n");
-      exit(1);
-    }
-  } 
+  if(options.format == FORMAT_BINARY && options.streams > 1) {
+    fprintf(stderr, "--format binary reads a single stream.\n");
+    exit(1);
+  }
+
+  if(options.format == FORMAT_BINARY && options.command) {
+    fprintf(stderr, "--format binary cannot be used with a <command>.\n");
+    exit(1);
+  }
 }
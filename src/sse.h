@@ -10,18 +10,39 @@
 
 #define MAX_HEADERS 100
 
+/* default limit for an event's data: 16 MByte */
+#define EVENT_SIZE_LIMIT  16 * 1024 * 1024
+
+/* initial size of the per-event memory arena: 16 kByte */
+#define EVENT_ARENA_SIZE  16 * 1024
+
 /* response limit: 128 kByte */
 #define RESPONSE_LIMIT  128 * 1024
 
+/* event data of at least that size is spliced into pipes: 64 kByte */
+#define SPLICE_MIN  64 * 1024
+
 #include <unistd.h>
 #include <string.h>
 #include <stdlib.h>
 #include <ctype.h>
 #include <stdio.h>
 
+#include "arena.h"
+#include "shm-ring.h"
+
 #define DECLARE_OBJECT(T, name) extern struct T name
 #define DEFINE_OBJECT(T, name)  struct T name = T ## _Initializer
 
+/*
+ * output formats
+ */
+enum {
+  FORMAT_TEXT = 0,            // headers, data, and "label: value" lines
+  FORMAT_NDJSON,              // one JSON object per line
+  FORMAT_BINARY               // length-prefixed records, see sse-binary.h
+};
+
 /*
  * Aplication options
  */
@@ -33,6 +54,32 @@ struct Options {
   int         allow_insecure; // allow insecure connections
   const char *ssl_cert;       // SSL cert file
   const char *ca_info;        // CA cert file
+  size_t      max_event_size; // limit on an event's data size, 0 for no limit
+  int         json_paths;     // number of JSON paths to extract
+  int         tag_records;    // prefix JSON records with event id and index
+  int         decode_workers; // number of JSON decode threads, 0 for none
+  size_t      flush_bytes;    // write output once that many bytes are buffered
+  unsigned    flush_events;   // write output once that many events are buffered
+  int         flush_ms;       // write output after that many milliseconds
+  int         format;         // output format, one of FORMAT_*
+  const char *shm_name;       // publish output into this shm ring
+  size_t      shm_size;       // size of the shm ring
+  int         shm_policy;     // what to do about slow shm readers, SSE_SHM_*
+  const char *serve_path;     // serve the output on this Unix socket
+  size_t      serve_queue;    // limit on the output queued per client
+  char      **command;        // command to run on each event, or NULL
+  int         command_workers; // number of persistent command workers
+  int         command_jobs;   // number of commands to run at the same time
+  int         ordered;        // run commands for events with the same id in order
+  int         batch_size;     // run the command for up to that many events at once
+  int         batch_wait;     // wait at most that many milliseconds for a batch to fill
+  int         reply_batch;    // post up to that many replies to the same URL at once
+  int         reply_window;   // wait at most that many milliseconds for more replies
+  const char *reply_spool;    // keep replies in this directory until they are delivered
+  int         reconnect;      // reconnect when the stream ends
+  int         streams;        // number of streams given via --stream and --streams
+  int         threads;        // number of threads reading the streams
+  int         idle_timeout;   // end a connection idle for that many seconds, 0 for never
 };
 
 struct MemoryStruct {
@@ -40,7 +87,16 @@ struct MemoryStruct {
   size_t size;
 };
 
-#define Options_Initializer {0,0,0,0,0,0,0}
+/*
+ * A growable output buffer.
+ */
+struct Buffer {
+  char*   data;
+  size_t  len;
+  size_t  size;
+};
+
+#define Options_Initializer {0,0,0,0,0,0,0,EVENT_SIZE_LIMIT,0,0,0,64 * 1024,1024,100,FORMAT_TEXT,0,16 * 1024 * 1024,SSE_SHM_OVERWRITE,0,4 * 1024 * 1024,0,0,0,0,1,100,1,100,0,0,0,1,0}
 DECLARE_OBJECT(Options, options);
 
 #define FD_STDIN    0
@@ -48,19 +104,357 @@ DECLARE_OBJECT(Options, options);
 #define FD_STDERR   2
 
 /*
- * put some data into the SSE parser
+ * A slice of bytes. It is not NUL terminated.
+ */
+struct SSESlice {
+  const char* ptr;
+  size_t      len;
+};
+
+/*
+ * field ids. Fields registered via sse_field_register get ids starting
+ * at SSE_FIELD_EXTRA; all unknown fields have the id SSE_FIELD_OTHER.
  */
-extern void parse_sse(char *ptr, size_t size);
+#define SSE_FIELD_OTHER 0
+#define SSE_FIELD_EVENT 1
+#define SSE_FIELD_ID    2
+#define SSE_FIELD_RETRY 3
+#define SSE_FIELD_DATA  4
+#define SSE_FIELD_REPLY 5
+#define SSE_FIELD_STREAM 6    // the tag of the event's stream; not read from the input
+#define SSE_FIELD_EXTRA 7
+
+#define SSE_MAX_FIELDS  16
 
 /*
- * parse and convert to json.
+ * register an additional field name, and return its field id. This
+ * must be called before parsing starts.
  */
-extern void parse_json(const char* data);
+extern int sse_field_register(const char* name);
 
 /*
- * Callback for SSE events.
+ * returns the id of the field \a name, or SSE_FIELD_OTHER.
  */
-extern void on_sse_event(char** headers, const char* data, const char* reply_url);
+extern int sse_field_lookup(const char* name, size_t len);
+
+/*
+ * returns the name of the field \a id, in lower and in upper case.
+ */
+extern const char* sse_field_name(int id);
+extern const char* sse_field_upcased(int id);
+
+struct SSEField {
+  int             type;   // the field id
+  struct SSESlice name;
+  struct SSESlice value;
+};
+
+/*
+ * An event, as passed to a parser's on_event callback. Its fields appear
+ * in stream order; each data line is a field of its own. All slices point
+ * into the parser's input and are valid only during the callback. Use
+ * sse_event_copy to keep an event.
+ *
+ * slots[id] is the index + 1 of the last field with that id, or 0.
+ */
+struct SSEEvent {
+  struct SSEField*  fields;
+  unsigned          nfields;
+  unsigned          slots[SSE_MAX_FIELDS];
+};
+
+/*
+ * returns the value of the last field with id \a id, or NULL.
+ */
+static inline const struct SSESlice* sse_event_get(const struct SSEEvent* event, int id) {
+  return event->slots[id] ? &event->fields[event->slots[id] - 1].value : NULL;
+}
+
+/*
+ * returns an owned copy of \a event; release it via free(3).
+ */
+extern struct SSEEvent* sse_event_copy(const struct SSEEvent* event);
+
+/*
+ * An incremental SSE parser. It keeps the state of the current event
+ * and the unfinished tail of the input between calls to sse_parser_feed.
+ */
+struct SSEParser {
+  /*
+   * If set, events are passed to on_event as views into the input, and
+   * on_sse_event is not called.
+   */
+  void        (*on_event)(const struct SSEEvent* event, void* context);
+  void*       context;
+
+  char*       tail;                 // unfinished input from previous chunks
+  size_t      tail_len;
+  size_t      tail_size;
+  size_t      line_start;           // start of the unfinished line in tail
+
+  struct Arena arena;               // memory for the current event
+
+  char*       headers[MAX_HEADERS]; // "NAME=value" headers of the current event
+  char**      header_ptr;
+  const char* values[SSE_MAX_FIELDS]; // values of known fields, by field id
+  char*       data_buf;             // data of the current event
+  size_t      data_len;
+  size_t      data_cap;
+  size_t      max_data_size;        // limit for data_len, 0 for no limit
+  int         discard;              // set if the current event exceeds the limit
+  int         skip_line;            // set while skipping the rest of an overlong line
+  char*       reply_url;            // reply URL of the current event
+
+  struct SSEField* fields;          // fields of the current event, with on_event
+  unsigned    nfields;
+  unsigned    fields_cap;
+  unsigned    slots[SSE_MAX_FIELDS];
+
+  char*       last_id;              // id of the last event that had one, or NULL
+  size_t      last_id_cap;
+  long        retry;                // msecs from the last "retry" field, or -1
+
+  const char* stream;               // tag added to each event, or NULL
+  unsigned long events;             // number of events passed on
+};
+
+/*
+ * initialize a parser.
+ */
+extern void sse_parser_init(struct SSEParser* parser);
+
+/*
+ * release all resources held by a parser.
+ */
+extern void sse_parser_free(struct SSEParser* parser);
+
+/*
+ * drop the unfinished event and input, e.g. when the connection broke.
+ * last_id and retry are kept.
+ */
+extern void sse_parser_reset(struct SSEParser* parser);
+
+/*
+ * put some data into the SSE parser. This calls on_sse_event for each
+ * complete event; the result does not depend on how the input is split
+ * into chunks.
+ */
+extern void sse_parser_feed(struct SSEParser* parser, const char* ptr, size_t len);
+
+/*
+ * find the end of the line starting at \a p. Returns a pointer to the
+ * terminating newline, or NULL if there is none before \a end. If a
+ * newline is found \a *pcolon is set to the first colon in the line,
+ * or to NULL.
+ */
+extern const char* sse_scan_line(const char* p, const char* end, const char** pcolon);
+
+/*
+ * use the implementation \a name ("avx2", "sse2", or "scalar") from now
+ * on, instead of the best one for this CPU; for tests. Returns -1 if it
+ * is not available here.
+ */
+extern int sse_scan_select(const char* name);
+
+/*
+ * add a JSON path to extract from each event. Returns -1 if the path
+ * is invalid.
+ */
+extern int parse_json_add(const char* path);
+
+/*
+ * finish setting up the JSON paths to extract from each event.
+ */
+extern void parse_json_init();
+
+/*
+ * returns the matcher for the configured JSON paths.
+ */
+struct JSONMatcher;
+extern const struct JSONMatcher* parse_json_matcher();
+
+/*
+ * extract the configured JSON paths from an event's data, and append
+ * the resulting records to \a out. In NDJSON format this adds the
+ * values to the event's object, and closes it. In text format each
+ * record is prefixed with the \a stream tag, if set.
+ */
+extern void parse_json(const char* data, const char* event_id, const char* stream, struct Buffer* out);
+
+/*
+ * append an event's headers and data to \a out, unless only JSON paths
+ * are to be printed. In NDJSON format this opens the event's object.
+ */
+extern void format_event(char** headers, const char** values, const char* data, struct Buffer* out);
+
+/*
+ * append an event as a frame for a command to \a out; see workers.c.
+ */
+extern void format_frame(char** headers, const char* data, struct Buffer* out);
+
+/*
+ * append only the header lines of a frame, for \a data_len bytes of data.
+ */
+extern void format_frame_header(char** headers, size_t data_len, struct Buffer* out);
+
+/*
+ * write the header of the binary format, and the records of events
+ * passed to binary_on_event.
+ */
+extern void binary_init();
+extern void binary_on_event(const struct SSEEvent* event, void* context);
+
+/*
+ * start \a n threads to extract JSON from events in the background.
+ */
+extern void decode_pool_start(int n);
+
+/*
+ * hand an event to the decode workers. The event's output is written
+ * to stdout once it and all earlier events are done.
+ */
+extern void decode_pool_submit(char** headers, const char** values, const char* data);
+
+/*
+ * wait until all submitted events are written.
+ */
+extern void decode_pool_drain();
+
+/*
+ * set up buffered output to stdout.
+ */
+extern void output_init();
+
+/*
+ * give the calling thread a staging buffer of its own; see output.c.
+ */
+extern void output_thread_init();
+
+/*
+ * write the output of an event of type \a type to stdout. The output is
+ * buffered, and written out according to the --flush-* options.
+ */
+extern void output_write(const char* type, const char* data, size_t len);
+
+/*
+ * write output that goes before all events.
+ */
+extern void output_header(const char* data, size_t len);
+
+/*
+ * write out all buffered output.
+ */
+extern void output_flush();
+
+/*
+ * listen on the Unix socket \a path, and pass output on to all clients
+ * that want events of its type.
+ */
+extern void serve_init(const char* path);
+extern void serve_preamble(const char* data, size_t len);
+extern void serve_write(const char* type, const char* data, size_t len);
+extern void serve_close();
+
+/*
+ * make room for \a len more bytes in \a buf, and return a pointer to
+ * the end of its contents.
+ */
+extern char* buffer_reserve(struct Buffer* buf, size_t len);
+
+/*
+ * append \a len bytes from \a data to \a buf.
+ */
+extern void buffer_append(struct Buffer* buf, const char* data, size_t len);
+
+/*
+ * append a JSON string with \a len bytes from \a s to \a out.
+ */
+extern void buffer_append_json_string(struct Buffer* out, const char* s, size_t len);
+
+/*
+ * Callback for SSE events. \a values holds the values of all known
+ * fields, indexed by field id, or NULL.
+ */
+extern void on_sse_event(char** headers, const char** values, const char* data, const char* reply_url);
+
+/*
+ * add the stream "[<tag>=]<url>", or the streams listed in the file
+ * \a path, one per line; see streams.c. streams_load returns the number
+ * of streams added.
+ */
+extern void streams_add(const char* spec);
+extern int streams_load(const char* path);
+
+/*
+ * read all streams until they are done, with options.threads threads.
+ * Returns 0, or 1 if a stream failed.
+ */
+extern int streams_run();
+
+/*
+ * start posting replies in the background; see reply.c.
+ */
+extern void replies_start();
+extern void replies_drain();
+
+/*
+ * queue the reply to the event \a event_id, \a len bytes from \a body,
+ * to be posted to \a reply_url.
+ */
+extern void send_reply(const char* reply_url, const char* event_id, const char* body, size_t len);
+
+/*
+ * the reply spool; see spool.c.
+ */
+struct SpoolEntry {
+  const char* url;
+  const char* ids;            // the events' ids, each NUL-terminated
+  int         nevents;
+  int         batched;
+  const char* body;
+  size_t      len;
+  const void* handle;         // identifies the entry to spool_done()
+};
+
+/*
+ * open the spool in \a dir, and pass each pending entry to \a on_entry.
+ */
+extern void spool_open(const char* dir, void (*on_entry)(const struct SpoolEntry* entry));
+
+/*
+ * append a reply request to the spool. Sets \a *spooled_body to the
+ * spool's copy of \a body, and returns a handle for spool_done(); or
+ * NULL if the spool cannot take the request.
+ */
+extern const void* spool_append(const char* url, char** ids, int nevents, int batched,
+                                const char* body, size_t len, const char** spooled_body);
+
+/*
+ * mark a reply request as delivered.
+ */
+extern void spool_done(const void* handle);
+
+/*
+ * write the spool's changes to disk, unless that was done shortly before
+ * and \a force is not set. Returns the msecs until the next sync is due.
+ */
+extern int spool_sync(int force);
+extern void spool_close();
+
+/*
+ * start \a n persistent command workers, and hand events to them.
+ */
+extern void workers_start(int n);
+extern void workers_submit(char** headers, const char** values, const char* data, const char* reply_url);
+extern void workers_drain();
+
+/*
+ * run the command once per event - or once per batch of events, see
+ * options.batch_size - up to options.command_jobs at a time.
+ */
+extern void spawn_start();
+extern void spawn_submit(char** headers, const char** values, const char* data, const char* reply_url);
+extern void spawn_drain();
 
 /*
  * Write \a dataLen bytes from \a data to \a fd.
@@ -68,11 +462,16 @@ extern void on_sse_event(char** headers, const char* data, const char* reply_url
 extern int write_all(int fd, const char* data, unsigned dataLen);
 
 /*
- * read data from fd handle, return a malloced area in the pResult 
- * buffer - this must be freed by the caller - and returns the number
- * of bytes read.
+ * Write all \a iovcnt buffers in \a iov to \a fd.
+ */
+struct iovec;
+extern int writev_all(int fd, struct iovec* iov, int iovcnt);
+
+/*
+ * Write up to \a len bytes from \a data to the non-blocking pipe \a fd;
+ * see tools.c for when \a data must stay unchanged afterwards.
  */
-extern int read_all(int fd, char** pResult, size_t limit);
+extern ssize_t pipe_write(int fd, const char* data, size_t len);
 
 /*
  * print a 0-limited array of text \a lines to the \a output FILE handle.
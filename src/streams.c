@@ -0,0 +1,655 @@
+/*
+ * This file is part of the sse package, copyright (c) 2011, 2012, @radiospiel.
+ * It is copyrighted under the terms of the modified BSD license, see LICENSE.BSD.
+ *
+ * For more information see https://https://github.com/radiospiel/sse.
+ */
+
+/*
+ * Reading the streams.
+ *
+ * sse reads any number of streams - the URL on the command line, or
+ * those given via --stream and --streams - by default in one thread. Each
+ * stream has a curl easy handle and a parser of its own. All handles
+ * run in one curl multi handle, which is driven by epoll(7) and
+ * curl_multi_socket_action(); so the streams share connections, the
+ * DNS cache, and TLS sessions, and an idle stream costs nothing but its
+ * socket and its parser.
+ *
+ * With more than one stream each stream gets a tag: the name given via
+ * "<tag>=<url>", or the URL's streamID parameter, or else the URL. The
+ * tag is added to each of its events, as a "STREAM=<tag>" header; see
+ * parse-sse.c.
+ *
+ * When a stream ends it is done - unless --reconnect is set, see
+ * stream_done(). sse ends when all its streams are done.
+ *
+ * With --threads <n> the streams are dealt out round robin to <n>
+ * engines, each running in a thread of its own. An engine owns its
+ * multi handle, its epoll set, its streams and their parsers, and its
+ * output is staged separately (see output.c); engines share nothing.
+ * Their counters are added up once they are done, and reported with -v.
+ */
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
+#include <pthread.h>
+#include <errno.h>
+#include <time.h>
+#include "sse.h"
+#include "http.h"
+
+#define STREAM_CONNECT_RETRIES  5     // retries of a failed connect, without --reconnect
+#define STREAM_BACKOFF_MAX      30000 // max. msecs between reconnects
+
+struct Engine;
+
+struct Stream {
+  struct Engine* engine;
+  char*         url;
+  char*         tag;            // the tag of the stream's events, or NULL
+  CURL*         curl;
+  struct curl_slist* headers;
+  struct SSEParser parser;
+  size_t        received;       // bytes received on the current connection
+  int           verified;       // set once the response was checked
+  const char*   fatal;          // why the stream cannot be read, or NULL
+  int           attempts;       // failed connects in a row
+  long          connect_at;     // when to connect again, or -1
+  char          error[CURL_ERROR_SIZE];
+};
+
+/*
+ * An engine reads its streams in one thread.
+ */
+struct Engine {
+  struct Stream** streams;
+  int           nstreams;
+  int           active;         // streams that are not done
+  CURLM*        multi;
+  CURLSH*       share;
+  int           epfd;
+  long          timer_at;       // when curl wants to be called, or -1
+  unsigned      seed;           // for the reconnect jitter
+  pthread_t     thread;
+
+  /* counters */
+  unsigned long connects;
+  unsigned long bytes;
+  unsigned long events;
+  int           failed;         // streams that failed for good
+};
+
+static struct Stream** streams = 0;
+static int nstreams = 0;
+
+static long now_ms()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/*
+ * report something about \a stream, prefixed with its tag.
+ */
+static void stream_log(struct Stream* stream, const char* msg)
+{
+  if(stream->tag)
+    fprintf(stderr, "%s: %s\n", stream->tag, msg);
+  else
+    fprintf(stderr, "%s\n", msg);
+}
+
+/*
+ * returns NULL if the response looks like an event stream, or else
+ * why it does not.
+ */
+static const char* stream_verify(struct Stream* stream)
+{
+  #define EXPECTED_CONTENT_TYPE "text/event-stream"
+
+  static const char expected_content_type[] = EXPECTED_CONTENT_TYPE;
+
+  long response_code = 0;
+  curl_easy_getinfo(stream->curl, CURLINFO_RESPONSE_CODE, &response_code);
+
+  /* the status is reported once the transfer is done. */
+  if(response_code < 200 || response_code >= 300)
+    return 0;
+
+  char* content_type;
+  curl_easy_getinfo(stream->curl, CURLINFO_CONTENT_TYPE, &content_type);
+  if(!content_type) content_type = "";
+
+  if(!strncmp(content_type, expected_content_type, strlen(expected_content_type)))
+    return 0;
+
+  return "Invalid content_type, should be '" EXPECTED_CONTENT_TYPE "'.";
+}
+
+static size_t on_data(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+  struct Stream* stream = userdata;
+  long response_code = 0;
+
+  /* only a successful response is parsed. */
+  if(!stream->verified) {
+    stream->verified = 1;
+    stream->fatal = stream_verify(stream);
+  }
+
+  curl_easy_getinfo(stream->curl, CURLINFO_RESPONSE_CODE, &response_code);
+  if(stream->fatal || response_code < 200 || response_code >= 300)
+    return 0;
+
+  stream->received += size * nmemb;
+  stream->engine->bytes += size * nmemb;
+  sse_parser_feed(&stream->parser, ptr, size * nmemb);
+  return size * nmemb;
+}
+
+static void stream_connect(struct Stream* stream)
+{
+  curl_slist_free_all(stream->headers);
+  stream->headers = curl_slist_append(0, "Accept: text/event-stream");
+
+  /* resume after the last event; an empty id means: from the start. */
+  if(stream->parser.last_id && *stream->parser.last_id) {
+    char* header = malloc(strlen(stream->parser.last_id) + 16);
+    if(!header)
+      die("malloc");
+
+    sprintf(header, "Last-Event-ID: %s", stream->parser.last_id);
+    stream->headers = curl_slist_append(stream->headers, header);
+    free(header);
+  }
+
+  curl_easy_setopt(stream->curl, CURLOPT_HTTPHEADER, stream->headers);
+
+  stream->received = 0;
+  stream->verified = 0;
+  stream->fatal = 0;
+  stream->connect_at = -1;
+  *stream->error = 0;
+
+  stream->engine->connects++;
+  curl_multi_add_handle(stream->engine->multi, stream->curl);
+}
+
+/*
+ * msecs to wait before the next reconnect: what the server asked for,
+ * or else a backoff with jitter, from 100 msecs up to 30 secs.
+ */
+static long reconnect_delay(struct Stream* stream)
+{
+  if(stream->parser.retry >= 0)
+    return stream->parser.retry;
+
+  int attempts = stream->attempts;
+  long backoff = 100L << (attempts < 9 ? attempts : 9);
+  if(backoff > STREAM_BACKOFF_MAX)
+    backoff = STREAM_BACKOFF_MAX;
+
+  return backoff / 2 + rand_r(&stream->engine->seed) % (backoff / 2 + 1);
+}
+
+static int is_connect_error(CURLcode result)
+{
+  return result == CURLE_COULDNT_RESOLVE_PROXY || result == CURLE_COULDNT_RESOLVE_HOST ||
+         result == CURLE_COULDNT_CONNECT;
+}
+
+/*
+ * the connection of \a stream ended. Without --reconnect the stream is
+ * done, unless it could not connect; that is retried a few times. With
+ * --reconnect the stream is read again, after the last event - unless
+ * the server answered in a way that will not change.
+ */
+static void stream_done(struct Stream* stream, CURLcode result)
+{
+  long response_code = 0;
+  const char* effective_url = 0;
+  char msg[CURL_ERROR_SIZE + 512];
+
+  curl_easy_getinfo(stream->curl, CURLINFO_RESPONSE_CODE, &response_code);
+  curl_easy_getinfo(stream->curl, CURLINFO_EFFECTIVE_URL, &effective_url);
+  curl_multi_remove_handle(stream->engine->multi, stream->curl);
+
+  /* 0: the stream ended; 1: it failed, but that might go away; -1: it failed */
+  int outcome = 0;
+
+  if(stream->fatal) {
+    snprintf(msg, sizeof(msg), "%s: %s", effective_url, stream->fatal);
+    outcome = -1;
+  }
+  else if(response_code && (response_code < 200 || response_code >= 300)) {
+    snprintf(msg, sizeof(msg), "%s: HTTP(S) status code %ld", effective_url, response_code);
+    outcome = response_code >= 500 ? 1 : -1;
+  }
+  else if(result != CURLE_OK) {
+    snprintf(msg, sizeof(msg), "curl: %s", *stream->error ? stream->error : curl_easy_strerror(result));
+    outcome = 1;
+  }
+
+  if(outcome)
+    stream_log(stream, msg);
+
+  if(!options.reconnect) {
+    if(outcome > 0 && is_connect_error(result) && stream->attempts++ < STREAM_CONNECT_RETRIES) {
+      stream_log(stream, "retrying...");
+      stream->connect_at = now_ms() + 3000;
+      return;
+    }
+  }
+  else if(outcome >= 0) {
+    /* an event cut off by the disconnect is sent again. */
+    sse_parser_reset(&stream->parser);
+
+    if(stream->received)
+      stream->attempts = 0;
+
+    long delay = reconnect_delay(stream);
+    stream->attempts++;
+
+    if(options.verbosity || stream->attempts > 1) {
+      snprintf(msg, sizeof(msg), "reconnecting in %ld ms, after event %.256s", delay,
+        stream->parser.last_id && *stream->parser.last_id ? stream->parser.last_id : "-");
+      stream_log(stream, msg);
+    }
+
+    stream->connect_at = now_ms() + delay;
+    return;
+  }
+
+  if(outcome)
+    stream->engine->failed++;
+
+  stream->engine->active--;
+}
+
+/*
+ * connect the streams that are due. Returns the msecs until the next
+ * one is due, or -1.
+ */
+static long streams_due(struct Engine* engine)
+{
+  long now = now_ms(), next = -1;
+  int i;
+
+  for(i = 0; i < engine->nstreams; ++i) {
+    struct Stream* stream = engine->streams[i];
+    if(stream->connect_at < 0)
+      continue;
+
+    if(stream->connect_at <= now) {
+      stream_connect(stream);
+      continue;
+    }
+
+    if(next < 0 || stream->connect_at - now < next)
+      next = stream->connect_at - now;
+  }
+
+  return next;
+}
+
+/*
+ * finish the streams whose connection ended.
+ */
+static void streams_check(struct Engine* engine)
+{
+  CURLMsg* msg;
+  int n;
+
+  while((msg = curl_multi_info_read(engine->multi, &n)) != 0) {
+    if(msg->msg != CURLMSG_DONE)
+      continue;
+
+    struct Stream* stream;
+    CURLcode result = msg->data.result;
+
+    curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char**) &stream);
+    stream_done(stream, result);
+  }
+}
+
+#ifdef __linux__
+
+/*
+ * curl tells which sockets to watch for what, and when to call it
+ * anyways; the sockets are watched via epoll.
+ */
+static int on_socket(CURL* curl, curl_socket_t fd, int what, void* userp, void* socketp)
+{
+  struct Engine* engine = userp;
+  struct epoll_event ev;
+
+  if(what == CURL_POLL_REMOVE) {
+    /* the socket may be closed already. */
+    epoll_ctl(engine->epfd, EPOLL_CTL_DEL, fd, 0);
+    return 0;
+  }
+
+  memset(&ev, 0, sizeof(ev));
+  ev.data.fd = fd;
+  ev.events = (what & CURL_POLL_IN ? EPOLLIN : 0) | (what & CURL_POLL_OUT ? EPOLLOUT : 0);
+
+  if(epoll_ctl(engine->epfd, EPOLL_CTL_MOD, fd, &ev) < 0 &&
+     (errno != ENOENT || epoll_ctl(engine->epfd, EPOLL_CTL_ADD, fd, &ev) < 0))
+    die("epoll_ctl");
+
+  return 0;
+}
+
+static int on_timer(CURLM* multi, long timeout_ms, void* userp)
+{
+  struct Engine* engine = userp;
+
+  engine->timer_at = timeout_ms < 0 ? -1 : now_ms() + timeout_ms;
+  return 0;
+}
+
+static void streams_poll_init(struct Engine* engine)
+{
+  engine->epfd = epoll_create1(EPOLL_CLOEXEC);
+  if(engine->epfd < 0)
+    die("epoll_create1");
+
+  curl_multi_setopt(engine->multi, CURLMOPT_SOCKETFUNCTION, on_socket);
+  curl_multi_setopt(engine->multi, CURLMOPT_SOCKETDATA, engine);
+  curl_multi_setopt(engine->multi, CURLMOPT_TIMERFUNCTION, on_timer);
+  curl_multi_setopt(engine->multi, CURLMOPT_TIMERDATA, engine);
+}
+
+/*
+ * wait up to \a timeout msecs - or, if that is -1, until curl wants to
+ * be called - and let curl handle what happened.
+ */
+static void streams_poll(struct Engine* engine, long timeout)
+{
+  struct epoll_event events[64];
+  int running, n, i;
+
+  if(engine->timer_at >= 0) {
+    long wait = engine->timer_at - now_ms();
+    if(wait < 0)
+      wait = 0;
+    if(timeout < 0 || wait < timeout)
+      timeout = wait;
+  }
+
+  n = epoll_wait(engine->epfd, events, 64, (int) timeout);
+  if(n < 0) {
+    if(errno == EINTR)
+      return;
+    die("epoll_wait");
+  }
+
+  for(i = 0; i < n; ++i) {
+    int flags = 0;
+    if(events[i].events & EPOLLIN)
+      flags |= CURL_CSELECT_IN;
+    if(events[i].events & EPOLLOUT)
+      flags |= CURL_CSELECT_OUT;
+    if(events[i].events & (EPOLLERR | EPOLLHUP))
+      flags |= CURL_CSELECT_ERR;
+
+    curl_multi_socket_action(engine->multi, events[i].data.fd, flags, &running);
+  }
+
+  /* the timer fires once; curl sets it again when needed. */
+  if(engine->timer_at >= 0 && engine->timer_at <= now_ms()) {
+    engine->timer_at = -1;
+    curl_multi_socket_action(engine->multi, CURL_SOCKET_TIMEOUT, 0, &running);
+  }
+}
+
+static void streams_poll_free(struct Engine* engine)
+{
+  close(engine->epfd);
+}
+
+#else
+
+static void streams_poll_init(struct Engine* engine)
+{
+}
+
+static void streams_poll(struct Engine* engine, long timeout)
+{
+  int running;
+
+  curl_multi_perform(engine->multi, &running);
+  curl_multi_poll(engine->multi, 0, 0, timeout < 0 ? 1000 : (int) timeout, 0);
+  curl_multi_perform(engine->multi, &running);
+}
+
+static void streams_poll_free(struct Engine* engine)
+{
+}
+
+#endif
+
+/*
+ * returns the tag of a stream that was not given one: the URL's
+ * streamID parameter, or the URL.
+ */
+static char* default_tag(const char* url)
+{
+  const char* query = strchr(url, '?');
+  const char* p = query;
+
+  while(p) {
+    const char* value = strseq(p + 1, "streamID=");
+    if(value)
+      return strndup(value, strcspn(value, "&#"));
+
+    p = strchr(p + 1, '&');
+  }
+
+  return strdup(url);
+}
+
+void streams_add(const char* spec)
+{
+  /* "<tag>=<url>"; a "=" after a ":", "/" or "?" belongs to the URL. */
+  const char* url = spec;
+  size_t tag_len = strcspn(spec, "=:/?");
+  char* tag = 0;
+
+  if(tag_len && spec[tag_len] == '=') {
+    tag = strndup(spec, tag_len);
+    url = spec + tag_len + 1;
+  }
+
+  if(!options.allow_insecure && strncmp(url, "https:", 6)) {
+    fprintf(stderr, "Insecure connections not allowed, use -i, if necessary.\n");
+    exit(1);
+  }
+
+  struct Stream* stream = calloc(1, sizeof(struct Stream));
+  streams = realloc(streams, (nstreams + 1) * sizeof(struct Stream*));
+  if(!stream || !streams)
+    die("malloc");
+
+  stream->url = strdup(url);
+  stream->tag = tag;
+  streams[nstreams++] = stream;
+}
+
+int streams_load(const char* path)
+{
+  FILE* file = fopen(path, "r");
+  if(!file)
+    die(path);
+
+  char line[8192];
+  int n = 0;
+
+  while(fgets(line, sizeof(line), file)) {
+    char* p = line;
+    char* end = line + strlen(line);
+
+    while(isspace(*p))
+      p++;
+    while(end > p && isspace(end[-1]))
+      *--end = 0;
+
+    if(!*p || *p == '#')
+      continue;
+
+    streams_add(p);
+    n++;
+  }
+
+  fclose(file);
+  return n;
+}
+
+/*
+ * read the streams of \a engine until they are done.
+ */
+static void* engine_run(void* arg)
+{
+  struct Engine* engine = arg;
+  int i;
+
+  if(options.threads > 1)
+    output_thread_init();
+
+  engine->multi = curl_multi_init();
+  engine->share = curl_share_init();
+  if(!engine->multi || !engine->share)
+    die("curl");
+
+  /* all handles are used by this thread only, so no locking is needed. */
+  curl_share_setopt(engine->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+
+  engine->timer_at = -1;
+  streams_poll_init(engine);
+
+  for(i = 0; i < engine->nstreams; ++i) {
+    struct Stream* stream = engine->streams[i];
+
+    sse_parser_init(&stream->parser);
+    stream->parser.max_data_size = options.max_event_size;
+    stream->parser.stream = stream->tag;
+
+    /* binary records are built from the parser's event views. */
+    if(options.format == FORMAT_BINARY)
+      stream->parser.on_event = binary_on_event;
+
+    stream->curl = curl_easy_init();
+    if(!stream->curl)
+      die("curl");
+
+    http_setup(stream->curl);
+    curl_easy_setopt(stream->curl, CURLOPT_URL, stream->url);
+    curl_easy_setopt(stream->curl, CURLOPT_ACCEPT_ENCODING, "");
+    curl_easy_setopt(stream->curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(stream->curl, CURLOPT_SHARE, engine->share);
+    curl_easy_setopt(stream->curl, CURLOPT_WRITEFUNCTION, on_data);
+    curl_easy_setopt(stream->curl, CURLOPT_WRITEDATA, stream);
+    curl_easy_setopt(stream->curl, CURLOPT_ERRORBUFFER, stream->error);
+    curl_easy_setopt(stream->curl, CURLOPT_PRIVATE, stream);
+
+    /* a stalled connection fails, and is retried like one; see stream_done(). */
+    if(options.idle_timeout > 0) {
+      curl_easy_setopt(stream->curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+      curl_easy_setopt(stream->curl, CURLOPT_LOW_SPEED_TIME, (long) options.idle_timeout);
+    }
+
+    stream_connect(stream);
+    engine->active++;
+  }
+
+  while(engine->active) {
+    streams_poll(engine, streams_due(engine));
+    streams_check(engine);
+  }
+
+  for(i = 0; i < engine->nstreams; ++i) {
+    struct Stream* stream = engine->streams[i];
+
+    engine->events += stream->parser.events;
+
+    curl_easy_cleanup(stream->curl);
+    curl_slist_free_all(stream->headers);
+    sse_parser_free(&stream->parser);
+  }
+
+  curl_multi_cleanup(engine->multi);
+  curl_share_cleanup(engine->share);
+  streams_poll_free(engine);
+
+  return 0;
+}
+
+int streams_run()
+{
+  int nengines = options.threads < nstreams ? options.threads : nstreams, i;
+  if(nengines < 1)
+    nengines = 1;
+
+  struct Engine* engines = calloc(nengines, sizeof(struct Engine));
+  struct Stream** dealt = calloc(nstreams, sizeof(struct Stream*));
+  if(!engines || !dealt)
+    die("calloc");
+
+  /* deal out the streams round robin; each engine gets a slice of dealt. */
+  for(i = 0; i < nengines; ++i) {
+    engines[i].streams = dealt + i * (nstreams / nengines) + (i < nstreams % nengines ? i : nstreams % nengines);
+    engines[i].seed = getpid() ^ time(0) ^ i;
+  }
+
+  for(i = 0; i < nstreams; ++i) {
+    struct Engine* engine = engines + i % nengines;
+    struct Stream* stream = streams[i];
+
+    if(!stream->tag && nstreams > 1)
+      stream->tag = default_tag(stream->url);
+
+    stream->engine = engine;
+    engine->streams[engine->nstreams++] = stream;
+  }
+
+  curl_global_init(CURL_GLOBAL_ALL);
+
+  if(nengines == 1) {
+    engine_run(engines);
+  }
+  else {
+    for(i = 0; i < nengines; ++i) {
+      if(pthread_create(&engines[i].thread, 0, engine_run, engines + i))
+        die("pthread_create");
+    }
+
+    for(i = 0; i < nengines; ++i)
+      pthread_join(engines[i].thread, 0);
+  }
+
+  curl_global_cleanup();
+
+  /* the merged counters */
+  unsigned long connects = 0, bytes = 0, events = 0;
+  int failed = 0;
+
+  for(i = 0; i < nengines; ++i) {
+    connects += engines[i].connects;
+    bytes += engines[i].bytes;
+    events += engines[i].events;
+    failed += engines[i].failed;
+  }
+
+  if(options.verbosity)
+    fprintf(stderr, "streams: %d on %d thread(s); %lu events, %lu byte, %lu connects, %d failed\n",
+      nstreams, nengines, events, bytes, connects, failed);
+
+  free(dealt);
+  free(engines);
+
+  return failed ? 1 : 0;
+}
@@ -4,114 +4,343 @@
  *
  * For more information see https://https://github.com/radiospiel/sse.
  */
-#include <jansson.h>
+#ifdef __linux__
+#define _GNU_SOURCE             /* vmsplice */
+#include <fcntl.h>
+#endif
+
+#include <errno.h>
+#include <sys/uio.h>
 #include "sse.h"
 #include "http.h"
+#include "json.h"
+
+void fprint_list(FILE* out, char** h)
+{
+  while(*h) {
+    fputs(*h++, out);
+    fputs("\n", out);
+  }
+}
 
-#if defined(__APPLE__) && defined(__MACH__)
+/*
+ * the JSON paths to extract from each event's data.
+ */
+static struct JSONMatcher json_matcher;
+static const char* json_labels[JSON_MAX_NODES];
+static int json_repeated[JSON_MAX_NODES];    // set for paths with a "[]" step
+
+#define DEFAULT_JSON_PATH "metrics.messages[].message"
 
-extern char **environ;
-static int execvpe(const char *program, char **argv, char **envp)
+/*
+ * add a JSON path to extract. The value is printed with a label: the 
+ * last member name in the path.
+ */
+int parse_json_add(const char* path)
 {
-    char **saved = environ;
-    environ = envp;
-    
-    int rc = execvp(program, argv);
-    
-    environ = saved;
-    return rc;
+  if(!json_matcher.nnodes)
+    json_matcher_init(&json_matcher);
+
+  int index = json_matcher_add(&json_matcher, path);
+  if(index < 0)
+    return -1;
+
+  const char* label = strrchr(path, '.');
+  json_labels[index] = strndup(label ? label + 1 : path, strcspn(label ? label + 1 : path, "["));
+  json_repeated[index] = strstr(path, "[]") != 0;
+  return 0;
 }
 
-#endif
+void parse_json_init()
+{
+  if(!json_matcher.nnodes)
+    parse_json_add(DEFAULT_JSON_PATH);
+}
 
-void fprint_list(FILE* out, char** h)
+const struct JSONMatcher* parse_json_matcher()
 {
-  while(*h) {
-    fputs(*h++, out);
-    fputs("\n", out);
+  return &json_matcher;
+}
+
+/*
+ * make room for \a len more bytes in \a buf, and return a pointer to
+ * the end of its contents.
+ */
+char* buffer_reserve(struct Buffer* buf, size_t len)
+{
+  if(buf->len + len > buf->size) {
+    size_t new_size = buf->size ? buf->size : 4096;
+    while(new_size < buf->len + len)
+      new_size *= 2;
+
+    buf->data = realloc(buf->data, new_size);
+    if(!buf->data)
+      die("realloc");
+    buf->size = new_size;
   }
+
+  return buf->data + buf->len;
+}
+
+void buffer_append(struct Buffer* buf, const char* data, size_t len)
+{
+  memcpy(buffer_reserve(buf, len), data, len);
+  buf->len += len;
 }
 
-void log_sse_event(char** headers, const char* data)
+/*
+ * append a JSON string with \a len bytes from \a s to \a out.
+ */
+void buffer_append_json_string(struct Buffer* out, const char* s, size_t len)
 {
-  char* event_id = 0;
-  char* event_type = 0;
-  char** p;
-  for(p = headers; (!event_id || !event_type) && *p; ++p) {
-    if(strncmp(*p, "ID=", 3) == 0)
-      event_id = *p + 3;
-    else if(strncmp(*p, "TYPE=", 5) == 0)
-      event_type = *p + 5;
+  char* p = buffer_reserve(out, 6 * len + 2);
+
+  *p++ = '"';
+  p += json_escape(s, len, p);
+  *p++ = '"';
+
+  out->len = p - out->data;
+}
+
+/*
+ * append the member name \a key to the NDJSON object in \a out.
+ */
+static void buffer_append_json_key(struct Buffer* out, const char* key)
+{
+  if(out->len && out->data[out->len - 1] != '{')
+    buffer_append(out, ",", 1);
+
+  buffer_append_json_string(out, key, strlen(key));
+  buffer_append(out, ":", 1);
+}
+
+struct JSONValue {
+  int         path;
+  const char* value;
+  size_t      len;
+};
+
+struct JSONBatch {
+  struct Buffer* out;
+  const char* event_id;
+  const char* stream;
+  int         found;
+  int         counts[JSON_MAX_NODES];   // number of records, per path
+  struct Buffer* values;                // NDJSON: struct JSONValues found
+};
+
+static void on_json_match(int path, const char* value, size_t len, void* context)
+{
+  struct JSONBatch* batch = context;
+  struct Buffer* out = batch->out;
+  const char* label = json_labels[path];
+  int index = batch->counts[path]++;
+
+  batch->found = 1;
+
+  /*
+   * In NDJSON the values of a path are printed together, so they are
+   * collected first.
+   */
+  if(options.format == FORMAT_NDJSON) {
+    struct JSONValue v = { path, value, len };
+    buffer_append(batch->values, (const char*) &v, sizeof(v));
+    return;
   }
 
-  fprintf(stderr, "EVENT %s:%s (%d byte)\n", event_type ? event_type : "event", 
-                      event_id ? event_id : "<none>", (int) strlen(data));
+  /* "<stream> " */
+  if(batch->stream) {
+    size_t stream_len = strlen(batch->stream);
+    char* p = buffer_reserve(out, stream_len + 1);
+    memcpy(p, batch->stream, stream_len);
+    p[stream_len] = ' ';
+    out->len += stream_len + 1;
+  }
+
+  /* "<id> <index> " */
+  if(options.tag_records) {
+    const char* id = batch->event_id ? batch->event_id : "-";
+    buffer_reserve(out, strlen(id) + 24);
+    out->len += sprintf(out->data + out->len, "%s %d ", id, index);
+  }
+
+  /* "<label>: <value>\n" */
+  size_t label_len = strlen(label);
+  char* p = buffer_reserve(out, label_len + len + 3);
+
+  memcpy(p, label, label_len);
+  p += label_len;
+  *p++ = ':';
+  *p++ = ' ';
+  p += json_unescape(value, len, p);
+  *p++ = '\n';
+
+  out->len = p - out->data;
 }
 
-void parse_json(const char* data)
+/*
+ * append the collected values to the NDJSON object in \a out: a path
+ * with a "[]" step as an array, other paths as a single value.
+ */
+static void write_json_values(struct JSONBatch* batch)
 {
-  json_t *root = NULL;
-  json_error_t error;
-  root = json_loads(data, 0, &error);
-  json_t *metrics;
-  json_t *messages;
-  json_t *msg_array_0;
-  json_t *msg;
-  const char *msg_str;
+  struct Buffer* out = batch->out;
+  const struct JSONValue* values = (const struct JSONValue*) batch->values->data;
+  size_t nvalues = batch->values->len / sizeof(struct JSONValue);
+  int path;
+
+  for(path = 0; path < json_matcher.npaths; ++path) {
+    if(!batch->counts[path] && !json_repeated[path])
+      continue;
+
+    buffer_append_json_key(out, json_labels[path]);
+    if(json_repeated[path])
+      buffer_append(out, "[", 1);
+
+    size_t i;
+    int n = 0;
+    for(i = 0; i < nvalues; ++i) {
+      if(values[i].path != path)
+        continue;
+
+      if(n++)
+        buffer_append(out, ",", 1);
+
+      char* p = buffer_reserve(out, values[i].len);
+      out->len += json_compact(values[i].value, values[i].len, p);
 
-  metrics  = json_object_get(root, "metrics");
-  if(!json_is_object(metrics))
-  {
-      fprintf(stderr, "error: metrics is not a json object\n");
+      if(!json_repeated[path])
+        break;
+    }
+
+    if(json_repeated[path])
+      buffer_append(out, "]", 1);
   }
+}
 
-  messages = json_object_get(metrics, "messages");
-  if(!json_is_array(messages))
-  {
-      fprintf(stderr, "error: messages is not a json array\n");
+void parse_json(const char* data, const char* event_id, const char* stream, struct Buffer* out)
+{
+  static __thread struct Buffer values;
+
+  struct JSONBatch batch;
+  memset(&batch, 0, sizeof(batch));
+  batch.out = out;
+  batch.event_id = event_id;
+  batch.stream = stream;
+  batch.values = &values;
+  values.len = 0;
+
+  if(json_match(&json_matcher, data, strlen(data), on_json_match, &batch) < 0)
+    fprintf(stderr, "error: invalid JSON\n");
+  else if(!batch.found)
+    fprintf(stderr, "error: no JSON path found in event data\n");
+
+  if(options.format == FORMAT_NDJSON) {
+    write_json_values(&batch);
+    buffer_append(out, "}\n", 2);
   }
-  msg_array_0 = json_array_get(messages, 0);
+}
 
-  if(!json_is_object(msg_array_0))
-  {
-      fprintf(stderr, "error: first element of messages is not a json object\n");
+/*
+ * append the event as a command frame to \a out: "SSE_NAME=value" lines,
+ * the data length, an empty line, and the data.
+ */
+void format_frame_header(char** headers, size_t data_len, struct Buffer* out)
+{
+  for(; *headers; ++headers) {
+    buffer_append(out, "SSE_", 4);
+    buffer_append(out, *headers, strlen(*headers));
+    buffer_append(out, "\n", 1);
   }
-  msg = json_object_get(msg_array_0, "message");
 
-  /* now print the first element of the messages array as a string */
-  msg_str = json_string_value(msg);
-  printf("message: %s\n", msg_str);
+  char* p = buffer_reserve(out, 48);
+  out->len += sprintf(p, "SSE_DATA_LENGTH=%lu\n\n", (unsigned long) data_len);
 }
 
-//TODO: transform data to json here?
-// seems that the on_sse_event is called in flush function after a
-// buffering and parsing period with flex
-// call sequence: main -> sse_main -> http -> on_data callback -> parse_sse
-void on_sse_event(char** headers, const char* data, const char* reply_url)
+void format_frame(char** headers, const char* data, struct Buffer* out)
 {
-  char* result = 0;
-  
-  /* print out parsed data -- NOT JSON yet */
-  fprint_list(stdout, headers);
-  fputs(data, stdout);
-  fputs("\n\n", stdout);
+  size_t data_len = strlen(data);
+
+  format_frame_header(headers, data_len, out);
+  buffer_append(out, data, data_len);
+}
 
-  /* example of parsing and converting to json */
-  parse_json(data);
+/*
+ * append the event's headers and data to \a out, unless JSON paths were
+ * selected.
+ */
+void format_event(char** headers, const char** values, const char* data, struct Buffer* out)
+{
+  if(options.format == FORMAT_NDJSON) {
+    buffer_append(out, "{", 1);
+
+    if(values[SSE_FIELD_STREAM]) {
+      buffer_append_json_key(out, "stream");
+      buffer_append_json_string(out, values[SSE_FIELD_STREAM], strlen(values[SSE_FIELD_STREAM]));
+    }
+    if(values[SSE_FIELD_ID]) {
+      buffer_append_json_key(out, "id");
+      buffer_append_json_string(out, values[SSE_FIELD_ID], strlen(values[SSE_FIELD_ID]));
+    }
+    if(values[SSE_FIELD_EVENT]) {
+      buffer_append_json_key(out, "event");
+      buffer_append_json_string(out, values[SSE_FIELD_EVENT], strlen(values[SSE_FIELD_EVENT]));
+    }
+    if(!options.json_paths) {
+      buffer_append_json_key(out, "data");
+      buffer_append_json_string(out, data, strlen(data));
+    }
+    return;
+  }
 
-  if(reply_url) {
-    printf("REPLY URL\n");
-    char* body = result ? result : "";
-    const char* reply_headers[] = {
-      "Content-Type:",
-      NULL
-    };
+  if(options.json_paths)
+    return;
 
-    fprintf(stderr, "REPLY %s (%d byte)\n", reply_url, (int) strlen(body));
-    http(HTTP_POST, reply_url, reply_headers, body, strlen(body), http_ignore_data, 0);
+  while(*headers) {
+    buffer_append(out, *headers, strlen(*headers));
+    buffer_append(out, "\n", 1);
+    headers++;
   }
 
-  free(result);
+  buffer_append(out, data, strlen(data));
+  buffer_append(out, "\n\n", 2);
+}
+
+/*
+ * called by the parser for each complete event, unless it has an
+ * on_event callback. Call sequence: streams_run -> on_data (streams.c)
+ * -> sse_parser_feed -> flush (parse-sse.c) -> on_sse_event.
+ */
+void on_sse_event(char** headers, const char** values, const char* data, const char* reply_url)
+{
+  /*
+   * hand the event to the command, or print out parsed data and the
+   * extracted JSON records. With decode workers the JSON is extracted
+   * in the background.
+   */
+  if(options.command) {
+    if(options.command_workers)
+      workers_submit(headers, values, data, reply_url);
+    else
+      spawn_submit(headers, values, data, reply_url);
+    return;
+  }
+
+  if(options.decode_workers) {
+    decode_pool_submit(headers, values, data);
+  }
+  else {
+    static __thread struct Buffer out;
+    out.len = 0;
+
+    format_event(headers, values, data, &out);
+    parse_json(data, values[SSE_FIELD_ID], values[SSE_FIELD_STREAM], &out);
+
+    output_write(values[SSE_FIELD_EVENT], out.data, out.len);
+  }
+
+  if(reply_url)
+    send_reply(reply_url, values[SSE_FIELD_ID], "", 0);
 }
 
 /*
@@ -132,43 +361,52 @@ int write_all(int fd, const char* data, unsigned dataLen) {
 }
 
 /*
- * read data from fd handle, return a malloced area in the pResult 
- * buffer - this must be freed by the caller - and returns the number
- * of bytes read.
+ * write all iovcnt buffers in iov to the fd handle.
  */
-int read_all(int fd, char** pResult, size_t limit) {
-  char buf[8192]; 
-  int length = 0;
-  
-  *pResult = 0;
-  
-  while(1) {
-    size_t bytes_to_read = limit ? limit - length : sizeof(buf);
-    if(!bytes_to_read) break;
-    
-    int bytes_read = read(fd, buf, bytes_to_read);
-
-    if(bytes_read < 0) {
-      free(*pResult);
-      *pResult = 0;
+int writev_all(int fd, struct iovec* iov, int iovcnt) {
+  while(iovcnt > 0) {
+    ssize_t written = writev(fd, iov, iovcnt);
+    if(written < 0) {
+      if(errno == EINTR) continue;
       return -1;
     }
 
-    if(bytes_read > 0) {
-      *pResult = realloc(*pResult, length + bytes_read + 1);
-
-      memcpy(*pResult + length, buf, bytes_read);
-      length += bytes_read;
+    while(iovcnt > 0 && (size_t) written >= iov->iov_len) {
+      written -= iov->iov_len;
+      ++iov, --iovcnt;
     }
 
-    if(bytes_read == 0)
-      break;
+    if(iovcnt > 0) {
+      iov->iov_base = (char*) iov->iov_base + written;
+      iov->iov_len -= written;
+    }
   }
 
-  if(*pResult) {
-    (*pResult)[length] = 0;
+  return 0;
+}
+
+/*
+ * write up to len bytes from data to the non-blocking pipe fd, without
+ * waiting. Larger buffers are not copied, but spliced into the pipe with
+ * vmsplice(2): the pipe then refers to the caller's pages, which must
+ * stay allocated and unchanged until the reader has read them. Where
+ * vmsplice is not available, this falls back to write(2).
+ */
+ssize_t pipe_write(int fd, const char* data, size_t len) {
+#ifdef __linux__
+  static int no_vmsplice = 0;
+
+  if(len >= SPLICE_MIN && !no_vmsplice) {
+    struct iovec iov = { (void*) data, len };
+    ssize_t n = vmsplice(fd, &iov, 1, SPLICE_F_NONBLOCK);
+    if(n >= 0 || (errno != EINVAL && errno != ENOSYS))
+      return n;
+
+    no_vmsplice = 1;
   }
-  return length;
+#endif
+
+  return write(fd, data, len);
 }
 
 void die(const char* msg) {
@@ -0,0 +1,435 @@
+/*
+ * This file is part of the sse package, copyright (c) 2011, 2012, @radiospiel.
+ * It is copyrighted under the terms of the modified BSD license, see LICENSE.BSD.
+ *
+ * For more information see https://https://github.com/radiospiel/sse.
+ */
+
+/*
+ * Persistent command workers (-w <n>).
+ *
+ * The <command> is started <n> times up front, and each instance
+ * handles one event after the other. An event is written to an idle
+ * worker's stdin as a frame:
+ *
+ *   SSE_EVENT=<type>
+ *   SSE_ID=<id>
+ *   ...                           (one line per event attribute)
+ *   SSE_DATA_LENGTH=<n>
+ *                                 (an empty line)
+ *   <n bytes of data>
+ *
+ * The worker answers on its stdout with a line holding the length of
+ * its result, followed by the result:
+ *
+ *   <n>
+ *   <n bytes of result>
+ *
+ * If the event had a reply URL the result is posted there; otherwise it
+ * is written to the output. A worker that dies is restarted.
+ *
+ * Events may be submitted by several threads (see --threads); they take
+ * turns. An event goes to an idle worker: its frame is copied into the
+ * worker's input buffer, and written to the worker's stdin as far as the
+ * pipe takes it. The workers thread writes the rest, and reads the
+ * workers' answers, so a result is passed on as soon as it is complete,
+ * and a slow worker does not hold up the other workers, nor the streams.
+ *
+ * The frame is written, not spliced into the pipe as spawn.c does: the
+ * input buffer is reused for the worker's next event, possibly before
+ * the worker has read all of it.
+ */
+
+#include <pthread.h>
+#include <poll.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include "sse.h"
+
+struct Worker {
+  pid_t         pid;
+  int           in;             // the worker's stdin
+  int           out;            // the worker's stdout
+  int           busy;           // set while the worker handles an event
+  char*         event_id;       // id of the event being handled
+  char*         event_type;     // type of the event being handled
+  char*         reply_url;      // reply URL of the event being handled
+  struct Buffer input;          // the frame of the event being handled
+  size_t        written;        // bytes of input written to stdin
+  struct Buffer response;       // response read so far
+  size_t        header_len;     // length of the response's length line, or 0
+  size_t        expected;       // length of the response's result
+  size_t        dropped;        // bytes of the result read past RESPONSE_LIMIT
+};
+
+static struct Worker* workers = 0;
+static int nworkers = 0;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  idle = PTHREAD_COND_INITIALIZER;   // signalled when a worker gets idle
+static int wake[2];             // a pipe to wake up the workers thread
+static int stopping = 0;        // set by workers_drain; ends the workers thread
+
+/*
+ * create a pipe which is not inherited by other workers.
+ */
+static void pipe_cloexec(int fds[2])
+{
+  if(pipe(fds) < 0)
+    die("pipe");
+
+  fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+  fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+}
+
+static void worker_start(struct Worker* worker)
+{
+  int in[2], out[2];
+
+  pipe_cloexec(in);
+  pipe_cloexec(out);
+
+  pid_t pid = fork();
+  if(pid < 0)
+    die("fork");
+
+  if(!pid) {
+    dup2(in[0], 0);
+    dup2(out[1], 1);
+    close(in[0]); close(in[1]);
+    close(out[0]); close(out[1]);
+
+    execvp(options.command[0], options.command);
+    _die(options.command[0]);
+  }
+
+  close(in[0]);
+  close(out[1]);
+
+  fcntl(in[1], F_SETFL, O_NONBLOCK);
+  fcntl(out[0], F_SETFL, O_NONBLOCK);
+
+  worker->pid = pid;
+  worker->in = in[1];
+  worker->out = out[0];
+  worker->busy = 0;
+  worker->input.len = worker->written = 0;
+  worker->response.len = 0;
+  worker->header_len = 0;
+  worker->dropped = 0;
+}
+
+static void worker_stop(struct Worker* worker)
+{
+  int status;
+
+  close(worker->in);
+  close(worker->out);
+  waitpid(worker->pid, &status, 0);
+
+  if(options.verbosity && (!WIFEXITED(status) || WEXITSTATUS(status)))
+    fprintf(stderr, "worker %d exited with status %d\n", (int) worker->pid, status);
+}
+
+/*
+ * forget about the event \a worker was handling.
+ */
+static void worker_idle(struct Worker* worker)
+{
+  free(worker->event_id);
+  free(worker->event_type);
+  free(worker->reply_url);
+  worker->event_id = worker->event_type = worker->reply_url = 0;
+
+  worker->busy = 0;
+  worker->input.len = worker->written = 0;
+  worker->response.len = 0;
+  worker->header_len = 0;
+  worker->dropped = 0;
+
+  pthread_cond_broadcast(&idle);
+}
+
+/*
+ * a worker failed; restart it. Its event is lost. The worker might still
+ * be running, so it is killed first: waiting for it to exit on its own
+ * could block forever.
+ */
+static void worker_restart(struct Worker* worker, const char* reason)
+{
+  fprintf(stderr, "worker %d %s, restarting it\n", (int) worker->pid, reason);
+
+  kill(worker->pid, SIGKILL);
+  worker_idle(worker);
+  worker_stop(worker);
+  worker_start(worker);
+}
+
+/*
+ * pass on the result of \a worker's event.
+ */
+static void worker_done(struct Worker* worker)
+{
+  const char* result = worker->response.data + worker->header_len;
+  size_t len = worker->expected;
+
+  if(len > RESPONSE_LIMIT) {
+    fprintf(stderr, "worker %d: result exceeds %d byte, truncating it\n", (int) worker->pid, RESPONSE_LIMIT);
+    len = RESPONSE_LIMIT;
+  }
+
+  if(worker->reply_url)
+    send_reply(worker->reply_url, worker->event_id, result, len);
+  else
+    output_write(worker->event_type, result, len);
+
+  worker_idle(worker);
+}
+
+/*
+ * write more of \a worker's input to its stdin. Returns -1 if the worker
+ * does not take its input.
+ */
+static int worker_write(struct Worker* worker)
+{
+  while(worker->written < worker->input.len) {
+    ssize_t n = write(worker->in, worker->input.data + worker->written, worker->input.len - worker->written);
+    if(n < 0) {
+      if(errno == EINTR)
+        continue;
+      return errno == EAGAIN ? 0 : -1;
+    }
+    worker->written += n;
+  }
+
+  return 0;
+}
+
+/*
+ * read what \a worker has written.
+ */
+static void worker_read(struct Worker* worker)
+{
+  struct Buffer* response = &worker->response;
+  ssize_t n = read(worker->out, buffer_reserve(response, 8192), 8192);
+
+  if(n < 0 && (errno == EINTR || errno == EAGAIN))
+    return;
+  if(n <= 0) {
+    worker_restart(worker, "exited");
+    return;
+  }
+
+  if(!worker->busy) {
+    fprintf(stderr, "worker %d wrote %d byte out of turn, ignoring it\n", (int) worker->pid, (int) n);
+    return;
+  }
+
+  response->len += n;
+
+  /* the length line */
+  if(!worker->header_len) {
+    char* nl = memchr(response->data, '\n', response->len);
+    if(!nl) {
+      if(response->len > 32)
+        worker_restart(worker, "sent an invalid response");
+      return;
+    }
+
+    char* end;
+    worker->expected = strtoul(response->data, &end, 10);
+    if(end != nl || end == response->data) {
+      worker_restart(worker, "sent an invalid response");
+      return;
+    }
+
+    worker->header_len = nl + 1 - response->data;
+  }
+
+  /*
+   * keep at most RESPONSE_LIMIT bytes of the result (see worker_done);
+   * the rest is read and dropped.
+   */
+  size_t limit = worker->header_len + RESPONSE_LIMIT;
+  if(response->len > limit) {
+    worker->dropped += response->len - limit;
+    response->len = limit;
+  }
+
+  if(response->len + worker->dropped >= worker->header_len + worker->expected)
+    worker_done(worker);
+}
+
+/*
+ * wake up the workers thread, to write a new event's input. Must be
+ * called with the lock held.
+ */
+static void workers_wake()
+{
+  if(write(wake[1], "", 1) < 0 && errno != EAGAIN)
+    die("write");
+}
+
+/*
+ * wait for the workers, write their input and read what they write.
+ * Must be called with the lock held; it is released while waiting. Only
+ * the workers thread starts and stops workers while the workers run.
+ */
+static void workers_poll()
+{
+  int npolled = nworkers;
+  struct pollfd fds[2 * npolled + 1];
+  pid_t pids[npolled];
+  int i;
+
+  /* poll(2) skips entries with a negative fd. */
+  for(i = 0; i < npolled; ++i) {
+    struct Worker* worker = workers + i;
+
+    pids[i] = worker->pid;
+    fds[2 * i].fd = worker->out;
+    fds[2 * i].events = POLLIN;
+    fds[2 * i + 1].fd = worker->written < worker->input.len ? worker->in : -1;
+    fds[2 * i + 1].events = POLLOUT;
+  }
+
+  fds[2 * npolled].fd = wake[0];
+  fds[2 * npolled].events = POLLIN;
+
+  for(i = 0; i <= 2 * npolled; ++i)
+    fds[i].revents = 0;
+
+  pthread_mutex_unlock(&lock);
+  int rc = poll(fds, 2 * npolled + 1, -1);
+  pthread_mutex_lock(&lock);
+
+  if(rc < 0 && errno != EINTR)
+    die("poll");
+
+  if(fds[2 * npolled].revents) {
+    char buf[64];
+    while(read(wake[0], buf, sizeof(buf)) > 0)
+      ;
+  }
+
+  /* the workers might have been stopped meanwhile, see workers_drain. */
+  for(i = 0; i < npolled && i < nworkers; ++i) {
+    struct Worker* worker = workers + i;
+
+    if(fds[2 * i + 1].revents && worker_write(worker) < 0)
+      worker_restart(worker, "does not read its input");
+
+    /* a restarted worker has new pipes. */
+    if(worker->pid == pids[i] && fds[2 * i].revents)
+      worker_read(worker);
+  }
+}
+
+/*
+ * the workers thread feeds the workers, and passes on their results,
+ * until workers_drain stopped them.
+ */
+static void* workers_thread(void* arg)
+{
+  pthread_mutex_lock(&lock);
+
+  while(!stopping)
+    workers_poll();
+
+  pthread_mutex_unlock(&lock);
+  return 0;
+}
+
+void workers_start(int n)
+{
+  signal(SIGPIPE, SIG_IGN);
+
+  workers = calloc(n, sizeof(struct Worker));
+  if(!workers)
+    die("calloc");
+
+  for(nworkers = 0; nworkers < n; ++nworkers)
+    worker_start(workers + nworkers);
+
+  if(pipe(wake) < 0)
+    die("pipe");
+
+  int i;
+  for(i = 0; i < 2; ++i) {
+    fcntl(wake[i], F_SETFD, FD_CLOEXEC);
+    fcntl(wake[i], F_SETFL, O_NONBLOCK);
+  }
+
+  pthread_t thread;
+  if(pthread_create(&thread, 0, workers_thread, 0))
+    die("pthread_create");
+  pthread_detach(thread);
+
+  atexit(workers_drain);
+}
+
+void workers_submit(char** headers, const char** values, const char* data, const char* reply_url)
+{
+  struct Worker* worker = 0;
+  int i;
+
+  pthread_mutex_lock(&lock);
+
+  /* wait for an idle worker. */
+  while(1) {
+    for(i = 0; i < nworkers && workers[i].busy; ++i)
+      ;
+
+    if(i < nworkers) {
+      worker = workers + i;
+      break;
+    }
+
+    pthread_cond_wait(&idle, &lock);
+  }
+
+  worker->busy = 1;
+  worker->event_id = values[SSE_FIELD_ID] ? strdup(values[SSE_FIELD_ID]) : 0;
+  worker->event_type = values[SSE_FIELD_EVENT] ? strdup(values[SSE_FIELD_EVENT]) : 0;
+  worker->reply_url = reply_url ? strdup(reply_url) : 0;
+
+  worker->input.len = worker->written = 0;
+  format_frame(headers, data, &worker->input);
+
+  /*
+   * write what the pipe takes right away; the rest, or a failure, is
+   * left to the workers thread.
+   */
+  if(worker_write(worker) < 0 || worker->written < worker->input.len)
+    workers_wake();
+
+  pthread_mutex_unlock(&lock);
+}
+
+void workers_drain()
+{
+  int i;
+
+  pthread_mutex_lock(&lock);
+
+  while(1) {
+    for(i = 0; i < nworkers && !workers[i].busy; ++i)
+      ;
+
+    if(i == nworkers)
+      break;
+
+    pthread_cond_wait(&idle, &lock);
+  }
+
+  for(i = 0; i < nworkers; ++i)
+    worker_stop(workers + i);
+
+  nworkers = 0;
+  stopping = 1;
+  workers_wake();
+
+  pthread_mutex_unlock(&lock);
+}
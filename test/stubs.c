@@ -0,0 +1,31 @@
+/*
+ * This file is part of the sse package, copyright (c) 2011, 2012, @radiospiel.
+ * It is copyrighted under the terms of the modified BSD license, see LICENSE.BSD.
+ *
+ * For more information see https://https://github.com/radiospiel/sse.
+ */
+
+/*
+ * The rest of sse, for the tests: the options, and functions that do
+ * nothing. They are weak, so a test that links the real one, or wants
+ * to see what is passed in, just defines its own.
+ */
+
+#include "sse.h"
+
+DEFINE_OBJECT(Options, options);
+
+#define WEAK __attribute__((weak))
+
+WEAK void die(const char* msg)
+{
+  perror(msg);
+  exit(1);
+}
+
+WEAK void output_header(const char* data, size_t len) {}
+WEAK void output_write(const char* type, const char* data, size_t len) {}
+WEAK void send_reply(const char* reply_url, const char* event_id, const char* body, size_t len) {}
+WEAK void decode_pool_submit(char** headers, const char** values, const char* data) {}
+WEAK void workers_submit(char** headers, const char** values, const char* data, const char* reply_url) {}
+WEAK void spawn_submit(char** headers, const char** values, const char* data, const char* reply_url) {}
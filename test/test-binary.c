@@ -0,0 +1,204 @@
+/*
+ * This file is part of the sse package, copyright (c) 2011, 2012, @radiospiel.
+ * It is copyrighted under the terms of the modified BSD license, see LICENSE.BSD.
+ *
+ * For more information see https://https://github.com/radiospiel/sse.
+ */
+
+/*
+ * Tests for the binary output format; run via "make test".
+ *
+ * A stream is parsed and written in the binary format, as with
+ * "--format binary", and read back with the reader from
+ * bin/libsse-reader.a, in memory and from a memory-mapped file.
+ */
+
+#include <sys/mman.h>
+#include "test.h"
+#include "sse-binary.h"
+
+/* === recording output ========================================== */
+
+static struct Buffer out;   // the output
+static int replies;         // number of send_reply calls
+
+void output_header(const char* data, size_t len)
+{
+  buffer_append(&out, data, len);
+}
+
+void output_write(const char* type, const char* data, size_t len)
+{
+  buffer_append(&out, data, len);
+}
+
+void send_reply(const char* reply_url, const char* event_id, const char* body, size_t len)
+{
+  replies++;
+}
+
+
+/* === tests ======================================================= */
+
+static const char stream[] =
+  "id: 1\n"
+  "event: log\n"
+  "data: {\"metrics\": {\"messages\": [{\"message\": \"a\\\"b\"}, {\"message\": 2}]}}\n"
+  "\n"
+  "data: {\"metrics\":\n"
+  "data:  {\"messages\": [{\"message\": \"\\u00e9\"}]}}\n"
+  "reply: http://localhost/reply\n"
+  "\n"
+  "id: 3\n"
+  "data: not json\n"
+  "\n";
+
+static void check_string(const struct SSEBinaryRecord* record, const struct SSEBinarySlice* slice,
+                         const char* expected)
+{
+  const char* s = sse_record_string(record, slice);
+
+  if(!expected) {
+    check(!s, "string '%s' should be absent", s);
+    return;
+  }
+
+  check(s && slice->len == strlen(expected) && !memcmp(s, expected, slice->len) && !s[slice->len],
+        "expected '%s', got '%.*s'", expected, s ? (int) slice->len : 6, s ? s : "(null)");
+}
+
+static void check_records(struct SSEReader* reader)
+{
+  const struct SSEBinaryRecord* r;
+
+  check(reader->npaths == 1 && !strcmp(reader->paths[0], "metrics.messages[].message"), "paths");
+
+  r = sse_reader_next(reader);
+  check(r && r->nvalues == 2, "first record");
+  if(r) {
+    check_string(r, &r->id, "1");
+    check_string(r, &r->event, "log");
+    check_string(r, &r->data, "{\"metrics\": {\"messages\": [{\"message\": \"a\\\"b\"}, {\"message\": 2}]}}");
+    check_string(r, &r->values[0].value, "a\"b");
+    check_string(r, &r->values[1].value, "2");
+    check(r->values[1].path == 0 && r->values[1].index == 1, "second value");
+    check(r->size % 8 == 0, "record size %u", r->size);
+  }
+
+  r = sse_reader_next(reader);
+  check(r && r->nvalues == 1, "second record");
+  if(r) {
+    check_string(r, &r->id, NULL);
+    check_string(r, &r->event, NULL);
+    check_string(r, &r->data, "{\"metrics\":\n {\"messages\": [{\"message\": \"\\u00e9\"}]}}");
+    check_string(r, &r->values[0].value, "\xc3\xa9");
+  }
+
+  r = sse_reader_next(reader);
+  check(r && r->nvalues == 0, "third record");
+  if(r) {
+    check_string(r, &r->id, "3");
+    check_string(r, &r->data, "not json");
+  }
+
+  check(!sse_reader_next(reader), "extra record");
+}
+
+static void write_stream()
+{
+  struct SSEParser parser;
+
+  out.len = 0;
+  replies = 0;
+
+  sse_parser_init(&parser);
+  parser.on_event = binary_on_event;
+
+  binary_init();
+  sse_parser_feed(&parser, stream, sizeof(stream) - 1);
+  sse_parser_free(&parser);
+
+  check(replies == 1, "%d replies", replies);
+}
+
+static void test_round_trip()
+{
+  struct SSEReader reader;
+
+  write_stream();
+
+  check(sse_reader_init(&reader, out.data, out.len) == 0, "invalid header");
+  check_records(&reader);
+
+  /* a truncated record ends the data */
+  check(sse_reader_init(&reader, out.data, out.len - 8) == 0, "invalid header");
+  check(sse_reader_next(&reader) && sse_reader_next(&reader), "records before the truncated one");
+  check(!sse_reader_next(&reader), "truncated record");
+
+  check(sse_reader_init(&reader, out.data, out.len) == 0, "invalid header");
+
+  /* as does a malformed one */
+  char* copy = malloc(out.len);
+  memcpy(copy, out.data, out.len);
+  ((struct SSEBinaryRecord*) (copy + reader.pos))->size = 3;
+
+  check(sse_reader_init(&reader, copy, out.len) == 0, "invalid header");
+  check(!sse_reader_next(&reader), "malformed record");
+  free(copy);
+
+  check(sse_reader_init(&reader, "SSEB", 4) == -1, "truncated header");
+}
+
+static void test_mapped_file()
+{
+  struct SSEReader reader;
+  char path[] = "/tmp/test-binary.XXXXXX";
+
+  write_stream();
+
+  int fd = mkstemp(path);
+  check(fd >= 0 && write_all(fd, out.data, out.len) == (int) out.len, "writing %s", path);
+  close(fd);
+
+  check(sse_reader_open(&reader, path) == 0, "cannot open %s", path);
+  check(reader.mapped, "not mapped");
+  check_records(&reader);
+  sse_reader_close(&reader);
+
+  unlink(path);
+}
+
+/*
+ * an event that does not fit into a 32 bit record is dropped. Its data
+ * is never touched beyond the first byte, so it needs no memory.
+ */
+static void test_oversize_event()
+{
+  size_t len = (size_t) UINT32_MAX + 1;
+  char* data = mmap(0, len, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if(data == MAP_FAILED) {
+    fprintf(stderr, "cannot map %lu bytes, skipping test_oversize_event\n", (unsigned long) len);
+    return;
+  }
+
+  struct SSEField field = { SSE_FIELD_DATA, { "data", 4 }, { data, len } };
+  struct SSEEvent event = { &field, 1, { 0 } };
+  event.slots[SSE_FIELD_DATA] = 1;
+
+  out.len = 0;
+  binary_on_event(&event, 0);
+  check(out.len == 0, "oversize event written");
+
+  munmap(data, len);
+}
+
+int main()
+{
+  parse_json_init();
+
+  test_round_trip();
+  test_mapped_file();
+  test_oversize_event();
+
+  return test_done("binary");
+}
@@ -0,0 +1,193 @@
+/*
+ * This file is part of the sse package, copyright (c) 2011, 2012, @radiospiel.
+ * It is copyrighted under the terms of the modified BSD license, see LICENSE.BSD.
+ *
+ * For more information see https://https://github.com/radiospiel/sse.
+ */
+
+/*
+ * Tests for the JSON matcher and the string helpers; run via "make test".
+ *
+ * Matches are written down as "<path>=<raw value>;" and compared against
+ * the expected text.
+ */
+
+#include "test.h"
+#include "json.h"
+
+/* === recording matches =========================================== */
+
+static char matches[4096];
+
+static void on_match(int path, const char* value, size_t len, void* context)
+{
+  size_t used = strlen(matches);
+  snprintf(matches + used, sizeof(matches) - used, "%d=%.*s;", path, (int) len, value);
+}
+
+/*
+ * match \a json against \a paths (a NULL terminated list), and compare
+ * the matches against \a expected. Returns json_match's result.
+ */
+static int match(const char** paths, const char* json, const char* expected)
+{
+  struct JSONMatcher matcher;
+  json_matcher_init(&matcher);
+
+  for(; *paths; ++paths)
+    check(json_matcher_add(&matcher, *paths) >= 0, "invalid path %s", *paths);
+
+  matches[0] = 0;
+  int r = json_match(&matcher, json, strlen(json), on_match, NULL);
+
+  check(!strcmp(matches, expected), "%s:\n  expected %s\n  got      %s", json, expected, matches);
+  return r;
+}
+
+/* === tests ======================================================= */
+
+static void test_default_path()
+{
+  const char* paths[] = { "metrics.messages[].message", NULL };
+
+  int r = match(paths,
+    "{\"id\": 1, \"metrics\": {\"name\": \"{[\\\"\", \"messages\": ["
+      "{\"message\": \"one\", \"x\": [1, {\"message\": 0}]},"
+      "{\"level\": 2},"
+      "{\"message\": {\"a\": [1, 2]}}"
+    "]}, \"message\": \"not me\"}",
+    "0=\"one\";0={\"a\": [1, 2]};");
+  check(r == 0, "json_match returned %d", r);
+
+  r = match(paths, "{\"metrics\": {\"messages\": []}}", "");
+  check(r == 0, "json_match returned %d", r);
+
+  r = match(paths, "[{\"metrics\": 1}, \"metrics\"]", "");
+  check(r == 0, "json_match returned %d", r);
+}
+
+/*
+ * an element matched by both an index and a "[]" step is scanned twice,
+ * first for the index.
+ */
+static void test_nested_wildcards()
+{
+  const char* paths[] = { "a[].b[].c", "a[1].d", "e", NULL };
+
+  int r = match(paths,
+    "{\"a\": [{\"b\": [{\"c\": 1}, {\"c\": 2}], \"d\": true},"
+            "{\"b\": [{\"c\": \"3\"}], \"d\": null},"
+            "{\"b\": []}],"
+    " \"e\": -1.5e3}",
+    "0=1;0=2;1=null;0=\"3\";2=-1.5e3;");
+  check(r == 0, "json_match returned %d", r);
+}
+
+static void test_escaped_keys_and_values()
+{
+  const char* paths[] = { "s", NULL };
+
+  int r = match(paths,
+    "{\"s\\\"\": 1, \"t\": \"}\\\\\", \"s\": \"a\\\"b\\\\\\u00e9\"}",
+    "0=\"a\\\"b\\\\\\u00e9\";");
+  check(r == 0, "json_match returned %d", r);
+}
+
+/*
+ * Scanning stops once all paths are found, so only the text up to there
+ * is checked.
+ */
+static void test_invalid_json()
+{
+  const char* paths[] = { "a[].b", NULL };
+
+  check(match(paths, "", "") == -1, "empty text accepted");
+  check(match(paths, "{\"a\": [{\"b\": 1}, {\"b\": 2", "0=1;0=2;") == -1, "truncated object accepted");
+  check(match(paths, "{\"a\": [{\"b\": \"x", "") == -1, "truncated string accepted");
+  check(match(paths, "{\"a\": [{\"b\": 1}", "0=1;") == -1, "truncated array accepted");
+  check(match(paths, "{\"a\" [1]}", "") == -1, "missing colon accepted");
+  check(match(paths, "{\"c\": 1 \"a\": []}", "") == -1, "missing comma accepted");
+  check(match(paths, "{\"c\": []} x", "") == -1, "trailing garbage accepted");
+  check(match(paths, "{\"a\": [{\"b\": 1}]} x", "0=1;") == 0, "scanning did not stop");
+}
+
+static void test_invalid_paths()
+{
+  struct JSONMatcher matcher;
+  json_matcher_init(&matcher);
+
+  const char* invalid[] = { "", ".a", "a.", "a..b", "a[", "a[x]", "a[-1]", "a[]b", NULL };
+  const char** p;
+  for(p = invalid; *p; ++p)
+    check(json_matcher_add(&matcher, *p) == -1, "path '%s' accepted", *p);
+
+  check(json_matcher_add(&matcher, "a.b") == 0, "path 'a.b' rejected");
+  check(json_matcher_add(&matcher, "a.b") == -1, "path 'a.b' accepted twice");
+  check(json_matcher_add(&matcher, "a[0][]") == 1, "path 'a[0][]' rejected");
+}
+
+static void check_unescape(const char* value, const char* expected)
+{
+  char dest[256];
+  size_t len = json_unescape(value, strlen(value), dest);
+
+  check(len == strlen(expected) && !memcmp(dest, expected, len),
+        "unescape %s: got '%.*s'", value, (int) len, dest);
+}
+
+static void test_unescape()
+{
+  check_unescape("\"plain\"", "plain");
+  check_unescape("\"\\\"\\\\\\/\\b\\f\\n\\r\\t\"", "\"\\/\b\f\n\r\t");
+  check_unescape("\"\\u0041\\u00e9\\u20AC\"", "A\xc3\xa9\xe2\x82\xac");
+  check_unescape("\"\\ud83d\\ude00!\"", "\xf0\x9f\x98\x80!");
+  check_unescape("\"\\u12\"", "\\u12");
+  check_unescape("\"\\uzzzz\"", "\\uzzzz");
+  check_unescape("42", "42");
+  check_unescape("{\"a\": 1}", "{\"a\": 1}");
+}
+
+static void test_escape()
+{
+  const char s[] = "a\"b\\c\n\t\x01\x1f\xc3\xa9";
+  char dest[6 * sizeof(s)];
+  size_t len = json_escape(s, sizeof(s) - 1, dest);
+
+  const char* expected = "a\\\"b\\\\c\\n\\t\\u0001\\u001f\xc3\xa9";
+  check(len == strlen(expected) && !memcmp(dest, expected, len),
+        "escape: got '%.*s'", (int) len, dest);
+
+  /* and back */
+  char quoted[sizeof(dest) + 2], back[sizeof(dest)];
+  quoted[0] = '"';
+  memcpy(quoted + 1, dest, len);
+  quoted[len + 1] = '"';
+
+  size_t back_len = json_unescape(quoted, len + 2, back);
+  check(back_len == sizeof(s) - 1 && !memcmp(back, s, back_len), "escape does not round trip");
+}
+
+static void test_compact()
+{
+  const char* value = "{ \"a\" : [1,\n\t2 ] ,\r\n \"b\": \" x \\\" y \" }";
+  char dest[256];
+  size_t len = json_compact(value, strlen(value), dest);
+
+  const char* expected = "{\"a\":[1,2],\"b\":\" x \\\" y \"}";
+  check(len == strlen(expected) && !memcmp(dest, expected, len),
+        "compact: got '%.*s'", (int) len, dest);
+}
+
+int main()
+{
+  test_default_path();
+  test_nested_wildcards();
+  test_escaped_keys_and_values();
+  test_invalid_json();
+  test_invalid_paths();
+  test_unescape();
+  test_escape();
+  test_compact();
+
+  return test_done("json");
+}
@@ -0,0 +1,422 @@
+/*
+ * This file is part of the sse package, copyright (c) 2011, 2012, @radiospiel.
+ * It is copyrighted under the terms of the modified BSD license, see LICENSE.BSD.
+ *
+ * For more information see https://https://github.com/radiospiel/sse.
+ */
+
+/*
+ * Tests for the SSE parser; run via "make test".
+ *
+ * The parser's events are written down as text, and compared against
+ * the expected text, and against what the parser reports for the same
+ * stream when it is fed in one piece.
+ */
+
+#include "test.h"
+
+/* === recording events ============================================ */
+
+static struct {
+  char*  data;
+  size_t len, size;
+} events;
+
+static void record(const char* s, size_t len)
+{
+  if(len + 1 > events.size - events.len) {
+    events.size = (events.size + len + 1) * 2;
+    events.data = realloc(events.data, events.size);
+    if(!events.data)
+      die("realloc");
+  }
+
+  memcpy(events.data + events.len, s, len);
+  events.len += len;
+  events.data[events.len] = 0;
+}
+
+static void record_str(const char* s)
+{
+  record(s, strlen(s));
+}
+
+/*
+ * the callback for parsers without on_event.
+ */
+void on_sse_event(char** headers, const char** values, const char* data, const char* reply_url)
+{
+  for(; *headers; ++headers) {
+    record_str("H:");
+    record_str(*headers);
+    record_str("\n");
+  }
+
+  record_str("D:");
+  record_str(data);
+  record_str("\n");
+
+  if(reply_url) {
+    record_str("R:");
+    record_str(reply_url);
+    record_str("\n");
+  }
+
+  int id;
+  for(id = SSE_FIELD_EXTRA; id < SSE_MAX_FIELDS; ++id) {
+    if(!values[id])
+      continue;
+
+    record_str("V:");
+    record_str(sse_field_name(id));
+    record_str("=");
+    record_str(values[id]);
+    record_str("\n");
+  }
+
+  record_str("--\n");
+}
+
+static const char* field_types[] = { "other", "event", "id", "retry", "data", "reply", "stream" };
+
+static void on_event(const struct SSEEvent* event, void* context)
+{
+  unsigned i;
+
+  for(i = 0; i < event->nfields; ++i) {
+    const struct SSEField* field = event->fields + i;
+
+    record_str(field->type < SSE_FIELD_EXTRA ? field_types[field->type] : "extra");
+    record_str(" ");
+    record(field->name.ptr, field->name.len);
+    record_str("=");
+    record(field->value.ptr, field->value.len);
+    record_str("\n");
+  }
+
+  record_str("--\n");
+}
+
+/* === feeding ===================================================== */
+
+static const char stream[] =
+  ": a comment\n"
+  "id: 1\n"
+  "event: log\n"
+  "data: first line\n"
+  "data: second line\n"
+  "\n"
+  "data:no space\n"
+  "reply: http://localhost/reply\n"
+  "foo-bar: baz\n"
+  "\n"
+  "retry: 1500\n"
+  "id: 2\n"
+  "data: {\"a\": 1}\n"
+  "\n"
+  "\n"
+  "\n"
+  "data: last\n"
+  "\n";
+
+/* the events in the stream above, as recorded by on_sse_event */
+static const char expected_legacy[] =
+  "H:ID=1\n"
+  "H:EVENT=log\n"
+  "D:first line\nsecond line\n"
+  "--\n"
+  "H:FOO-BAR=baz\n"
+  "D:no space\n"
+  "R:http://localhost/reply\n"
+  "--\n"
+  "H:RETRY=1500\n"
+  "H:ID=2\n"
+  "D:{\"a\": 1}\n"
+  "--\n"
+  "D:last\n"
+  "--\n";
+
+/* ... and by on_event */
+static const char expected_view[] =
+  "id id=1\n"
+  "event event=log\n"
+  "data data=first line\n"
+  "data data=second line\n"
+  "--\n"
+  "data data=no space\n"
+  "reply reply=http://localhost/reply\n"
+  "other foo-bar=baz\n"
+  "--\n"
+  "retry retry=1500\n"
+  "id id=2\n"
+  "data data={\"a\": 1}\n"
+  "--\n"
+  "data data=last\n"
+  "--\n";
+
+/*
+ * feed \a len bytes from \a data to a new parser, in chunks that end at
+ * the offsets in \a splits. Each chunk is copied into a buffer of its
+ * own, which is wiped afterwards, so a parser that keeps pointers into
+ * the caller's buffer is caught. Returns the recorded events.
+ */
+static char* parse(int view, const char* data, size_t len, const size_t* splits, int nsplits)
+{
+  struct SSEParser parser;
+  size_t pos = 0;
+  int i;
+
+  sse_parser_init(&parser);
+  if(view)
+    parser.on_event = on_event;
+
+  events.len = 0;
+  record_str("");
+
+  for(i = 0; i <= nsplits; ++i) {
+    size_t next = i < nsplits ? splits[i] : len;
+    size_t n = next - pos;
+    char* chunk = malloc(n + 1);
+
+    memcpy(chunk, data + pos, n);
+    sse_parser_feed(&parser, chunk, n);
+    memset(chunk, '#', n);
+    free(chunk);
+
+    pos = next;
+  }
+
+  check(parser.retry == 1500, "retry is %ld", parser.retry);
+  check(parser.last_id && !strcmp(parser.last_id, "2"), "last id is %s", parser.last_id);
+
+  sse_parser_free(&parser);
+  return strdup(events.data);
+}
+
+/*
+ * the events must not depend on where the chunk boundaries fall.
+ */
+static void test_chunk_boundaries(int view)
+{
+  size_t len = strlen(stream), i;
+  char* expected = parse(view, stream, len, 0, 0);
+
+  check(!strcmp(expected, view ? expected_view : expected_legacy), "%s mode:\n%s\nexpected:\n%s",
+    view ? "view" : "legacy", expected, view ? expected_view : expected_legacy);
+
+  /* two chunks, split at every offset */
+  for(i = 1; i < len; ++i) {
+    char* actual = parse(view, stream, len, &i, 1);
+    check(!strcmp(expected, actual), "%s mode, split at %lu:\n%s\nexpected:\n%s",
+      view ? "view" : "legacy", (unsigned long) i, actual, expected);
+    free(actual);
+  }
+
+  /* one byte at a time */
+  size_t* splits = malloc(len * sizeof(size_t));
+  for(i = 1; i < len; ++i)
+    splits[i - 1] = i;
+
+  char* actual = parse(view, stream, len, splits, len - 1);
+  check(!strcmp(expected, actual), "%s mode, byte by byte:\n%s", view ? "view" : "legacy", actual);
+
+  free(actual);
+  free(splits);
+  free(expected);
+}
+
+/*
+ * with events split across chunks the parser keeps parts of the input
+ * in its tail; the tail must not grow with the stream, nor with a line
+ * that never ends.
+ */
+static void test_tail_is_bounded(int view)
+{
+  const char event[] = "id: 42\nevent: tick\ndata: some payload\n\n";
+  size_t len = sizeof(event) - 1, cut = 17, i;
+  struct SSEParser parser;
+  char chunk[sizeof(event)];
+
+  /* every chunk ends in the middle of an event */
+  memcpy(chunk, event + cut, len - cut);
+  memcpy(chunk + len - cut, event, cut);
+
+  sse_parser_init(&parser);
+  if(view)
+    parser.on_event = on_event;
+
+  sse_parser_feed(&parser, event, cut);
+  for(i = 0; i < 100000; ++i) {
+    events.len = 0;
+    record_str("");
+
+    sse_parser_feed(&parser, chunk, len);
+  }
+
+  check(strstr(events.data, "some payload"), "%s mode, events missing:\n%s", view ? "view" : "legacy", events.data);
+  check(parser.tail_len <= len, "%s mode, tail_len is %lu", view ? "view" : "legacy", (unsigned long) parser.tail_len);
+  check(parser.tail_size <= 1024, "%s mode, tail_size is %lu", view ? "view" : "legacy", (unsigned long) parser.tail_size);
+
+  sse_parser_free(&parser);
+
+  /* a line without a newline is dropped once it exceeds the limit. */
+  char line[1000];
+  memset(line, 'x', sizeof(line));
+
+  sse_parser_init(&parser);
+  parser.max_data_size = 4096;
+  if(view)
+    parser.on_event = on_event;
+
+  events.len = 0;
+  record_str("");
+
+  sse_parser_feed(&parser, "id: 7\ndata: ", 12);
+  for(i = 0; i < 1000; ++i)
+    sse_parser_feed(&parser, line, sizeof(line));
+
+  check(parser.tail_size <= 16384, "%s mode, tail_size is %lu after an endless line",
+    view ? "view" : "legacy", (unsigned long) parser.tail_size);
+
+  sse_parser_feed(&parser, "xx\n\ndata: next\n\n", 17);
+  check(!strstr(events.data, "xxx") && strstr(events.data, "next"), "%s mode, events after an endless line:\n%s",
+    view ? "view" : "legacy", events.data);
+
+  sse_parser_free(&parser);
+}
+
+/*
+ * an empty id resets the last event id; a longer or shorter one
+ * replaces it, and an event without an id keeps it.
+ */
+static void test_empty_id(int view)
+{
+  char long_chunk[256], long_id[101];
+  memset(long_id, 'a', 100);
+  long_id[100] = 0;
+  sprintf(long_chunk, "id: %s\ndata: z\n\n", long_id);
+
+  const char* chunks[] = { "id: 1\ndata: x\n\n", "id: \ndata: y\n\n", "id: 2\ndata: z\n\n", "id:\ndata: z\n\n",
+                           "id: 22\ndata: z\n\n", "id: 2\ndata: z\n\n", long_chunk, "data: z\n\n", "id: 3\ndata: z\n\n" };
+  const char* ids[] = { "1", "", "2", "", "22", "2", long_id, long_id, "3" };
+  struct SSEParser parser;
+  int i;
+
+  sse_parser_init(&parser);
+  if(view)
+    parser.on_event = on_event;
+
+  for(i = 0; i < 9; ++i) {
+    sse_parser_feed(&parser, chunks[i], strlen(chunks[i]));
+    check(parser.last_id && !strcmp(parser.last_id, ids[i]), "%s mode, last id after %d events is '%s'",
+      view ? "view" : "legacy", i + 1, parser.last_id ? parser.last_id : "(null)");
+  }
+
+  sse_parser_free(&parser);
+}
+
+/*
+ * "retry: 0" asks for no delay at all, which differs from no "retry"
+ * field; a value that is not a number is ignored.
+ */
+static void test_retry()
+{
+  struct SSEParser parser;
+
+  sse_parser_init(&parser);
+  check(parser.retry == -1, "retry is %ld without a retry field", parser.retry);
+
+  sse_parser_feed(&parser, "retry: 0\n\n", 10);
+  check(parser.retry == 0, "retry is %ld after 'retry: 0'", parser.retry);
+
+  sse_parser_feed(&parser, "retry: soon\n\n", 13);
+  check(parser.retry == 0, "retry is %ld after 'retry: soon'", parser.retry);
+
+  sse_parser_free(&parser);
+}
+
+/*
+ * fields registered with -f get ids of their own. "channel" hashes to
+ * the slot of "retry" in the precomputed table, so registering it makes
+ * fields_rehash() pick another seed; all names must still be found.
+ * Registered fields stay, so this runs last.
+ */
+static void test_registered_fields()
+{
+  const char* builtin[] = { 0, "event", "id", "retry", "data", "reply" };
+  int foo_bar = sse_field_register("foo-bar");
+  int i;
+
+  check(foo_bar == SSE_FIELD_EXTRA, "foo-bar has id %d", foo_bar);
+  check(sse_field_register("foo-bar") == foo_bar, "foo-bar registered twice");
+
+  char* legacy = parse(0, stream, strlen(stream), 0, 0);
+  char* view = parse(1, stream, strlen(stream), 0, 0);
+  check(strstr(legacy, "H:FOO-BAR=baz\n") && strstr(legacy, "V:foo-bar=baz\n"), "legacy mode:\n%s", legacy);
+  check(strstr(view, "extra foo-bar=baz\n"), "view mode:\n%s", view);
+  free(legacy);
+  free(view);
+
+  int channel = sse_field_register("channel");
+  check(channel == SSE_FIELD_EXTRA + 1, "channel has id %d", channel);
+
+  for(i = SSE_FIELD_EVENT; i <= SSE_FIELD_REPLY; ++i)
+    check(sse_field_lookup(builtin[i], strlen(builtin[i])) == i, "%s not found after rehashing", builtin[i]);
+  check(sse_field_lookup("foo-bar", 7) == foo_bar, "foo-bar not found after rehashing");
+  check(sse_field_lookup("channel", 7) == channel, "channel not found");
+  check(sse_field_lookup("chan", 4) == SSE_FIELD_OTHER, "chan found");
+
+  struct SSEParser parser;
+  sse_parser_init(&parser);
+  parser.on_event = on_event;
+
+  events.len = 0;
+  record_str("");
+  sse_parser_feed(&parser, "channel: news\nretry: 5\ndata: x\n\n", 32);
+  check(!strcmp(events.data, "extra channel=news\nretry retry=5\ndata data=x\n--\n"), "view mode:\n%s", events.data);
+
+  sse_parser_free(&parser);
+}
+
+/*
+ * a single huge event must not leave the parser holding on to its
+ * memory.
+ */
+static void test_arena_shrinks()
+{
+  size_t len = 16 * 1024 * 1024;
+  char* event = malloc(len + 16);
+  struct SSEParser parser;
+
+  memcpy(event, "data: ", 6);
+  memset(event + 6, 'x', len);
+  memcpy(event + 6 + len, "\n\n", 2);
+
+  sse_parser_init(&parser);
+
+  events.len = 0;
+  sse_parser_feed(&parser, event, len + 8);
+  check(events.len > len, "huge event missing");
+
+  sse_parser_feed(&parser, "data: small\n\n", 14);
+  check(parser.arena.size < 1024 * 1024, "arena size is %lu after a huge event", (unsigned long) parser.arena.size);
+  check(!parser.arena.overflow, "arena keeps overflow blocks");
+
+  sse_parser_free(&parser);
+  free(event);
+}
+
+int main()
+{
+  test_chunk_boundaries(0);
+  test_chunk_boundaries(1);
+  test_tail_is_bounded(0);
+  test_tail_is_bounded(1);
+  test_empty_id(0);
+  test_empty_id(1);
+  test_retry();
+  test_arena_shrinks();
+  test_registered_fields();
+
+  return test_done("parse-sse");
+}
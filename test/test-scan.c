@@ -0,0 +1,90 @@
+/*
+ * This file is part of the sse package, copyright (c) 2011, 2012, @radiospiel.
+ * It is copyrighted under the terms of the modified BSD license, see LICENSE.BSD.
+ *
+ * For more information see https://https://github.com/radiospiel/sse.
+ */
+
+/*
+ * Tests for the line scanner; run via "make test".
+ *
+ * Each implementation the CPU supports scans lines of up to 70 bytes,
+ * with a colon at each position or none, followed by input of various
+ * lengths; so that the newline, the colon, and the end of the input
+ * fall on both sides of the 16 and 32 byte vectors.
+ */
+
+#include "test.h"
+
+#define MAX_LINE 70
+
+/* lengths of the input after the newline */
+static const size_t tails[] = { 0, 1, 15, 16, 17, 31, 32, 33 };
+
+/*
+ * scan a line of \a len bytes with a colon at \a colon (or none, if -1),
+ * followed by \a tail bytes that hold more colons and newlines. Without
+ * \a newline the input ends after the line.
+ */
+static void scan(const char* name, size_t len, long colon, size_t tail, int newline)
+{
+  size_t size = newline ? len + 1 + tail : len, i;
+  char* buf = malloc(size ? size : 1);
+
+  for(i = 0; i < len; ++i)
+    buf[i] = 'a' + i % 26;
+  if(colon >= 0)
+    buf[colon] = ':';
+
+  if(newline) {
+    buf[len] = '\n';
+    for(i = 0; i < tail; ++i)
+      buf[len + 1 + i] = i % 3 ? ':' : '\n';
+  }
+
+  const char* found = (const char*) 1;
+  const char* eol = sse_scan_line(buf, buf + size, &found);
+
+  if(!newline) {
+    check(!eol, "%s: newline found in %lu bytes without one", name, (unsigned long) len);
+  }
+  else {
+    check(eol == buf + len, "%s: line of %lu bytes + %lu, newline at %ld", name,
+          (unsigned long) len, (unsigned long) tail, eol ? (long) (eol - buf) : -1L);
+    check(found == (colon >= 0 ? buf + colon : NULL), "%s: line of %lu bytes + %lu, colon at %ld, found at %ld",
+          name, (unsigned long) len, (unsigned long) tail, colon, found ? (long) (found - buf) : -1L);
+  }
+
+  free(buf);
+}
+
+static void test_scan(const char* name)
+{
+  size_t len, t;
+  long colon;
+
+  if(sse_scan_select(name) < 0) {
+    fprintf(stderr, "no %s here, skipping it\n", name);
+    return;
+  }
+
+  for(len = 0; len <= MAX_LINE; ++len) {
+    for(colon = -1; colon < (long) len; ++colon) {
+      for(t = 0; t < sizeof(tails) / sizeof(*tails); ++t)
+        scan(name, len, colon, tails[t], 1);
+
+      scan(name, len, colon, 0, 0);
+    }
+  }
+}
+
+int main()
+{
+  test_scan("avx2");
+  test_scan("sse2");
+  test_scan("scalar");
+
+  check(sse_scan_select("neon") < 0, "unknown implementation selected");
+
+  return test_done("scan");
+}
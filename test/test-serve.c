@@ -0,0 +1,258 @@
+/*
+ * This file is part of the sse package, copyright (c) 2011, 2012, @radiospiel.
+ * It is copyrighted under the terms of the modified BSD license, see LICENSE.BSD.
+ *
+ * For more information see https://https://github.com/radiospiel/sse.
+ */
+
+/*
+ * Tests for serving the output to local clients; run via "make test".
+ *
+ * Clients connect to the socket as any client would, and what they
+ * receive is compared against what was written. Each event is a line
+ * "<type> <n> <padding>".
+ */
+
+#define _GNU_SOURCE             /* memmem */
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "test.h"
+
+#define SOCKET_PATH "/tmp/test-serve.sock"
+#define PREAMBLE    "preamble\n"
+
+static int client_connect()
+{
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, SOCKET_PATH);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(fd < 0 || connect(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0)
+    die("connect");
+
+  return fd;
+}
+
+/*
+ * read what \a fd receives into \a out, until nothing comes in for
+ * \a timeout msecs.
+ */
+static void client_receive(int fd, struct Buffer* out, int timeout)
+{
+  struct pollfd pfd = { fd, POLLIN, 0 };
+
+  while(poll(&pfd, 1, timeout) > 0) {
+    ssize_t n = recv(fd, buffer_reserve(out, 65536), 65536, 0);
+    if(n <= 0)
+      break;
+    out->len += n;
+  }
+}
+
+/*
+ * connect a client, and wait until it got the preamble: then it is
+ * served.
+ */
+static int client_start()
+{
+  struct Buffer in = { 0 };
+  struct pollfd pfd = { client_connect(), POLLIN, 0 };
+  int fd = pfd.fd;
+
+  while(in.len < strlen(PREAMBLE) && poll(&pfd, 1, 1000) > 0) {
+    ssize_t n = recv(fd, buffer_reserve(&in, 256), 256, 0);
+    if(n <= 0)
+      break;
+    in.len += n;
+  }
+  check(in.len == strlen(PREAMBLE) && !memcmp(in.data, PREAMBLE, in.len), "preamble: '%.*s'", (int) in.len, in.data);
+
+  free(in.data);
+  return fd;
+}
+
+static void write_event(const char* type, int n, size_t padding)
+{
+  char event[65536];
+  int len = snprintf(event, sizeof(event), "%s %d ", type && *type ? type : "-", n);
+
+  memset(event + len, 'x', padding);
+  event[len + padding] = '\n';
+  serve_write(type, event, len + padding + 1);
+}
+
+/*
+ * the numbers of the events in \a in, as "<type> <n>;" each. Checks
+ * that each event arrived completely.
+ */
+static void events_of(const struct Buffer* in, char* out, size_t size)
+{
+  const char* p = in->data;
+  const char* end = p + in->len;
+
+  *out = 0;
+  while(p < end) {
+    const char* nl = memchr(p, '\n', end - p);
+    check(nl, "incomplete event at the end");
+    if(!nl)
+      break;
+
+    char type[32];
+    int n;
+    const char* pad = memchr(p, ' ', nl - p);
+    pad = pad ? memchr(pad + 1, ' ', nl - pad - 1) : 0;
+
+    check(pad && sscanf(p, "%31s %d", type, &n) == 2, "invalid event '%.*s'", (int) (nl - p), p);
+    for(++pad; pad && pad < nl; ++pad)
+      check(*pad == 'x', "event %d is mixed up with another", n);
+
+    size_t used = strlen(out);
+    snprintf(out + used, size - used, "%s %d;", type, n);
+    p = nl + 1;
+  }
+}
+
+/* === tests ======================================================= */
+
+/*
+ * a client gets the events of the types it asked for; an event without
+ * a type is a "message".
+ */
+static void test_filter()
+{
+  int all = client_start(), some = client_start();
+  struct Buffer in = { 0 };
+  char events[1024];
+  int i;
+
+  const char command[] = "events tick, message\n";
+  check(send(some, command, sizeof(command) - 1, 0) == sizeof(command) - 1, "send");
+
+  /* wait for the filter to be in place: until a "probe" is left out. */
+  for(i = 0; i < 100; ++i) {
+    in.len = 0;
+    write_event("probe", i, 0);
+    write_event("tick", i, 0);
+    client_receive(some, &in, 10);
+    if(in.len && !memmem(in.data, in.len, "probe", 5))
+      break;
+  }
+  check(i < 100, "filter not applied");
+
+  struct Buffer skipped = { 0 };
+  client_receive(all, &skipped, 10);
+  free(skipped.data);
+
+  in.len = 0;
+  write_event("tick", 1, 10);
+  write_event("log", 2, 10);
+  write_event(0, 3, 10);
+  write_event("", 4, 10);
+  write_event("tick", 5, 10);
+
+  client_receive(some, &in, 100);
+  events_of(&in, events, sizeof(events));
+  check(!strcmp(events, "tick 1;- 3;- 4;tick 5;"), "filtered events: %s", events);
+
+  in.len = 0;
+  client_receive(all, &in, 100);
+  events_of(&in, events, sizeof(events));
+  check(!strcmp(events, "tick 1;log 2;- 3;- 4;tick 5;"), "all events: %s", events);
+
+  /* "events *" turns the filter off again */
+  const char reset[] = "events *\n";
+  check(send(some, reset, sizeof(reset) - 1, 0) == sizeof(reset) - 1, "send");
+  for(i = 0; i < 100; ++i) {
+    in.len = 0;
+    write_event("probe", i, 0);
+    client_receive(some, &in, 10);
+    if(in.len)
+      break;
+  }
+  check(i < 100, "filter not reset");
+
+  free(in.data);
+  close(all);
+  close(some);
+}
+
+/*
+ * a client that does not read has whole events dropped once its queue
+ * is full, and gets events again once it reads; a client that keeps
+ * up gets all events. A client that is gone is dropped.
+ */
+static void test_slow_client()
+{
+  int fast = client_start(), slow = client_start();
+  struct Buffer in = { 0 }, fast_in = { 0 };
+  char events[65536];
+  int i;
+
+  for(i = 0; i < 200; ++i) {
+    write_event("e", i, 4000 + i);
+    client_receive(fast, &fast_in, 0);
+  }
+
+  /* all events, in order */
+  events_of(&fast_in, events, sizeof(events));
+  char* p = events;
+  for(i = 0; i < 200; ++i) {
+    char expected[32];
+    int len = sprintf(expected, "e %d;", i);
+    check(!strncmp(p, expected, len), "fast client: event %d missing", i);
+    if(strncmp(p, expected, len))
+      break;
+    p += len;
+  }
+
+  /* some events, each complete, in order */
+  client_receive(slow, &in, 100);
+  events_of(&in, events, sizeof(events));
+
+  int n, last = -1, count = 0;
+  for(p = events; sscanf(p, "e %d;", &n) == 1; p = strchr(p, ';') + 1) {
+    check(n > last, "slow client: event %d after %d", n, last);
+    last = n;
+    count++;
+  }
+  check(count > 0 && count < 200, "slow client got %d events", count);
+
+  /* once it read its queue, it gets events again */
+  in.len = 0;
+  write_event("e", 200, 10);
+  client_receive(slow, &in, 100);
+  events_of(&in, events, sizeof(events));
+  check(!strcmp(events, "e 200;"), "slow client, after reading: %s", events);
+
+  /* a client that is gone */
+  close(slow);
+  close(fast);
+  for(i = 0; i < 10; ++i)
+    write_event("e", i, 10);
+
+  free(in.data);
+  free(fast_in.data);
+}
+
+int main()
+{
+  signal(SIGPIPE, SIG_IGN);
+
+  options.serve_queue = 64 * 1024;
+
+  serve_init(SOCKET_PATH);
+  serve_preamble(PREAMBLE, strlen(PREAMBLE));
+
+  test_filter();
+  test_slow_client();
+
+  serve_close();
+  unlink(SOCKET_PATH);
+
+  return test_done("serve");
+}
@@ -0,0 +1,180 @@
+/*
+ * This file is part of the sse package, copyright (c) 2011, 2012, @radiospiel.
+ * It is copyrighted under the terms of the modified BSD license, see LICENSE.BSD.
+ *
+ * For more information see https://https://github.com/radiospiel/sse.
+ */
+
+/*
+ * Tests for the shared-memory ring; run via "make test".
+ *
+ * Events are published into a small ring, so that it wraps around many
+ * times, and read back with the reader from bin/libsse-reader.a.
+ */
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "test.h"
+#include "shm-ring.h"
+
+#define RING_NAME "/sse-test-shm-ring"
+#define RING_SIZE 4096
+
+/*
+ * publish event \a n; events differ in length, so records end at all
+ * sorts of offsets.
+ */
+static void publish(int n)
+{
+  char event[256];
+  int len = sprintf(event, "event %d ", n);
+
+  memset(event + len, 'x', n % 100);
+  shm_ring_publish(event, len + n % 100);
+}
+
+/*
+ * read the next event, and return its number, or -1 if there is none.
+ */
+static int next(struct SSEShmReader* reader)
+{
+  char buf[256];
+  size_t len = sse_shm_reader_next(reader, buf, sizeof(buf) - 1);
+  if(!len)
+    return -1;
+
+  buf[len] = 0;
+  int n = atoi(buf + 6);
+  check(len == strlen(buf) && len == (size_t) sprintf(buf, "event %d ", n) + n % 100,
+        "event %d has %lu byte", n, (unsigned long) len);
+  return n;
+}
+
+static void test_wrap_around()
+{
+  struct SSEShmReader reader;
+  int i;
+
+  shm_ring_create(RING_NAME, RING_SIZE, SSE_SHM_DROP);
+  shm_ring_preamble("header", 6);
+
+  check(sse_shm_reader_open(&reader, RING_NAME) == 0, "cannot open ring");
+
+  size_t len;
+  const char* preamble = sse_shm_reader_preamble(&reader, &len);
+  check(len == 6 && !memcmp(preamble, "header", 6), "preamble");
+
+  for(i = 0; i < 500; ++i) {
+    publish(i);
+    if(i % 7 == 0)
+      continue;
+
+    int n;
+    while((n = next(&reader)) >= 0)
+      check(n == i || (i % 7 == 1 && n == i - 1), "read event %d after publishing %d", n, i);
+  }
+
+  check(next(&reader) == -1, "extra event");
+  check(!sse_shm_reader_eof(&reader), "eof before close");
+  shm_ring_close();
+  check(sse_shm_reader_eof(&reader), "no eof after close");
+  check(sse_shm_reader_lost(&reader) == 0, "lost %lu events", (unsigned long) sse_shm_reader_lost(&reader));
+
+  sse_shm_reader_close(&reader);
+}
+
+/*
+ * a reader that does not read makes the writer drop, or overwrite events.
+ */
+static void test_slow_reader(int policy)
+{
+  struct SSEShmReader reader;
+  int i, n, first = -1, last = -1, count = 0;
+
+  shm_ring_create(RING_NAME, RING_SIZE, policy);
+  check(sse_shm_reader_open(&reader, RING_NAME) == 0, "cannot open ring");
+
+  for(i = 0; i < 200; ++i)
+    publish(i);
+  shm_ring_close();
+
+  while((n = next(&reader)) >= 0) {
+    check(last == -1 || n == last + 1, "read event %d after %d", n, last);
+    if(first == -1)
+      first = n;
+    last = n;
+    count++;
+  }
+
+  check(sse_shm_reader_eof(&reader), "no eof");
+  check(count > 10 && count < 200, "read %d events", count);
+  check(sse_shm_reader_lost(&reader) == (uint64_t) (200 - count), "lost %lu events, read %d",
+        (unsigned long) sse_shm_reader_lost(&reader), count);
+
+  if(policy == SSE_SHM_DROP)
+    check(first == 0, "first event is %d", first);
+  else
+    check(last == 199, "last event is %d", last);
+
+  sse_shm_reader_close(&reader);
+}
+
+/*
+ * a reader that died without detaching does not hold up the ring.
+ */
+static void test_dead_reader()
+{
+  struct SSEShmReader reader;
+  int i, n, count = 0;
+
+  shm_ring_create(RING_NAME, RING_SIZE, SSE_SHM_DROP);
+  publish(0);
+
+  pid_t pid = fork();
+  if(!pid) {
+    _exit(sse_shm_reader_open(&reader, RING_NAME) == 0 ? 0 : 1);
+  }
+
+  int status;
+  waitpid(pid, &status, 0);
+  check(WIFEXITED(status) && WEXITSTATUS(status) == 0, "reader process failed");
+
+  check(sse_shm_reader_open(&reader, RING_NAME) == 0, "cannot open ring");
+  check(reader.ring->readers[0].pid == (uint32_t) pid, "dead reader has no slot");
+
+  /* the writer looks for dead readers at most once a second. */
+  sleep(1);
+
+  for(i = 1; i < 200; ++i) {
+    publish(i);
+    while((n = next(&reader)) >= 0) {
+      check(n == i, "read event %d after publishing %d", n, i);
+      count++;
+    }
+  }
+
+  check(count == 199, "read %d events", count);
+  check(sse_shm_reader_lost(&reader) == 0, "lost %lu events", (unsigned long) sse_shm_reader_lost(&reader));
+  check(reader.ring->readers[0].pid == 0, "dead reader's slot is not freed");
+  check(reader.ring->readers[0].cursor == SSE_SHM_NO_CURSOR, "dead reader's cursor is not reset");
+
+  /* the slot is free for the next reader */
+  struct SSEShmReader other;
+  check(sse_shm_reader_open(&other, RING_NAME) == 0, "cannot open ring");
+  check(other.slot == other.ring->readers, "freed slot not reused");
+  sse_shm_reader_close(&other);
+
+  sse_shm_reader_close(&reader);
+}
+
+int main()
+{
+  test_wrap_around();
+  test_slow_reader(SSE_SHM_DROP);
+  test_slow_reader(SSE_SHM_OVERWRITE);
+  test_dead_reader();
+
+  shm_unlink(RING_NAME);
+
+  return test_done("shm-ring");
+}
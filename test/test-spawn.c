@@ -0,0 +1,249 @@
+/*
+ * This file is part of the sse package, copyright (c) 2011, 2012, @radiospiel.
+ * It is copyrighted under the terms of the modified BSD license, see LICENSE.BSD.
+ *
+ * For more information see https://https://github.com/radiospiel/sse.
+ */
+
+/*
+ * Tests for running the <command> in batches; run via "make test".
+ *
+ * Each event has a type of its own, and the command answers with one
+ * result per event; each type must show up exactly once in the output.
+ * How long the events take tells how many children ran at once.
+ */
+
+#include <pthread.h>
+#include <time.h>
+#include "test.h"
+
+/* === recording output ========================================== */
+
+#define MAX_EVENTS 64
+
+static pthread_mutex_t results_lock = PTHREAD_MUTEX_INITIALIZER;
+static int results[MAX_EVENTS];   // number of results per event type
+
+void output_write(const char* type, const char* data, size_t len)
+{
+  int n = type ? atoi(type) : -1;
+
+  pthread_mutex_lock(&results_lock);
+  if(n >= 0 && n < MAX_EVENTS && len == 2 && !memcmp(data, "ok", 2))
+    results[n]++;
+  pthread_mutex_unlock(&results_lock);
+}
+
+
+/* === tests ======================================================= */
+
+/*
+ * answers each event of the batch with "ok" - after a while, so that
+ * the next batch finds all slots busy.
+ */
+static char* batch_command[] = {
+  "/bin/sh", "-c",
+  "cat > /dev/null; sleep 0.2; "
+  "i=0; while [ $i -lt $SSE_BATCH_SIZE ]; do printf '2\\nok'; i=$((i+1)); done",
+  0
+};
+
+/*
+ * answers an event with "ok" after 0.3 secs, without reading its data;
+ * only if it does not see an SSE_* variable of our own.
+ */
+static char* event_command[] = {
+  "/bin/sh", "-c",
+  "sleep 0.3; [ -z \"$SSE_STALE\" ] && [ -n \"$SSE_EVENT\" ] && printf ok",
+  0
+};
+
+static char* missing_command[] = { "/nonexistent/command", 0 };
+
+static void submit_event(int n, const char* id, const char* data)
+{
+  char type[16], event_header[32], id_header[32];
+  sprintf(type, "%d", n);
+  sprintf(event_header, "EVENT=%d", n);
+  snprintf(id_header, sizeof(id_header), "ID=%s", id ? id : "");
+
+  char* headers[] = { event_header, id ? id_header : 0, 0 };
+  const char* values[SSE_MAX_FIELDS] = { 0 };
+  values[SSE_FIELD_EVENT] = type;
+  values[SSE_FIELD_ID] = id;
+
+  spawn_submit(headers, values, data, 0);
+}
+
+static void submit(int n)
+{
+  submit_event(n, 0, "{}");
+}
+
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void* submit_thread(void* arg)
+{
+  int first = *(int*) arg, i;
+
+  for(i = 0; i < 6; ++i)
+    submit(first + i);
+
+  return 0;
+}
+
+static void check_results(int nevents)
+{
+  int i;
+
+  pthread_mutex_lock(&results_lock);
+  for(i = 0; i < nevents; ++i) {
+    check(results[i] == 1, "event %d has %d results", i, results[i]);
+    results[i] = 0;
+  }
+  pthread_mutex_unlock(&results_lock);
+}
+
+/*
+ * a full batch waits for a free slot, while the spawn thread finds the
+ * next batch due: each batch is still started once.
+ */
+static void test_full_batch_while_busy()
+{
+  int i;
+
+  for(i = 0; i < 6; ++i)
+    submit(i);
+
+  spawn_drain();
+  check_results(6);
+}
+
+/*
+ * several threads submit at once, as with --threads.
+ */
+static void test_threads()
+{
+  pthread_t threads[4];
+  int first[4], i;
+
+  for(i = 0; i < 4; ++i) {
+    first[i] = 6 * i;
+    pthread_create(threads + i, 0, submit_thread, first + i);
+  }
+  for(i = 0; i < 4; ++i)
+    pthread_join(threads[i], 0);
+
+  spawn_drain();
+  check_results(24);
+}
+
+/*
+ * without --batch, each event gets a child of its own; an event with
+ * more than SPLICE_MIN bytes is spliced into its stdin.
+ */
+static void test_per_event()
+{
+  size_t len = 4 * SPLICE_MIN;
+  char* data = malloc(len + 1);
+  int i;
+
+  memset(data, 'x', len);
+  data[len] = 0;
+
+  for(i = 0; i < 4; ++i)
+    submit_event(i, 0, i % 2 ? data : "{}");
+
+  spawn_drain();
+  check_results(4);
+  free(data);
+}
+
+/*
+ * no more than -J children run at once: with -J 2 three events take
+ * two rounds.
+ */
+static void test_jobs_limit()
+{
+  double started = now();
+  int i;
+
+  for(i = 0; i < 3; ++i)
+    submit(i);
+
+  spawn_drain();
+  check(now() - started >= 0.55, "3 events took %.2f secs", now() - started);
+  check_results(3);
+}
+
+/*
+ * with --ordered, events with the same id run one after the other.
+ */
+static void test_ordered()
+{
+  double started = now();
+
+  options.ordered = 1;
+  submit_event(0, "a", "{}");
+  submit_event(1, "a", "{}");
+  options.ordered = 0;
+
+  spawn_drain();
+  check(now() - started >= 0.55, "2 events took %.2f secs", now() - started);
+  check_results(2);
+}
+
+/*
+ * a command that cannot be started gives no results, and frees its
+ * slots.
+ */
+static void test_spawn_failure()
+{
+  int i;
+
+  options.command = missing_command;
+  for(i = 0; i < 4; ++i)
+    submit(i);
+  spawn_drain();
+
+  pthread_mutex_lock(&results_lock);
+  for(i = 0; i < 4; ++i)
+    check(results[i] == 0, "event %d has %d results", i, results[i]);
+  pthread_mutex_unlock(&results_lock);
+
+  options.command = event_command;
+  submit(0);
+  spawn_drain();
+  check_results(1);
+}
+
+int main()
+{
+  setenv("SSE_STALE", "1", 1);
+
+  options.command = batch_command;
+  options.command_jobs = 2;
+  options.batch_size = 2;
+  options.batch_wait = 100;
+
+  spawn_start();
+
+  test_full_batch_while_busy();
+
+  options.batch_size = 4;
+  test_threads();
+
+  options.command = event_command;
+  options.batch_size = 0;
+  test_per_event();
+  test_jobs_limit();
+  test_ordered();
+  test_spawn_failure();
+
+  return test_done("spawn");
+}
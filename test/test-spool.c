@@ -0,0 +1,204 @@
+/*
+ * This file is part of the sse package, copyright (c) 2011, 2012, @radiospiel.
+ * It is copyrighted under the terms of the modified BSD license, see LICENSE.BSD.
+ *
+ * For more information see https://https://github.com/radiospiel/sse.
+ */
+
+/*
+ * Tests for the reply spool; run via "make test".
+ *
+ * Replies are spooled into a temporary directory, which is opened again
+ * as on a restart - as it was left, and with its segment truncated or
+ * corrupted. The replayed entries are written down as text, and compared
+ * against the expected text.
+ */
+
+#define _GNU_SOURCE             /* memmem */
+
+#include <dirent.h>
+#include <limits.h>
+#include "test.h"
+
+/* === recording entries =========================================== */
+
+static char replayed[4096];
+static const void* handles[16];
+static int nhandles;
+
+static void on_entry(const struct SpoolEntry* entry)
+{
+  size_t used = strlen(replayed);
+  const char* id = entry->ids;
+  int i;
+
+  used += snprintf(replayed + used, sizeof(replayed) - used, "%s", entry->url);
+  for(i = 0; i < entry->nevents; ++i) {
+    used += snprintf(replayed + used, sizeof(replayed) - used, " %s", id);
+    id += strlen(id) + 1;
+  }
+  snprintf(replayed + used, sizeof(replayed) - used, " %.*s;", (int) entry->len, entry->body);
+
+  handles[nhandles++] = entry->handle;
+}
+
+static char dir[] = "/tmp/test-spool.XXXXXX";
+
+/*
+ * open the spool, as on a restart, and compare what it replays against
+ * \a expected.
+ */
+static void reopen(const char* expected)
+{
+  replayed[0] = 0;
+  nhandles = 0;
+
+  spool_open(dir, on_entry);
+  check(!strcmp(replayed, expected), "replayed:\n  expected %s\n  got      %s", expected, replayed);
+}
+
+/*
+ * returns the path of the only segment in the spool, or NULL.
+ */
+static char* segment()
+{
+  static char path[sizeof(dir) + NAME_MAX + 1];
+  DIR* d = opendir(dir);
+  struct dirent* de;
+  int n = 0;
+
+  while((de = readdir(d)) != 0) {
+    if(strstr(de->d_name, ".spool")) {
+      snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+      n++;
+    }
+  }
+  closedir(d);
+
+  return n == 1 ? path : NULL;
+}
+
+/*
+ * spool the replies "a", "b", and "c", and mark "b" as delivered.
+ */
+static void spool_abc()
+{
+  char* ids_a[] = { "1", 0 };
+  char* ids_b[] = { "2", 0 };
+  char* ids_c[] = { "3", "4", 0 };
+  const char* body;
+
+  reopen("");
+
+  spool_append("http://a", ids_a, 1, 0, "a", 1, &body);
+  spool_done(spool_append("http://b", ids_b, 1, 0, "b", 1, &body));
+  spool_append("http://c", ids_c, 2, 1, "[c,c]", 5, &body);
+  check(!strcmp(body, "[c,c]"), "spooled body is %s", body);
+
+  spool_close();
+}
+
+/* === tests ======================================================= */
+
+static void test_replay()
+{
+  int i;
+
+  spool_abc();
+
+  reopen("http://a 1 a;http://c 3 4 [c,c];");
+  spool_close();
+
+  /* still pending, until delivered */
+  reopen("http://a 1 a;http://c 3 4 [c,c];");
+  for(i = 0; i < nhandles; ++i)
+    spool_done(handles[i]);
+  spool_close();
+
+  check(!segment(), "segment not removed");
+  reopen("");
+  spool_close();
+}
+
+/*
+ * a record that did not make it to disk completely ends the segment.
+ */
+static void test_truncated()
+{
+  spool_abc();
+
+  char* path = segment();
+  check(path, "no segment");
+  if(!path)
+    return;
+
+  /* the records take up 56, 56, and 64 bytes; cut the last one short */
+  check(truncate(path, 150) == 0, "cannot truncate %s", path);
+
+  reopen("http://a 1 a;");
+  spool_done(handles[0]);
+  spool_close();
+}
+
+static void test_corrupted()
+{
+  spool_abc();
+
+  char* path = segment();
+  FILE* f = path ? fopen(path, "r+") : NULL;
+  check(f, "no segment");
+  if(!f)
+    return;
+
+  /* flip a byte of the last record's body */
+  char buf[1024];
+  size_t len = fread(buf, 1, sizeof(buf), f);
+  char* body = memmem(buf, len, "[c,c]", 5);
+  check(body, "body not found");
+
+  if(body) {
+    fseek(f, body - buf + 1, SEEK_SET);
+    fputc('x', f);
+  }
+  fclose(f);
+
+  reopen("http://a 1 a;");
+  spool_done(handles[0]);
+  spool_close();
+}
+
+/*
+ * a reply that does not fit on the disk is not spooled; the next one is.
+ */
+static void test_no_space()
+{
+  char* ids[] = { "1", 0 };
+  const char* body;
+
+  reopen("");
+
+  check(!spool_append("http://a", ids, 1, 0, "a", (size_t) 1 << 50, &body), "huge reply spooled");
+  const void* handle = spool_append("http://b", ids, 1, 0, "b", 1, &body);
+  check(handle && !strcmp(body, "b"), "reply not spooled after a failure");
+
+  if(handle)
+    spool_done(handle);
+  spool_close();
+
+  check(!segment(), "segment not removed");
+}
+
+int main()
+{
+  if(!mkdtemp(dir))
+    die("mkdtemp");
+
+  test_replay();
+  test_truncated();
+  test_corrupted();
+  test_no_space();
+
+  rmdir(dir);
+
+  return test_done("spool");
+}
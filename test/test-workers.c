@@ -0,0 +1,216 @@
+/*
+ * This file is part of the sse package, copyright (c) 2011, 2012, @radiospiel.
+ * It is copyrighted under the terms of the modified BSD license, see LICENSE.BSD.
+ *
+ * For more information see https://https://github.com/radiospiel/sse.
+ */
+
+/*
+ * Tests for the -w workers; run via "make test".
+ *
+ * The worker is a shell script, which reads each frame and answers with
+ * "<type>:<data>"; some data makes it exit, answer out of protocol, or
+ * take a while.
+ */
+
+#include <pthread.h>
+#include <dirent.h>
+#include <time.h>
+#include "test.h"
+
+/* === recording output ========================================== */
+
+#define MAX_EVENTS 64
+
+static pthread_mutex_t results_lock = PTHREAD_MUTEX_INITIALIZER;
+static char* results[MAX_EVENTS];   // the result per event type
+static char* replies[MAX_EVENTS];   // the reply per event id
+
+static void record(char** slot, const char* data, size_t len)
+{
+  pthread_mutex_lock(&results_lock);
+  free(*slot);
+  *slot = strndup(data, len);
+  pthread_mutex_unlock(&results_lock);
+}
+
+void output_write(const char* type, const char* data, size_t len)
+{
+  int n = type ? atoi(type) : -1;
+  if(n >= 0 && n < MAX_EVENTS)
+    record(results + n, data, len);
+}
+
+void send_reply(const char* reply_url, const char* event_id, const char* body, size_t len)
+{
+  int n = event_id ? atoi(event_id) : -1;
+  if(n >= 0 && n < MAX_EVENTS && !strcmp(reply_url, "http://localhost/reply"))
+    record(replies + n, body, len);
+}
+
+
+/* === tests ======================================================= */
+
+static char* command[] = {
+  "/bin/sh", "-c",
+  "while IFS= read -r line; do\n"
+  "  case \"$line\" in\n"
+  "  SSE_EVENT=*) type=${line#SSE_EVENT=} ;;\n"
+  "  SSE_DATA_LENGTH=*) len=${line#SSE_DATA_LENGTH=} ;;\n"
+  "  '')\n"
+  "    data=$(dd bs=1 count=$len 2>/dev/null)\n"
+  "    case \"$data\" in\n"
+  "    exit) exit 0 ;;\n"
+  "    garbage) printf 'garbage\\n'; continue ;;\n"
+  "    slow) sleep 0.3 ;;\n"
+  "    esac\n"
+  "    result=\"$type:$data\"\n"
+  "    printf '%d\\n%s' ${#result} \"$result\"\n"
+  "    type= ;;\n"
+  "  esac\n"
+  "done",
+  0
+};
+
+static void submit(int n, const char* data, const char* reply_url)
+{
+  char type[16], id[16], event_header[32], id_header[32];
+  sprintf(type, "%d", n);
+  sprintf(id, "%d", n);
+  sprintf(event_header, "EVENT=%d", n);
+  sprintf(id_header, "ID=%d", n);
+
+  char* headers[] = { event_header, id_header, 0 };
+  const char* values[SSE_MAX_FIELDS] = { 0 };
+  values[SSE_FIELD_EVENT] = type;
+  values[SSE_FIELD_ID] = id;
+
+  workers_submit(headers, values, data, reply_url);
+}
+
+/*
+ * wait up to 5 secs for the result of event \a n in \a slots; returns
+ * it, or NULL.
+ */
+static char* wait_for(char** slots, int n)
+{
+  int i;
+
+  for(i = 0; i < 500; ++i) {
+    pthread_mutex_lock(&results_lock);
+    char* result = slots[n];
+    pthread_mutex_unlock(&results_lock);
+
+    if(result)
+      return result;
+
+    struct timespec ts = { 0, 10000000 };
+    nanosleep(&ts, 0);
+  }
+
+  return 0;
+}
+
+static void check_result(char** slots, int n, const char* expected)
+{
+  char* result = wait_for(slots, n);
+  check(result && !strcmp(result, expected), "event %d: expected '%s', got '%s'", n, expected, result ? result : "(none)");
+}
+
+/*
+ * each event goes to the worker as a frame, and its answer comes back
+ * as the event's result, or reply.
+ */
+static void test_protocol()
+{
+  submit(1, "plain", 0);
+  submit(2, "two\nlines: and a colon", 0);
+  submit(3, "", 0);
+  submit(4, "replied", "http://localhost/reply");
+
+  check_result(results, 1, "1:plain");
+  check_result(results, 2, "2:two\nlines: and a colon");
+  check_result(results, 3, "3:");
+  check_result(replies, 4, "4:replied");
+}
+
+/*
+ * a worker that exits, or answers out of protocol, is restarted; its
+ * event is lost, the next ones are not.
+ */
+static void test_restart()
+{
+  int i;
+
+  submit(10, "exit", 0);
+  submit(11, "exit", 0);
+  submit(12, "garbage", 0);
+
+  for(i = 13; i < 20; ++i) {
+    char data[16];
+    sprintf(data, "after %d", i);
+    submit(i, data, 0);
+  }
+
+  for(i = 13; i < 20; ++i) {
+    char expected[32];
+    sprintf(expected, "%d:after %d", i, i);
+    check_result(results, i, expected);
+  }
+
+  pthread_mutex_lock(&results_lock);
+  for(i = 10; i < 13; ++i)
+    check(!results[i], "lost event %d has a result", i);
+  pthread_mutex_unlock(&results_lock);
+}
+
+static int count_threads()
+{
+  DIR* d = opendir("/proc/self/task");
+  int n = 0;
+
+  if(!d)
+    return -1;
+  while(readdir(d))
+    n++;
+  closedir(d);
+
+  return n - 2;   // "." and ".."
+}
+
+/*
+ * workers_drain waits for the events being handled, and ends the
+ * workers thread.
+ */
+static void test_drain()
+{
+  submit(30, "slow", 0);
+  submit(31, "slow", 0);
+  workers_drain();
+
+  pthread_mutex_lock(&results_lock);
+  check(results[30] && results[31], "drained before the results were in");
+  pthread_mutex_unlock(&results_lock);
+
+  int i, threads = -1;
+  for(i = 0; i < 100 && (threads = count_threads()) > 1; ++i) {
+    struct timespec ts = { 0, 10000000 };
+    nanosleep(&ts, 0);
+  }
+
+  check(threads == 1 || threads == -1, "%d threads left after workers_drain", threads);
+}
+
+int main()
+{
+  options.command = command;
+  options.command_workers = 2;
+
+  workers_start(2);
+
+  test_protocol();
+  test_restart();
+  test_drain();
+
+  return test_done("workers");
+}
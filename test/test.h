@@ -0,0 +1,47 @@
+/*
+ * This file is part of the sse package, copyright (c) 2011, 2012, @radiospiel.
+ * It is copyrighted under the terms of the modified BSD license, see LICENSE.BSD.
+ *
+ * For more information see https://https://github.com/radiospiel/sse.
+ */
+
+#ifndef TEST_H
+#define TEST_H
+
+/*
+ * The harness of the tests in test/; each test is a program of its own,
+ * run via "make test". It is linked with the parts of sse it tests, and
+ * with test/stubs.c, which stands in for the rest.
+ */
+
+#include "sse.h"
+
+static int failures = 0;
+
+/*
+ * report a failure, unless \a cond holds; the test goes on.
+ */
+#define check(cond, ...) do {                     \
+    if(!(cond)) {                                 \
+      fprintf(stderr, "%s:%d: ", __FILE__, __LINE__); \
+      fprintf(stderr, __VA_ARGS__);               \
+      fprintf(stderr, "\n");                      \
+      failures++;                                 \
+    }                                             \
+  } while(0)
+
+/*
+ * report the outcome of the test \a name; returns the exit status.
+ */
+static inline int test_done(const char* name)
+{
+  if(failures) {
+    fprintf(stderr, "%s: %d failure(s)\n", name, failures);
+    return 1;
+  }
+
+  printf("%s: ok\n", name);
+  return 0;
+}
+
+#endif